@@ -0,0 +1,250 @@
+/**
+ * @file CoroutineTimedEventQueue.hpp
+ * @brief A C++ header file containing the CoroutineTimedEventQueue class, which requires C++20.
+ *
+ * The CoroutineTimedEventQueue class lets C++20 coroutines sleep until a time
+ * point or for a duration with co_await queue.at(timestamp) or
+ * co_await queue.after(duration). The events of the underlying
+ * BasicTimedEventQueue point straight at the suspended awaiters, so the
+ * worker resumes a coroutine without looking anything up, and a sleep can be
+ * cancelled through a std::stop_token. Without C++20 coroutine support the
+ * header declares nothing.
+ */
+#pragma once
+
+#include "TimedEventQueue.hpp"
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>) && __has_include(<stop_token>)
+
+#include <atomic>
+#include <coroutine>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+
+/**
+ * @class CoroutineTimer
+ * @brief The state a suspended coroutine shares with the expiration path of a CoroutineTimedEventQueue.
+ *
+ * Exactly one of the expiration and the cancellation finishes a timer, since
+ * the cancellation only finishes it after removing its event from the queue.
+ * The timer is armed once the awaiting coroutine has been suspended; a timer
+ * finished before that is not resumed but lets await_suspend return false,
+ * so the coroutine never runs on two threads.
+ */
+class CoroutineTimer
+{
+private:
+    enum State : int
+    {
+        Arming, ///< The event has been added but the coroutine is not yet known to be suspended.
+        Armed,  ///< The coroutine is suspended and is resumed when the timer finishes.
+        Done,   ///< The timer has expired or has been cancelled.
+    };
+
+    std::coroutine_handle<> _handle;         ///< The suspended coroutine.
+    std::atomic<int>        _state = Arming; ///< The State of the timer.
+    bool                    _fired = false;  ///< Whether the deadline was reached, written before the timer is finished.
+
+protected:
+    void suspend(std::coroutine_handle<> handle) { _handle = handle; }
+
+    /**
+     * @brief Marks the coroutine as suspended, or returns false if the timer already finished and it must not suspend.
+     */
+    bool arm()
+    {
+        auto expected = static_cast<int>(Arming);
+        return _state.compare_exchange_strong(expected, Armed, std::memory_order_acq_rel);
+    }
+
+    bool armed() const { return _state.load(std::memory_order_acquire) == Armed; }
+
+    bool fired() const { return _fired; }
+
+    /**
+     * @brief Finishes the timer, resuming the coroutine if it is already suspended. The timer must not be used afterwards.
+     */
+    void finish(bool fired)
+    {
+        _fired = fired;
+        if(_state.exchange(Done, std::memory_order_acq_rel) == Armed)
+        {
+            _handle.resume();
+        }
+    }
+
+public:
+    CoroutineTimer() = default;
+
+    CoroutineTimer(const CoroutineTimer&) = delete;
+
+    CoroutineTimer& operator=(const CoroutineTimer&) = delete;
+
+    /**
+     * @brief The callback of the underlying queue, resuming the coroutine of an expired timer.
+     */
+    struct Expire
+    {
+        void operator()(const TIMESTAMP&, CoroutineTimer*&& timer) const { timer->finish(true); }
+    };
+};
+
+/**
+ * @class CoroutineTimedEventQueue
+ * @tparam Storage The storage policy of the underlying queue, a HeapStorage without value index by default.
+ * @tparam Clock The clock of the underlying queue, TIME by default.
+ *
+ * @brief A timed event queue whose events resume C++20 coroutines.
+ *
+ * co_await at(timestamp) and co_await after(duration) suspend the calling
+ * coroutine until the deadline, and evaluate to true once it was reached or
+ * to false if the sleep was cancelled through its std::stop_token or the
+ * storage was at its capacity. The awaiter lives in the coroutine frame and is
+ * the value of its event, so a sleep allocates nothing beyond the storage of
+ * its event, and the default storage keeps no value index. The coroutine is
+ * resumed on the worker thread when the deadline is reached, or on the thread
+ * requesting the stop when it is cancelled.
+ *
+ * The underlying queue always uses ExpirationMode::Unlocked, so that resumed
+ * coroutines can sleep again. SubmissionMode::LockFree is not supported since
+ * a cancellation has to know whether the event was removed. A coroutine must
+ * not be destroyed while it is suspended in a sleep.
+ */
+template<typename Storage = HeapStorage<CoroutineTimer*, NoValueIndex>, typename Clock = TIME>
+class CoroutineTimedEventQueue
+{
+public:
+    using Queue = BasicTimedEventQueue<CoroutineTimer*, CoroutineTimer::Expire, Storage, Clock>;
+
+    /**
+     * @class Awaiter
+     * @brief The awaitable returned by at and after, suspending the awaiting coroutine until its deadline.
+     */
+    class Awaiter : private CoroutineTimer
+    {
+    private:
+        /**
+         * @brief The stop callback of a sleep, cancelling it unless its expiration is already in flight.
+         */
+        struct Cancel
+        {
+            Awaiter* awaiter;
+
+            void operator()() const
+            {
+                if(awaiter->_queue.removeEvent(awaiter->_timer))
+                {
+                    awaiter->finish(false);
+                }
+            }
+        };
+
+        Queue&                                    _queue;    ///< The queue the event is added to.
+        TIMESTAMP                                 _deadline; ///< The time point the coroutine sleeps until.
+        std::stop_token                           _token;    ///< The token cancelling the sleep.
+        TimerHandle                               _timer;    ///< The handle of the event, written before the stop callback is registered.
+        std::optional<std::stop_callback<Cancel>> _cancel;   ///< The stop callback, registered while the coroutine is suspended.
+
+    public:
+        Awaiter(Queue& queue, const TIMESTAMP& deadline, std::stop_token token)
+            : _queue(queue)
+            , _deadline(deadline)
+            , _token(std::move(token))
+        {
+        }
+
+        ~Awaiter()
+        {
+            if(armed())
+            {
+                _cancel.reset();
+                _queue.removeEvent(_timer);
+            }
+        }
+
+        bool await_ready() const noexcept { return _token.stop_requested(); }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            suspend(handle);
+            _timer = _queue.addEvent(_deadline, static_cast<CoroutineTimer*>(this));
+            if(!_timer.valid())
+            {
+                return false;
+            }
+            if(_token.stop_possible())
+            {
+                _cancel.emplace(_token, Cancel{this});
+            }
+            return arm();
+        }
+
+        /**
+         * @brief Returns whether the deadline was reached, false if the sleep was cancelled or the storage was full.
+         */
+        bool await_resume()
+        {
+            _cancel.reset();
+            return fired();
+        }
+    };
+
+private:
+    Queue _queue; ///< The queue holding the events of the sleeping coroutines.
+
+    static TimedEventQueueOptions validated(TimedEventQueueOptions options)
+    {
+        if(options.submissionMode == SubmissionMode::LockFree)
+        {
+            throw std::invalid_argument("CoroutineTimedEventQueue: SubmissionMode::LockFree is not supported");
+        }
+        options.expirationMode = ExpirationMode::Unlocked;
+        return options;
+    }
+
+public:
+    /**
+     * @brief Constructs the underlying queue and starts its worker thread, unless it has an external driver.
+     *
+     * @param options The options of the underlying queue. Its expirationMode is overridden with ExpirationMode::Unlocked.
+     * @param storage The storage policy instance.
+     * @throws std::invalid_argument If the options select SubmissionMode::LockFree, or are invalid for the underlying queue.
+     */
+    explicit CoroutineTimedEventQueue(const TimedEventQueueOptions& options = TimedEventQueueOptions(), Storage storage = Storage())
+        : _queue(CoroutineTimer::Expire(), validated(options), std::move(storage))
+    {
+    }
+
+    /**
+     * @brief Returns an awaitable suspending the awaiting coroutine until @p deadline.
+     *
+     * @param deadline The time point to sleep until.
+     * @param token The token cancelling the sleep, which resumes the coroutine at once with false.
+     */
+    Awaiter at(const TIMESTAMP& deadline, std::stop_token token = std::stop_token()) { return Awaiter(_queue, deadline, std::move(token)); }
+
+    /**
+     * @brief Returns an awaitable suspending the awaiting coroutine for @p delay, measured with the clock of the queue.
+     *
+     * @param delay The duration to sleep for.
+     * @param token The token cancelling the sleep, which resumes the coroutine at once with false.
+     */
+    template<typename Rep, typename Period>
+    Awaiter after(const std::chrono::duration<Rep, Period>& delay, std::stop_token token = std::stop_token())
+    {
+        return at(_queue.now() + std::chrono::duration_cast<TIMESTAMP::duration>(delay), std::move(token));
+    }
+
+    /**
+     * @brief Returns the underlying queue, for example to drive it with processExpired or to read its counters.
+     */
+    Queue& queue() { return _queue; }
+
+    /**
+     * @brief Stops the worker thread. The coroutines still sleeping are not resumed.
+     */
+    void stop() { _queue.stop(); }
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include "CoroutineTimedEventQueue.hpp"
+#include "TimedEventQueueTest.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/**
+ * @brief A coroutine that starts at once and destroys itself when it returns, enough to await the sleeps of the tests.
+ */
+struct Task
+{
+    struct promise_type
+    {
+        Task               get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void               return_void() {}
+        [[noreturn]] void  unhandled_exception() { std::terminate(); }
+    };
+};
+
+/**
+ * @brief What a sleeping coroutine reports once it is resumed.
+ */
+struct Outcome
+{
+    std::atomic<int>             resumed{0};   ///< How often the coroutine was resumed from the sleep.
+    std::atomic<bool>            fired{false}; ///< Whether the sleep reached its deadline.
+    std::atomic<std::thread::id> thread;       ///< The thread that resumed the coroutine.
+};
+
+Task sleepUntil(CoroutineTimedEventQueue<>& timers, TIMESTAMP deadline, std::stop_token token, Outcome& outcome)
+{
+    auto fired = co_await timers.at(deadline, std::move(token));
+    outcome.fired.store(fired);
+    outcome.thread.store(std::this_thread::get_id());
+    outcome.resumed.fetch_add(1);
+}
+
+Task sleepRepeatedly(CoroutineTimedEventQueue<>& timers, int times, std::mutex& mutex, std::vector<int>& order, int id)
+{
+    for(auto time = 0; time < times; ++time)
+    {
+        if(!co_await timers.after(std::chrono::milliseconds(5 + id * 3)))
+        {
+            co_return;
+        }
+        std::scoped_lock lock(mutex);
+        order.push_back(id);
+    }
+}
+
+/**
+ * @brief Checks that sleeps are resumed on the worker thread at their deadline, and that a resumed coroutine can sleep again.
+ */
+void testExpiry()
+{
+    CoroutineTimedEventQueue<> timers;
+    Outcome                    outcome;
+    auto                       start = TIME::now();
+    sleepUntil(timers, start + std::chrono::milliseconds(20), std::stop_token(), outcome);
+    CHECK(outcome.resumed.load() == 0);
+    CHECK(eventually([&] { return outcome.resumed.load() == 1; }));
+    CHECK(outcome.fired.load() && TIME::now() >= start + std::chrono::milliseconds(20));
+    CHECK(outcome.thread.load() != std::this_thread::get_id());
+
+    std::mutex       mutex;
+    std::vector<int> order;
+    sleepRepeatedly(timers, 3, mutex, order, 0);
+    sleepRepeatedly(timers, 1, mutex, order, 10);
+    CHECK(eventually([&] {
+        std::scoped_lock lock(mutex);
+        return order.size() == 4;
+    }));
+    CHECK((order == std::vector<int>{0, 0, 0, 10}));
+    CHECK(eventually([&] { return timers.queue().size() == 0; }));
+    timers.stop();
+}
+
+/**
+ * @brief Checks that a stop request resumes a sleep at once on the requesting thread with false and removes its event.
+ */
+void testCancel()
+{
+    CoroutineTimedEventQueue<> timers;
+    {
+        Outcome          outcome;
+        std::stop_source source;
+        sleepUntil(timers, TIME::now() + std::chrono::hours(1), source.get_token(), outcome);
+        CHECK(timers.queue().size() == 1 && outcome.resumed.load() == 0);
+        source.request_stop();
+        CHECK(outcome.resumed.load() == 1 && !outcome.fired.load());
+        CHECK(outcome.thread.load() == std::this_thread::get_id());
+        CHECK(timers.queue().size() == 0);
+    }
+    {
+        // A token stopped before the sleep does not suspend the coroutine at all.
+        Outcome          outcome;
+        std::stop_source source;
+        source.request_stop();
+        sleepUntil(timers, TIME::now() + std::chrono::hours(1), source.get_token(), outcome);
+        CHECK(outcome.resumed.load() == 1 && !outcome.fired.load());
+        CHECK(timers.queue().size() == 0);
+    }
+    {
+        // A stop requested after the expiration does nothing.
+        Outcome          outcome;
+        std::stop_source source;
+        sleepUntil(timers, TIME::now() + std::chrono::milliseconds(5), source.get_token(), outcome);
+        CHECK(eventually([&] { return outcome.resumed.load() == 1; }));
+        source.request_stop();
+        CHECK(outcome.resumed.load() == 1 && outcome.fired.load());
+    }
+    timers.stop();
+}
+
+/**
+ * @brief Requests stops while the worker expires the same sleeps, and checks that every coroutine is resumed exactly once.
+ */
+void testStopRace()
+{
+    constexpr int SLEEPS = 2000;
+
+    CoroutineTimedEventQueue<>    timers;
+    std::vector<Outcome>          outcomes(SLEEPS);
+    std::vector<std::stop_source> sources(SLEEPS);
+    std::mt19937                  generator(7);
+    for(auto sleep = 0; sleep < SLEEPS; ++sleep)
+    {
+        sleepUntil(timers, TIME::now() + std::chrono::microseconds(generator() % 200), sources[sleep].get_token(), outcomes[sleep]);
+        if(sleep % 8 == 7)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(generator() % 200));
+            for(auto stopped = sleep - 7; stopped <= sleep; stopped += 2)
+            {
+                sources[stopped].request_stop();
+            }
+        }
+    }
+    CHECK(eventually([&] {
+        for(const auto& outcome : outcomes)
+        {
+            if(outcome.resumed.load() == 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }));
+    timers.stop();
+    auto fired = 0;
+    for(auto sleep = 0; sleep < SLEEPS; ++sleep)
+    {
+        CHECK(outcomes[sleep].resumed.load() == 1);
+        CHECK(sleep % 2 == 0 || outcomes[sleep].fired.load());
+        fired += outcomes[sleep].fired.load() ? 1 : 0;
+    }
+    CHECK(timers.queue().size() == 0);
+    CHECK(fired >= SLEEPS / 2);
+}
+
+/**
+ * @brief Checks that a sleep the full storage rejects resumes at once with false, and that LockFree submission is rejected.
+ */
+void testCapacity()
+{
+    CoroutineTimedEventQueue<> timers(TimedEventQueueOptions(), HeapStorage<CoroutineTimer*, NoValueIndex>(StorageMemory(1)));
+    Outcome                    first;
+    Outcome                    second;
+    std::stop_source           source;
+    sleepUntil(timers, TIME::now() + std::chrono::hours(1), source.get_token(), first);
+    sleepUntil(timers, TIME::now() + std::chrono::milliseconds(1), std::stop_token(), second);
+    CHECK(second.resumed.load() == 1 && !second.fired.load());
+    CHECK(second.thread.load() == std::this_thread::get_id());
+    CHECK(timers.queue().capacityRejections() == 1 && first.resumed.load() == 0);
+    source.request_stop();
+    CHECK(first.resumed.load() == 1 && !first.fired.load());
+    timers.stop();
+
+    TimedEventQueueOptions lockFree;
+    lockFree.submissionMode = SubmissionMode::LockFree;
+    auto thrown             = false;
+    try
+    {
+        CoroutineTimedEventQueue<> rejected(lockFree);
+    }
+    catch(const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    return runTestSuites(argc, argv, {
+        {"expiry", testExpiry},
+        {"cancel", testCancel},
+        {"race", testStopRace},
+        {"capacity", testCapacity},
+    });
+}
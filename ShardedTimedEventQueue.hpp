@@ -0,0 +1,653 @@
+/**
+ * @file ShardedTimedEventQueue.hpp
+ * @brief A C++ header file containing the ShardedTimedEventQueue class.
+ *
+ * The ShardedTimedEventQueue class partitions its events across several
+ * BasicTimedEventQueue shards, each with its own mutex, storage and worker
+ * thread, so that expirations and modifications of different shards do not
+ * contend.
+ * Events are routed to their shard by the hash of their value or by the
+ * thread adding them.
+ */
+#pragma once
+
+#include "TimedEventQueue.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * @enum ShardingMode
+ * @brief Selects how a ShardedTimedEventQueue routes events to its shards.
+ */
+enum class ShardingMode
+{
+    /**
+     * An event belongs to the shard selected by the hash of its value, so
+     * events are found by value in their shard only.
+     */
+    ByValue,
+    /**
+     * An event belongs to the shard selected by the thread that adds it, so
+     * producers that each own a shard never contend. Events are looked up by
+     * value in every shard.
+     */
+    ByThread,
+};
+
+/**
+ * @struct ShardedTimerHandle
+ * @brief A handle to an event of a ShardedTimedEventQueue, holding the shard of the event and its handle in that shard.
+ */
+struct ShardedTimerHandle
+{
+    std::uint32_t shard = 0; ///< The index of the shard holding the event.
+    TimerHandle   handle;    ///< The handle of the event in its shard.
+
+    bool valid() const { return handle.valid(); }
+
+    friend bool operator==(const ShardedTimerHandle& lhs, const ShardedTimerHandle& rhs) { return lhs.shard == rhs.shard && lhs.handle == rhs.handle; }
+
+    friend bool operator!=(const ShardedTimerHandle& lhs, const ShardedTimerHandle& rhs) { return !(lhs == rhs); }
+};
+
+/**
+ * @struct ShardedTimedEventQueueOptions
+ * @brief The options a ShardedTimedEventQueue is constructed with.
+ */
+struct ShardedTimedEventQueueOptions
+{
+    std::size_t            shards     = std::thread::hardware_concurrency(); ///< The number of shards, at least 1.
+    ShardingMode           sharding   = ShardingMode::ByValue;               ///< How events are routed to their shard.
+    bool                   pinWorkers = false;                               ///< Whether the worker of shard i is pinned to CPU i modulo the number of CPUs.
+    TimedEventQueueOptions queue;                                            ///< The options of every shard. Its workerCpu is overridden when pinWorkers is set.
+};
+
+/**
+ * @class ShardedTimedEventQueue
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam Storage The storage policy of every shard, OrderedMapStorage<T> by default.
+ * @tparam Hash The hash function routing values to their shard with ShardingMode::ByValue.
+ *
+ * @brief A timed event queue whose events are partitioned across independent TimedEventQueue shards.
+ *
+ * Each shard has its own worker thread, which calls onTimestampExpire for the
+ * events of that shard. The callback can therefore run concurrently for
+ * events of different shards, and events of different shards expire in no
+ * particular order relative to each other; within a shard the guarantees of
+ * TimedEventQueue hold.
+ *
+ * Values are unique per shard only. With ShardingMode::ByThread the same
+ * value added from several threads can be pending in several shards, once in
+ * each; removeEvent(value) then removes all of them, and
+ * updateTimestamp(timestamp, value) reschedules all of them to the same
+ * timestamp.
+ *
+ * Removing or rescheduling an event by handle, and by value with
+ * ShardingMode::ByValue, only locks its shard. Removing events by timestamp,
+ * by value with ShardingMode::ByThread, and updating the value of an event
+ * visit every shard. The batch members group their range by shard and lock
+ * every shard they touch once.
+ */
+template<typename T, typename Storage = OrderedMapStorage<T>, typename Hash = std::hash<T>>
+class ShardedTimedEventQueue
+{
+private:
+    /**
+     * @brief The callback of a shard, forwarding the expirations of its events to the owning queue.
+     */
+    struct ShardCallback
+    {
+        ShardedTimedEventQueue* owner; ///< The queue the shard belongs to.
+
+        void operator()(const TIMESTAMP& timestamp, T&& value) const { owner->onTimestampExpireOwned(timestamp, std::move(value)); }
+    };
+
+    using Shard = BasicTimedEventQueue<T, ShardCallback, Storage>;
+
+    const ShardingMode                  _sharding; ///< How events are routed to their shard.
+    const bool                          _lockFree; ///< Whether the shards take commands with SubmissionMode::LockFree.
+    Hash                                _hash;     ///< The hash function routing values with ShardingMode::ByValue.
+    std::vector<std::unique_ptr<Shard>> _shards;   ///< The shards, each with its own worker thread.
+
+    std::uint32_t shardOf(const T& value) const
+    {
+        if(_sharding == ShardingMode::ByValue)
+        {
+            return static_cast<std::uint32_t>(_hash(value) % _shards.size());
+        }
+        return shardOfThread();
+    }
+
+    std::uint32_t shardOfThread() const { return static_cast<std::uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id()) % _shards.size()); }
+
+    /**
+     * @brief Splits a range into one vector per shard, skipping the elements route maps to no shard.
+     *
+     * @param route A callable returning the shard of an element and the element as its shard takes it.
+     */
+    template<typename Event, typename InputIt, typename Route>
+    std::vector<std::vector<Event>> groupByShard(InputIt first, InputIt last, Route route) const
+    {
+        std::vector<std::vector<Event>> groups(_shards.size());
+        for(; first != last; ++first)
+        {
+            auto [shard, event] = route(*first);
+            if(shard < groups.size())
+            {
+                groups[shard].push_back(std::move(event));
+            }
+        }
+        return groups;
+    }
+
+    /**
+     * @brief Adds an event taken out of a shard with extractEvent to @p shard, keeping it periodic if it was.
+     */
+    static TimerHandle add(Shard& shard, const TIMESTAMP& timestamp, const T& value, const ExtractedEvent<T>& event)
+    {
+        if(event.period > TIMESTAMP::duration::zero())
+        {
+            return shard.addPeriodicEvent(timestamp, event.period, value, event.recurrence);
+        }
+        return shard.addEvent(timestamp, value);
+    }
+
+protected:
+    /**
+     * @brief A pure virtual function that must be implemented by the user, called when an event's timestamp expires.
+     *
+     * This function is called by the worker thread of the shard holding the
+     * event, so it can be called concurrently for events of different shards.
+     *
+     * @param timestamp The expired timestamp.
+     * @param value The value associated with the expired timestamp.
+     */
+    virtual void onTimestampExpire(const TIMESTAMP& timestamp, const T& value) = 0;
+
+    /**
+     * @brief Called instead of onTimestampExpire with ownership of the expired value. The default calls onTimestampExpire.
+     *
+     * @param timestamp The expired timestamp.
+     * @param value The value associated with the expired timestamp.
+     */
+    virtual void onTimestampExpireOwned(const TIMESTAMP& timestamp, T&& value) { onTimestampExpire(timestamp, value); }
+
+public:
+    /**
+     * @brief Constructs the shards and starts their worker threads.
+     *
+     * @param options The number of shards, the sharding mode and the options of every shard.
+     * @param makeStorage A callable returning the storage policy instance of a shard, called once per shard.
+     * @throws std::invalid_argument If the number of shards is 0.
+     */
+    explicit ShardedTimedEventQueue(const ShardedTimedEventQueueOptions& options = ShardedTimedEventQueueOptions(),
+                                    const std::function<Storage()>& makeStorage = [] { return Storage(); })
+        : _sharding(options.sharding)
+        , _lockFree(options.queue.submissionMode == SubmissionMode::LockFree && !options.queue.singleThreaded)
+    {
+        if(options.shards == 0)
+        {
+            throw std::invalid_argument("ShardedTimedEventQueue: the number of shards must be positive");
+        }
+        auto cpus = std::max(std::thread::hardware_concurrency(), 1u);
+        _shards.reserve(options.shards);
+        for(std::size_t shard = 0; shard < options.shards; ++shard)
+        {
+            auto queueOptions = options.queue;
+            if(options.pinWorkers)
+            {
+                queueOptions.workerCpu = static_cast<int>(shard % cpus);
+            }
+            _shards.push_back(std::make_unique<Shard>(ShardCallback{this}, makeStorage(), queueOptions));
+        }
+    }
+
+    /**
+     * @brief Destructs the ShardedTimedEventQueue object, stopping the worker threads of all shards if they are still running.
+     *
+     * As with TimedEventQueue, the override of onTimestampExpire is already
+     * destroyed when this destructor runs, so a subclass has to call stop()
+     * in its own destructor.
+     */
+    virtual ~ShardedTimedEventQueue() { stop(); }
+
+    ShardedTimedEventQueue(const ShardedTimedEventQueue&) = delete;
+
+    ShardedTimedEventQueue& operator=(const ShardedTimedEventQueue&) = delete;
+
+    /**
+     * @brief Adds an event with the specified timestamp and value to the shard it is routed to.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    ShardedTimerHandle addEvent(const TIMESTAMP& timestamp, const T& value)
+    {
+        auto shard = shardOf(value);
+        return ShardedTimerHandle{shard, _shards[shard]->addEvent(timestamp, value)};
+    }
+
+    /**
+     * @brief Adds an event with the specified timestamp to the shard it is routed to, moving the value into the shard.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    ShardedTimerHandle addEvent(const TIMESTAMP& timestamp, T&& value)
+    {
+        auto shard = shardOf(value);
+        return ShardedTimerHandle{shard, _shards[shard]->addEvent(timestamp, std::move(value))};
+    }
+
+    /**
+     * @brief Adds a periodic event to the shard it is routed to, see BasicTimedEventQueue::addPeriodicEvent.
+     *
+     * @param first The timestamp of the first occurrence.
+     * @param interval The interval between two occurrences, which must be positive.
+     * @param value The value associated with the event.
+     * @param recurrence Whether the interval is measured from the previous deadline or from the previous expiration.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     * @throws std::invalid_argument If the interval is not positive.
+     */
+    template<typename Rep, typename Period>
+    ShardedTimerHandle addPeriodicEvent(const TIMESTAMP& first, const std::chrono::duration<Rep, Period>& interval, const T& value,
+                                        Recurrence recurrence = Recurrence::FixedRate)
+    {
+        auto shard = shardOf(value);
+        return ShardedTimerHandle{shard, _shards[shard]->addPeriodicEvent(first, interval, value, recurrence)};
+    }
+
+    /**
+     * @brief Removes the event the handle refers to from its shard.
+     *
+     * @param handle The handle of the event to remove.
+     * @return Whether the event was still pending.
+     */
+    bool removeEvent(const ShardedTimerHandle& handle) { return handle.shard < _shards.size() && _shards[handle.shard]->removeEvent(handle.handle); }
+
+    /**
+     * @brief Removes the event with the specified value from the queue.
+     *
+     * @param value The value of the event to remove.
+     */
+    void removeEvent(const T& value)
+    {
+        if(_sharding == ShardingMode::ByValue)
+        {
+            _shards[shardOf(value)]->removeEvent(value);
+            return;
+        }
+        for(auto& shard : _shards)
+        {
+            shard->removeEvent(value);
+        }
+    }
+
+    /**
+     * @brief Removes the events with the specified timestamp from every shard.
+     *
+     * @param timestamp The timestamp of the events to remove.
+     */
+    void removeEvent(const TIMESTAMP& timestamp)
+    {
+        for(auto& shard : _shards)
+        {
+            shard->removeEvent(timestamp);
+        }
+    }
+
+    /**
+     * @brief Updates the value associated with the specified timestamp.
+     *
+     * With ShardingMode::ByValue the event belongs to the shard of its old
+     * value, so every shard is visited. Nothing happens if an event with the
+     * new value is pending, as with BasicTimedEventQueue::updateValue. An event
+     * with the timestamp found in another shard than the one of the new value
+     * is moved there with its interval and recurrence: it is extracted under
+     * the lock of its shard and then added to the shard of the new value. If
+     * that shard rejects it at its capacity, the event is added back to its
+     * shard under its old value. A moved event gets a new handle in its new
+     * shard, so the handle returned when it was added becomes stale. Otherwise
+     * the earliest added event with the timestamp in the shard of the new value
+     * is updated. With ShardingMode::ByThread every shard updates its earliest
+     * added event with the timestamp.
+     *
+     * @param timestamp The timestamp of the event to update.
+     * @param value The new value to associate with the timestamp.
+     * @throws std::logic_error With ShardingMode::ByValue and SubmissionMode::LockFree shards, which cannot move an event
+     * between shards.
+     */
+    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    {
+        if(_sharding == ShardingMode::ByThread)
+        {
+            for(auto& shard : _shards)
+            {
+                shard->updateValue(timestamp, value);
+            }
+            return;
+        }
+        if(_lockFree)
+        {
+            throw std::logic_error("ShardedTimedEventQueue: updateValue needs SubmissionMode::Locked shards with ShardingMode::ByValue");
+        }
+        auto target = shardOf(value);
+        if(_shards[target]->contains(value))
+        {
+            return;
+        }
+        for(std::uint32_t shard = 0; shard < _shards.size(); ++shard)
+        {
+            if(shard == target)
+            {
+                continue;
+            }
+            if(auto event = _shards[shard]->extractEvent(timestamp))
+            {
+                if(!add(*_shards[target], timestamp, value, *event).valid())
+                {
+                    add(*_shards[shard], timestamp, event->value, *event);
+                }
+                return;
+            }
+        }
+        _shards[target]->updateValue(timestamp, value);
+    }
+
+    /**
+     * @brief Updates the timestamp of the event the handle refers to.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was still pending.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const ShardedTimerHandle& handle)
+    {
+        return handle.shard < _shards.size() && _shards[handle.shard]->updateTimestamp(timestamp, handle.handle);
+    }
+
+    /**
+     * @brief Updates the timestamp associated with the specified value in the queue.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param value The value of the event to update.
+     */
+    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    {
+        if(_sharding == ShardingMode::ByValue)
+        {
+            _shards[shardOf(value)]->updateTimestamp(timestamp, value);
+            return;
+        }
+        for(auto& shard : _shards)
+        {
+            shard->updateTimestamp(timestamp, value);
+        }
+    }
+
+    /**
+     * @brief Adds a range of (timestamp, value) pairs, grouped by the shard they are routed to.
+     *
+     * Every shard receives its part of the range through a single
+     * BasicTimedEventQueue::addEvents call; with ShardingMode::ByThread the
+     * whole range goes to the shard of the calling thread.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @param handles An output iterator receiving the handle of every event of the range, in the order of the range.
+     * @return The output iterator past the last written handle.
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt addEvents(InputIt first, InputIt last, OutputIt handles)
+    {
+        std::vector<std::uint32_t> routes;
+        auto                       groups = groupByShard<std::pair<TIMESTAMP, T>>(first, last, [this, &routes](const auto& event) {
+            const auto& [timestamp, value] = event;
+            routes.push_back(shardOf(value));
+            return std::make_pair(routes.back(), std::pair<TIMESTAMP, T>(timestamp, value));
+        });
+        std::vector<std::vector<TimerHandle>> added(_shards.size());
+        for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+        {
+            if(!groups[shard].empty())
+            {
+                added[shard].reserve(groups[shard].size());
+                _shards[shard]->addEvents(groups[shard].begin(), groups[shard].end(), std::back_inserter(added[shard]));
+            }
+        }
+        std::vector<std::size_t> next(_shards.size());
+        for(auto shard : routes)
+        {
+            *handles++ = ShardedTimerHandle{shard, added[shard][next[shard]++]};
+        }
+        return handles;
+    }
+
+    /**
+     * @brief Adds a range of (timestamp, value) pairs, grouped by the shard they are routed to.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @return The number of events that were added.
+     */
+    template<typename InputIt>
+    std::size_t addEvents(InputIt first, InputIt last)
+    {
+        if(_sharding == ShardingMode::ByThread)
+        {
+            return _shards[shardOfThread()]->addEvents(first, last);
+        }
+        auto groups = groupByShard<std::pair<TIMESTAMP, T>>(first, last, [this](const auto& event) {
+            const auto& [timestamp, value] = event;
+            return std::make_pair(shardOf(value), std::pair<TIMESTAMP, T>(timestamp, value));
+        });
+        auto added = std::size_t(0);
+        for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+        {
+            if(!groups[shard].empty())
+            {
+                added += _shards[shard]->addEvents(groups[shard]);
+            }
+        }
+        return added;
+    }
+
+    /**
+     * @brief Adds all events of a container of (timestamp, value) pairs, grouped by the shard they are routed to.
+     *
+     * @param events The container of events, such as a std::vector<std::pair<TIMESTAMP, T>>.
+     * @return The number of events that were added.
+     */
+    template<typename Range>
+    std::size_t addEvents(const Range& events)
+    {
+        return addEvents(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Removes a range of values, timestamps or handles, grouped by the shard holding them.
+     *
+     * Handles, and values with ShardingMode::ByValue, are removed from their
+     * shard only, every shard receiving its part through a single
+     * BasicTimedEventQueue::removeEvents call. Timestamps, and values with
+     * ShardingMode::ByThread, are removed from every shard, which requires a
+     * multi-pass range.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     */
+    template<typename InputIt>
+    void removeEvents(InputIt first, InputIt last)
+    {
+        using Event = std::decay_t<decltype(*first)>;
+        if constexpr(std::is_same_v<Event, ShardedTimerHandle>)
+        {
+            auto groups = groupByShard<TimerHandle>(first, last, [](const ShardedTimerHandle& handle) { return std::make_pair(handle.shard, handle.handle); });
+            for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+            {
+                if(!groups[shard].empty())
+                {
+                    _shards[shard]->removeEvents(groups[shard]);
+                }
+            }
+        }
+        else if constexpr(std::is_same_v<Event, TIMESTAMP>)
+        {
+            for(auto& shard : _shards)
+            {
+                shard->removeEvents(first, last);
+            }
+        }
+        else if(_sharding == ShardingMode::ByThread)
+        {
+            for(auto& shard : _shards)
+            {
+                shard->removeEvents(first, last);
+            }
+        }
+        else
+        {
+            auto groups = groupByShard<T>(first, last, [this](const T& value) { return std::make_pair(shardOf(value), value); });
+            for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+            {
+                if(!groups[shard].empty())
+                {
+                    _shards[shard]->removeEvents(groups[shard]);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Removes all events of a container of values, timestamps or handles, grouped by the shard holding them.
+     *
+     * @param events The container of events to remove.
+     */
+    template<typename Range>
+    void removeEvents(const Range& events)
+    {
+        removeEvents(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Updates the timestamps of a range of (timestamp, value) or (timestamp, handle) pairs, grouped by shard.
+     *
+     * Handles, and values with ShardingMode::ByValue, are rescheduled in their
+     * shard only, every shard receiving its part through a single
+     * BasicTimedEventQueue::updateTimestamps call. Values with
+     * ShardingMode::ByThread are rescheduled in every shard, which requires a
+     * multi-pass range.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     */
+    template<typename InputIt>
+    void updateTimestamps(InputIt first, InputIt last)
+    {
+        using Event = std::decay_t<decltype(std::get<1>(*first))>;
+        if constexpr(std::is_same_v<Event, ShardedTimerHandle>)
+        {
+            auto groups = groupByShard<std::pair<TIMESTAMP, TimerHandle>>(first, last, [](const auto& update) {
+                const auto& [timestamp, handle] = update;
+                return std::make_pair(handle.shard, std::make_pair(timestamp, handle.handle));
+            });
+            for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+            {
+                if(!groups[shard].empty())
+                {
+                    _shards[shard]->updateTimestamps(groups[shard]);
+                }
+            }
+        }
+        else if(_sharding == ShardingMode::ByThread)
+        {
+            for(auto& shard : _shards)
+            {
+                shard->updateTimestamps(first, last);
+            }
+        }
+        else
+        {
+            auto groups = groupByShard<std::pair<TIMESTAMP, T>>(first, last, [this](const auto& update) {
+                const auto& [timestamp, value] = update;
+                return std::make_pair(shardOf(value), std::pair<TIMESTAMP, T>(timestamp, value));
+            });
+            for(std::size_t shard = 0; shard < _shards.size(); ++shard)
+            {
+                if(!groups[shard].empty())
+                {
+                    _shards[shard]->updateTimestamps(groups[shard]);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Updates the timestamps of all events of a container of (timestamp, value) or (timestamp, handle) pairs, grouped by shard.
+     *
+     * @param events The container of updates.
+     */
+    template<typename Range>
+    void updateTimestamps(const Range& events)
+    {
+        updateTimestamps(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Returns the number of shards.
+     */
+    std::size_t shards() const { return _shards.size(); }
+
+    /**
+     * @brief Returns how many modifications did not wake a worker thread, summed over all shards.
+     */
+    std::uint64_t avoidedWakeups() const
+    {
+        auto avoided = std::uint64_t(0);
+        for(const auto& shard : _shards)
+        {
+            avoided += shard->avoidedWakeups();
+        }
+        return avoided;
+    }
+
+    /**
+     * @brief Returns how many events were not added because their shard was at its capacity, summed over all shards.
+     */
+    std::uint64_t capacityRejections() const
+    {
+        auto rejected = std::uint64_t(0);
+        for(const auto& shard : _shards)
+        {
+            rejected += shard->capacityRejections();
+        }
+        return rejected;
+    }
+
+    /**
+     * @brief Stops the worker threads of all shards.
+     *
+     * Like TimedEventQueue::stop, it should be called before the object is
+     * destroyed, so that no worker calls onTimestampExpire on a partially
+     * destroyed object.
+     */
+    void stop()
+    {
+        for(auto& shard : _shards)
+        {
+            shard->stop();
+        }
+    }
+};
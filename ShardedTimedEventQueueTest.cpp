@@ -0,0 +1,187 @@
+#include "ShardedTimedEventQueue.hpp"
+#include "TimedEventQueueTest.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+/**
+ * @brief Routes every value to the shard of its remainder, so that the tests know which shard holds an event.
+ */
+struct Identity
+{
+    std::size_t operator()(int value) const { return static_cast<std::size_t>(value); }
+};
+
+/**
+ * @brief A sharded queue with two shards, recording the expired events.
+ */
+class Recorder : public ShardedTimedEventQueue<int, OrderedMapStorage<int>, Identity>
+{
+private:
+    mutable std::mutex                     _mutex;
+    std::vector<std::pair<TIMESTAMP, int>> _expired;
+
+protected:
+    void onTimestampExpire(const TIMESTAMP& timestamp, const int& value) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _expired.emplace_back(timestamp, value);
+    }
+
+public:
+    explicit Recorder(ShardingMode sharding = ShardingMode::ByValue, TimedEventQueueOptions queue = TimedEventQueueOptions(),
+                      std::size_t capacity = 0)
+        : ShardedTimedEventQueue(ShardedTimedEventQueueOptions{2, sharding, false, queue},
+                                 [capacity] { return OrderedMapStorage<int>(StorageMemory(capacity)); })
+    {
+    }
+
+    ~Recorder() override { stop(); }
+
+    std::vector<std::pair<TIMESTAMP, int>> expired() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _expired;
+    }
+
+    std::size_t count(int value) const
+    {
+        auto events = expired();
+        return static_cast<std::size_t>(std::count_if(events.begin(), events.end(), [value](const auto& event) { return event.second == value; }));
+    }
+
+    /**
+     * @brief Waits until @p events have expired, then a little longer so that spurious expirations show up too.
+     */
+    std::vector<std::pair<TIMESTAMP, int>> await(std::size_t events) const
+    {
+        CHECK(eventually([&] { return expired().size() >= events; }));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        return expired();
+    }
+};
+
+using Expired = std::vector<std::pair<TIMESTAMP, int>>;
+
+TIMESTAMP soon(int milliseconds) { return TIME::now() + std::chrono::milliseconds(milliseconds); }
+
+/**
+ * @brief Checks that events are routed by value and that their handles and values reach the right shard.
+ */
+void testRouting()
+{
+    Recorder queue;
+    CHECK(queue.shards() == 2);
+    auto t1     = soon(100);
+    auto even   = queue.addEvent(t1, 2);
+    auto odd    = queue.addEvent(t1, 3);
+    auto erased = queue.addEvent(t1, 5);
+    CHECK(even.valid() && even.shard == 0);
+    CHECK(odd.valid() && odd.shard == 1);
+    CHECK(queue.removeEvent(erased));
+    CHECK(!queue.removeEvent(erased));
+    CHECK(!queue.removeEvent(ShardedTimerHandle{7, erased.handle}));
+    queue.removeEvent(3);
+    CHECK(queue.updateTimestamp(t1 + std::chrono::milliseconds(10), even));
+
+    std::vector<std::pair<TIMESTAMP, int>> batch{{t1, 4}, {t1, 7}, {t1, 6}};
+    std::vector<ShardedTimerHandle>        handles;
+    queue.addEvents(batch.begin(), batch.end(), std::back_inserter(handles));
+    CHECK(handles.size() == 3 && handles[0].shard == 0 && handles[1].shard == 1 && handles[2].shard == 0);
+    queue.updateTimestamp(t1 + std::chrono::milliseconds(20), 7);
+
+    auto expired = queue.await(4);
+    CHECK((expired.size() == 4 && queue.count(2) == 1 && queue.count(4) == 1 && queue.count(6) == 1 && queue.count(7) == 1));
+    CHECK(queue.count(3) == 0 && queue.count(5) == 0);
+    CHECK(std::find(expired.begin(), expired.end(), std::make_pair(t1 + std::chrono::milliseconds(20), 7)) != expired.end());
+}
+
+/**
+ * @brief Checks that updateValue moves an event to the shard of its new value without losing or duplicating events.
+ */
+void testUpdateValue()
+{
+    {
+        // The new value is pending in the other shard: nothing changes.
+        Recorder queue;
+        auto     t1 = soon(100);
+        auto     t2 = t1 + std::chrono::milliseconds(10);
+        queue.addEvent(t1, 1);
+        queue.addEvent(t2, 2);
+        queue.updateValue(t1, 2);
+        CHECK((queue.await(2) == Expired{{t1, 1}, {t2, 2}}));
+    }
+    {
+        // The event moves to the shard of its new value.
+        Recorder queue;
+        auto     t1 = soon(100);
+        auto     handle = queue.addEvent(t1, 1);
+        queue.updateValue(t1, 2);
+        CHECK(!queue.removeEvent(handle));
+        CHECK((queue.await(1) == Expired{{t1, 2}}));
+    }
+    {
+        // A periodic event stays periodic when it moves.
+        Recorder queue;
+        auto     t1 = soon(100);
+        queue.addPeriodicEvent(t1, std::chrono::milliseconds(20), 1);
+        queue.updateValue(t1, 2);
+        CHECK(eventually([&] { return queue.count(2) >= 3; }));
+        queue.removeEvent(2);
+        CHECK(queue.count(1) == 0);
+    }
+    {
+        // The shard of the new value is full: the event stays where it was under its old value.
+        Recorder queue(ShardingMode::ByValue, TimedEventQueueOptions(), 1);
+        auto     t1 = soon(100);
+        auto     t2 = t1 + std::chrono::milliseconds(10);
+        queue.addEvent(t2, 2);
+        queue.addEvent(t1, 1);
+        queue.updateValue(t1, 4);
+        CHECK(queue.capacityRejections() == 1);
+        CHECK((queue.await(2) == Expired{{t1, 1}, {t2, 2}}));
+    }
+    {
+        // No other shard has an event with the timestamp: the shard of the new value updates its own.
+        Recorder queue;
+        auto     t1 = soon(100);
+        queue.addEvent(t1, 2);
+        queue.updateValue(t1, 4);
+        CHECK((queue.await(1) == Expired{{t1, 4}}));
+    }
+    {
+        TimedEventQueueOptions lockFree;
+        lockFree.submissionMode = SubmissionMode::LockFree;
+        Recorder queue(ShardingMode::ByValue, lockFree);
+        auto     thrown = false;
+        try
+        {
+            queue.updateValue(soon(100), 2);
+        }
+        catch(const std::logic_error&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    return runTestSuites(argc, argv,
+                         {
+                             {"routing", testRouting},
+                             {"update_value", testUpdateValue},
+                         });
+}
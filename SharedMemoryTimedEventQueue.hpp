@@ -0,0 +1,860 @@
+/**
+ * @file SharedMemoryTimedEventQueue.hpp
+ * @brief A C++ header file containing the SharedMemoryTimedEventQueue class, which requires Linux.
+ *
+ * The SharedMemoryTimedEventQueue class keeps its events in a named POSIX
+ * shared memory segment, so that several processes share one queue: any
+ * process can add, reschedule or remove events, and the designated driver
+ * process expires them. The segment is synchronized with process-shared
+ * futexes instead of std::mutex and std::condition_variable, and holds no
+ * pointers, only indices, so every process may map it at a different
+ * address. On other platforms the header declares nothing.
+ */
+#pragma once
+
+#include "TimedEventQueue.hpp"
+
+#if defined(__linux__)
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "SharedMemoryTimedEventQueue: process-shared futexes need lock-free 32-bit atomics");
+
+/**
+ * @brief Blocks while @p word holds @p expected, until it is woken or @p deadline has passed.
+ *
+ * The futex is process-shared, so the word may live in memory mapped by
+ * several processes. TIMESTAMP::max() waits without a timeout.
+ */
+inline void futexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected, const TIMESTAMP& deadline = TIMESTAMP::max())
+{
+    timespec  spec{};
+    timespec* timeout = nullptr;
+    if(deadline != TIMESTAMP::max())
+    {
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        if(nanoseconds <= 0)
+        {
+            nanoseconds = 1;
+        }
+        spec.tv_sec  = static_cast<time_t>(nanoseconds / 1000000000);
+        spec.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+        timeout      = &spec;
+    }
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_BITSET, expected, timeout, nullptr, FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * @brief Wakes up to @p count threads of any process blocked in futexWait on @p word.
+ */
+inline void futexWake(std::atomic<std::uint32_t>& word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief Returns the process ID of the calling process, cached and refreshed in the child after fork.
+ */
+inline std::uint32_t currentProcessId()
+{
+    static std::uint32_t id = [] {
+        pthread_atfork(nullptr, nullptr, [] { id = static_cast<std::uint32_t>(getpid()); });
+        return static_cast<std::uint32_t>(getpid());
+    }();
+    return id;
+}
+
+/**
+ * @class ProcessSharedMutex
+ * @brief A robust mutex built on a process-shared futex, usable from every process mapping it.
+ *
+ * The mutex is a single 32-bit word holding the process ID of its owner, and
+ * is unlocked when zero, so a zero filled shared memory segment holds
+ * unlocked mutexes. Locking spins briefly before it blocks, since the
+ * critical sections of the queue are short. A blocked thread checks every
+ * OWNER_CHECK_INTERVAL whether the owner process still exists, and takes
+ * the mutex over if it died holding it. ownerDied then returns true until
+ * markConsistent is called, telling the next owners that the data the
+ * mutex protects may be half modified. The processes must share a PID
+ * namespace, and the takeover is missed if the ID of the dead owner is
+ * reused before a waiter checks it.
+ */
+class ProcessSharedMutex
+{
+private:
+    static constexpr std::uint32_t CONTENDED = 0x80000000; ///< Set in the word while other threads may be blocked on the mutex, above every process ID.
+    static constexpr int           SPINS     = 64;         ///< The number of attempts to lock the mutex before blocking.
+
+    static constexpr std::chrono::milliseconds OWNER_CHECK_INTERVAL{10}; ///< How often a blocked thread checks whether the owner still exists.
+
+    std::atomic<std::uint32_t> _state{0};     ///< The process ID of the owner, ORed with CONTENDED, or zero if unlocked. Also the futex word.
+    std::atomic<std::uint32_t> _ownerDied{0}; ///< Nonzero once the mutex was taken over from a dead owner, until markConsistent.
+
+    static bool exists(std::uint32_t process) { return kill(static_cast<pid_t>(process), 0) == 0 || errno != ESRCH; }
+
+public:
+    ProcessSharedMutex() = default;
+
+    ProcessSharedMutex(const ProcessSharedMutex&) = delete;
+
+    ProcessSharedMutex& operator=(const ProcessSharedMutex&) = delete;
+
+    bool try_lock()
+    {
+        auto expected = std::uint32_t(0);
+        return _state.compare_exchange_strong(expected, currentProcessId(), std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock()
+    {
+        for(auto spin = 0; spin < SPINS; ++spin)
+        {
+            if(try_lock())
+            {
+                return;
+            }
+            cpuRelax();
+        }
+        auto locked = currentProcessId() | CONTENDED;
+        auto state  = _state.load(std::memory_order_relaxed);
+        while(true)
+        {
+            if(state == 0)
+            {
+                if(_state.compare_exchange_weak(state, locked, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return;
+                }
+                continue;
+            }
+            if((state & CONTENDED) == 0 && !_state.compare_exchange_weak(state, state | CONTENDED, std::memory_order_relaxed))
+            {
+                continue;
+            }
+            futexWait(_state, state | CONTENDED, TIME::now() + OWNER_CHECK_INTERVAL);
+            auto owner = state | CONTENDED;
+            state      = _state.load(std::memory_order_relaxed);
+            if(state == owner && !exists(owner & ~CONTENDED) && _state.compare_exchange_strong(state, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                _ownerDied.store(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    void unlock()
+    {
+        if((_state.exchange(0, std::memory_order_release) & CONTENDED) != 0)
+        {
+            futexWake(_state, 1);
+        }
+    }
+
+    /**
+     * @brief Returns whether the mutex was taken over from a process that died holding it. The mutex must be held.
+     */
+    bool ownerDied() const { return _ownerDied.load(std::memory_order_relaxed) != 0; }
+
+    /**
+     * @brief Tells the next owners that the data the mutex protects was repaired after ownerDied. The mutex must be held.
+     */
+    void markConsistent() { _ownerDied.store(0, std::memory_order_relaxed); }
+};
+
+/**
+ * @class ProcessSharedConditionVariable
+ * @brief A condition variable built on a process-shared futex, waited on with a ProcessSharedMutex.
+ *
+ * The futex word is a sequence number that every notification increments, so
+ * a notification sent after the waiter released the mutex is never lost. A
+ * zero filled condition variable is valid.
+ */
+class ProcessSharedConditionVariable
+{
+private:
+    std::atomic<std::uint32_t> _sequence{0}; ///< The number of notifications, also the futex word.
+
+public:
+    ProcessSharedConditionVariable() = default;
+
+    ProcessSharedConditionVariable(const ProcessSharedConditionVariable&) = delete;
+
+    ProcessSharedConditionVariable& operator=(const ProcessSharedConditionVariable&) = delete;
+
+    /**
+     * @brief Releases the mutex and blocks until a notification, the deadline or a spurious wakeup, then locks it again.
+     */
+    void wait_until(std::unique_lock<ProcessSharedMutex>& lock, const TIMESTAMP& deadline)
+    {
+        auto sequence = _sequence.load(std::memory_order_relaxed);
+        lock.unlock();
+        futexWait(_sequence, sequence, deadline);
+        lock.lock();
+    }
+
+    /**
+     * @brief Wakes every waiting thread of every process.
+     */
+    void notify_all()
+    {
+        _sequence.fetch_add(1, std::memory_order_release);
+        futexWake(_sequence, INT_MAX);
+    }
+};
+
+/**
+ * @struct SharedMemoryTimedEventQueueOptions
+ * @brief The options a SharedMemoryTimedEventQueue is constructed with.
+ */
+struct SharedMemoryTimedEventQueueOptions
+{
+    std::size_t               capacity    = 1024;                    ///< The number of events the segment holds at most. Every process must open the segment with the same capacity.
+    bool                      driver      = false;                   ///< Whether this process starts the worker thread expiring the events of the segment.
+    mode_t                    permissions = 0600;                    ///< The permissions of the segment if this process creates it.
+    std::chrono::milliseconds openTimeout = std::chrono::seconds(1); ///< How long this process waits for the process creating the segment to initialize it.
+};
+
+/**
+ * @class SharedMemoryTimedEventQueue
+ * @tparam T The type of value to be associated with each event in the queue, which must be trivially copyable.
+ * @tparam Callback The callable invoked as callback(timestamp, value) when an event expires in the driver process.
+ *
+ * @brief A timed event queue whose events live in a named shared memory segment, shared by several processes.
+ *
+ * Every process constructs its own SharedMemoryTimedEventQueue with the name
+ * of the segment. The first one creates the segment exclusively, sizes and
+ * initializes it and then marks it ready; the others wait up to the
+ * openTimeout option for that before they map it, so a creator that died
+ * half way leaves a segment that the others reject with std::system_error
+ * until it is removed. Each process can add, reschedule and remove events. The
+ * processes constructed with the driver option run a worker thread that
+ * expires the due events and calls the callback without the mutex held;
+ * normally exactly one process is the driver, since the events expire in
+ * whichever driver pops them first.
+ *
+ * The segment holds a 4-ary min-heap of slot indices and a fixed slot array
+ * with the timestamps and values, so neither adding nor expiring events
+ * allocates, and events with equal timestamps expire in the order they were
+ * added or rescheduled. A TimerHandle holds the index and the generation of
+ * its slot, so it stays meaningful in every process and can be handed to
+ * another process, for example in a shared session table, to cancel the
+ * event there. Values are copied into the segment byte for byte, so they
+ * must not hold pointers into the memory of a process, and there is no
+ * lookup by value.
+ *
+ * The timestamps are steady clock time points, whose epoch on Linux is the
+ * system-wide CLOCK_MONOTONIC, so they mean the same in every process.
+ * A process holds the process-shared mutex only for the heap operations,
+ * never while a callback runs. If a process is killed in one of them, the
+ * next process to lock the mutex takes it over and rebuilds the heap and
+ * the free list from the slots: the events survive, except that one being
+ * added may be lost and one being removed may stay pending. The segment
+ * outlives the processes until remove is called.
+ */
+template<typename T, typename Callback>
+class SharedMemoryTimedEventQueue
+{
+    static_assert(std::is_trivially_copyable_v<T>, "SharedMemoryTimedEventQueue: the values are copied into shared memory and must be trivially copyable");
+    static_assert(std::is_invocable_v<Callback&, const TIMESTAMP&, T&&>, "SharedMemoryTimedEventQueue: the callback must be invocable as callback(timestamp, value)");
+
+private:
+    static constexpr std::size_t   ARITY = 4;                    ///< The number of children of every node of the heap.
+    static constexpr std::size_t   BATCH = 64;                   ///< The number of events the driver expires per lock at most.
+    static constexpr std::uint32_t FREE  = TimerHandle::INVALID; ///< The heap position of a slot holding no event.
+    static constexpr std::uint32_t MAGIC = 0x54455132;           ///< Identifies an initialized segment of this layout.
+
+    enum State : std::uint32_t
+    {
+        Uninitialized, ///< The segment was just created and is zero filled, or its creator is initializing it.
+        Ready,         ///< The segment can be used.
+    };
+
+    struct Slot
+    {
+        TIMESTAMP     timestamp;  ///< The deadline of the event.
+        std::uint64_t sequence;   ///< The order the event was added or rescheduled in, breaking ties between equal timestamps.
+        std::uint32_t position;   ///< The position of the slot in the heap, or FREE.
+        std::uint32_t generation; ///< Incremented whenever the event of the slot expires or is removed.
+        std::uint32_t next;       ///< The next slot of the free list while the slot is free.
+        T             value;      ///< The value of the event.
+    };
+
+    struct Header
+    {
+        std::atomic<std::uint32_t>     state;         ///< The State of the segment.
+        std::uint32_t                  magic;         ///< MAGIC once the segment is initialized.
+        std::uint32_t                  capacity;      ///< The number of slots.
+        std::uint32_t                  valueSize;     ///< The size of T in the process that initialized the segment.
+        std::uint32_t                  valueAlign;    ///< The alignment of T in the process that initialized the segment.
+        std::uint32_t                  size;          ///< The number of pending events, also the size of the heap.
+        std::uint32_t                  freeList;      ///< The first free slot, or FREE if the segment is full.
+        std::uint64_t                  sequence;      ///< The sequence number of the next added or rescheduled event.
+        TIMESTAMP                      sleepDeadline; ///< The deadline a driver sleeps until, or TIMESTAMP::min() while none sleeps.
+        ProcessSharedMutex             mutex;         ///< Synchronizes every access to the heap and the slots.
+        ProcessSharedConditionVariable wakeup;        ///< Wakes the driver when an event is scheduled earlier than sleepDeadline.
+    };
+
+    Callback                             _callback;          ///< The callable invoked when an event expires.
+    int                                  _fd = -1;           ///< The file descriptor of the shared memory segment.
+    void*                                _mapping = nullptr; ///< The address the segment is mapped at in this process.
+    std::size_t                          _length = 0;        ///< The length of the mapping.
+    Header*                              _header = nullptr;  ///< The header at the start of the segment.
+    Slot*                                _slots = nullptr;   ///< The slot array following the header.
+    std::uint32_t*                       _heap = nullptr;    ///< The heap of slot indices following the slots, the earliest at the front.
+    std::vector<std::pair<TIMESTAMP, T>> _expired;           ///< The events popped by the driver, kept to reuse its memory.
+    std::atomic<bool>                    _exit{false};       ///< Tells the worker thread of this process to stop.
+    std::thread                          _thread;            ///< The worker thread, if this process is a driver.
+
+    static std::size_t alignUp(std::size_t offset, std::size_t alignment) { return (offset + alignment - 1) / alignment * alignment; }
+
+    static std::size_t slotsOffset() { return alignUp(sizeof(Header), alignof(Slot)); }
+
+    static std::size_t heapOffset(std::size_t capacity) { return alignUp(slotsOffset() + capacity * sizeof(Slot), alignof(std::uint32_t)); }
+
+    static std::size_t segmentLength(std::size_t capacity) { return heapOffset(capacity) + capacity * sizeof(std::uint32_t); }
+
+    bool earlier(std::uint32_t lhs, std::uint32_t rhs) const
+    {
+        const auto& left  = _slots[lhs];
+        const auto& right = _slots[rhs];
+        return left.timestamp < right.timestamp || (left.timestamp == right.timestamp && left.sequence < right.sequence);
+    }
+
+    void place(std::size_t position, std::uint32_t slot) const
+    {
+        _heap[position]       = slot;
+        _slots[slot].position = static_cast<std::uint32_t>(position);
+    }
+
+    void siftUp(std::size_t position)
+    {
+        auto slot = _heap[position];
+        while(position != 0)
+        {
+            auto parent = (position - 1) / ARITY;
+            if(!earlier(slot, _heap[parent]))
+            {
+                break;
+            }
+            place(position, _heap[parent]);
+            position = parent;
+        }
+        place(position, slot);
+    }
+
+    void siftDown(std::size_t position) const
+    {
+        auto slot = _heap[position];
+        auto size = static_cast<std::size_t>(_header->size);
+        while(true)
+        {
+            auto first = position * ARITY + 1;
+            if(first >= size)
+            {
+                break;
+            }
+            auto last  = std::min(first + ARITY, size);
+            auto child = first;
+            for(auto other = first + 1; other < last; ++other)
+            {
+                if(earlier(_heap[other], _heap[child]))
+                {
+                    child = other;
+                }
+            }
+            if(!earlier(_heap[child], slot))
+            {
+                break;
+            }
+            place(position, _heap[child]);
+            position = child;
+        }
+        place(position, slot);
+    }
+
+    /**
+     * @brief Moves the slot at @p position to where its deadline belongs after it was changed.
+     */
+    void restore(std::size_t position)
+    {
+        if(position != 0 && earlier(_heap[position], _heap[(position - 1) / ARITY]))
+        {
+            siftUp(position);
+        }
+        else
+        {
+            siftDown(position);
+        }
+    }
+
+    /**
+     * @brief Removes the event of @p slot from the heap and returns its slot to the free list.
+     */
+    void release(std::uint32_t slot)
+    {
+        auto position = static_cast<std::size_t>(_slots[slot].position);
+        auto last     = --_header->size;
+        if(position != last)
+        {
+            place(position, _heap[last]);
+            restore(position);
+        }
+        auto& freed = _slots[slot];
+        freed.generation += 1;
+        freed.position    = FREE;
+        freed.next        = _header->freeList;
+        _header->freeList = slot;
+    }
+
+    /**
+     * @brief Returns the slot the handle refers to if its event is still pending, or nullptr.
+     */
+    Slot* find(const TimerHandle& handle) const
+    {
+        if(handle.index >= _header->capacity)
+        {
+            return nullptr;
+        }
+        auto& slot = _slots[handle.index];
+        return slot.position != FREE && slot.generation == handle.generation ? &slot : nullptr;
+    }
+
+    /**
+     * @brief Wakes the drivers if @p timestamp is earlier than the deadline they sleep until. The mutex must be held.
+     */
+    void notifyIfEarlier(const TIMESTAMP& timestamp)
+    {
+        if(timestamp < _header->sleepDeadline)
+        {
+            _header->sleepDeadline = TIMESTAMP::min();
+            _header->wakeup.notify_all();
+        }
+    }
+
+    TIMESTAMP front() const { return _header->size == 0 ? TIMESTAMP::max() : _slots[_heap[0]].timestamp; }
+
+    /**
+     * @brief Rebuilds the heap and the free list from the slots after a process died holding the mutex. The mutex must be held.
+     *
+     * A slot holds an event exactly while its position is not FREE, which
+     * every member keeps true at every step, so the slots stay consistent
+     * wherever the process died.
+     */
+    void repair() const
+    {
+        auto size         = std::uint32_t(0);
+        _header->freeList = FREE;
+        for(auto slot = _header->capacity; slot-- != 0;)
+        {
+            if(_slots[slot].position != FREE)
+            {
+                _heap[size++] = slot;
+            }
+            else
+            {
+                _slots[slot].next = _header->freeList;
+                _header->freeList = slot;
+            }
+        }
+        _header->size = size;
+        for(std::size_t position = 0; position < size; ++position)
+        {
+            place(position, _heap[position]);
+        }
+        for(auto position = size; position-- != 0;)
+        {
+            siftDown(position);
+        }
+        _header->mutex.markConsistent();
+    }
+
+    /**
+     * @brief Locks the mutex of the segment, repairing the segment if its previous owner died holding it.
+     */
+    std::unique_lock<ProcessSharedMutex> guard() const
+    {
+        std::unique_lock lock(_header->mutex);
+        if(_header->mutex.ownerDied())
+        {
+            repair();
+        }
+        return lock;
+    }
+
+    void map(std::size_t capacity)
+    {
+        _mapping = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if(_mapping == MAP_FAILED)
+        {
+            _mapping = nullptr;
+            throw std::system_error(errno, std::generic_category(), "SharedMemoryTimedEventQueue: cannot map the shared memory segment");
+        }
+        auto* base = static_cast<unsigned char*>(_mapping);
+        _header    = reinterpret_cast<Header*>(base);
+        _slots     = reinterpret_cast<Slot*>(base + slotsOffset());
+        _heap      = reinterpret_cast<std::uint32_t*>(base + heapOffset(capacity));
+    }
+
+    /**
+     * @brief Creates the segment if it does not exist yet, or maps it once its creator has initialized it.
+     *
+     * Only the process whose exclusive creation succeeds sizes the segment, so
+     * no process maps it with a size it does not have.
+     */
+    void open(const std::string& name, const SharedMemoryTimedEventQueueOptions& options)
+    {
+        _length       = segmentLength(options.capacity);
+        auto deadline = TIME::now() + options.openTimeout;
+        while(true)
+        {
+            _fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, options.permissions);
+            if(_fd >= 0)
+            {
+                create(name, options.capacity);
+                return;
+            }
+            if(errno != EEXIST)
+            {
+                throw std::system_error(errno, std::generic_category(), "SharedMemoryTimedEventQueue: cannot open the shared memory segment");
+            }
+            _fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+            if(_fd >= 0)
+            {
+                break;
+            }
+            if(errno != ENOENT)
+            {
+                throw std::system_error(errno, std::generic_category(), "SharedMemoryTimedEventQueue: cannot open the shared memory segment");
+            }
+        }
+
+        struct stat status{};
+        while(true)
+        {
+            if(fstat(_fd, &status) < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "SharedMemoryTimedEventQueue: cannot inspect the shared memory segment");
+            }
+            if(status.st_size != 0)
+            {
+                break;
+            }
+            if(TIME::now() >= deadline)
+            {
+                throw std::system_error(ETIMEDOUT, std::generic_category(), "SharedMemoryTimedEventQueue: the process creating the shared memory segment did not size it");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(static_cast<std::size_t>(status.st_size) != _length)
+        {
+            throw std::invalid_argument("SharedMemoryTimedEventQueue: the shared memory segment was created with a different capacity or value type");
+        }
+        map(options.capacity);
+        while(_header->state.load(std::memory_order_acquire) != Ready)
+        {
+            if(TIME::now() >= deadline)
+            {
+                throw std::system_error(ETIMEDOUT, std::generic_category(), "SharedMemoryTimedEventQueue: the process creating the shared memory segment did not initialize it");
+            }
+            futexWait(_header->state, Uninitialized, deadline);
+        }
+        if(_header->magic != MAGIC || _header->capacity != options.capacity || _header->valueSize != sizeof(T) || _header->valueAlign != alignof(T))
+        {
+            throw std::invalid_argument("SharedMemoryTimedEventQueue: the shared memory segment was created with a different capacity or value type");
+        }
+    }
+
+    /**
+     * @brief Sizes, maps and initializes the segment this process just created, then marks it ready. Removes it again on failure.
+     */
+    void create(const std::string& name, std::size_t capacity)
+    {
+        try
+        {
+            if(ftruncate(_fd, static_cast<off_t>(_length)) < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "SharedMemoryTimedEventQueue: cannot size the shared memory segment");
+            }
+            map(capacity);
+        }
+        catch(...)
+        {
+            shm_unlink(name.c_str());
+            throw;
+        }
+        _header->magic         = MAGIC;
+        _header->capacity      = static_cast<std::uint32_t>(capacity);
+        _header->valueSize     = static_cast<std::uint32_t>(sizeof(T));
+        _header->valueAlign    = static_cast<std::uint32_t>(alignof(T));
+        _header->size          = 0;
+        _header->sequence      = 0;
+        _header->sleepDeadline = TIMESTAMP::min();
+        for(std::size_t slot = 0; slot < capacity; ++slot)
+        {
+            _slots[slot].position = FREE;
+            _slots[slot].next     = slot + 1 < capacity ? static_cast<std::uint32_t>(slot + 1) : FREE;
+        }
+        _header->freeList = 0;
+        _header->state.store(Ready, std::memory_order_release);
+        futexWake(_header->state, INT_MAX);
+    }
+
+    void close()
+    {
+        if(_mapping != nullptr)
+        {
+            munmap(_mapping, _length);
+            _mapping = nullptr;
+        }
+        if(_fd >= 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    void run()
+    {
+        auto lock = guard();
+        while(!_exit.load())
+        {
+            if(_header->mutex.ownerDied())
+            {
+                repair();
+            }
+            auto now = TIME::now();
+            while(_header->size != 0 && _expired.size() < BATCH && _slots[_heap[0]].timestamp <= now)
+            {
+                auto  slot  = _heap[0];
+                auto& event = _slots[slot];
+                _expired.emplace_back(event.timestamp, event.value);
+                release(slot);
+            }
+            if(!_expired.empty())
+            {
+                lock.unlock();
+                for(auto& [timestamp, value] : _expired)
+                {
+                    _callback(timestamp, std::move(value));
+                }
+                _expired.clear();
+                lock.lock();
+                continue;
+            }
+            auto deadline          = front();
+            _header->sleepDeadline = deadline;
+            _header->wakeup.wait_until(lock, deadline);
+            _header->sleepDeadline = TIMESTAMP::min();
+        }
+    }
+
+public:
+    /**
+     * @brief Opens the named shared memory segment, creating and initializing it if it does not exist yet.
+     *
+     * @param callback The callable invoked when an event expires, only used if this process is a driver.
+     * @param name The name of the POSIX shared memory segment, such as "/sessions".
+     * @param options The capacity of the segment, whether this process drives the expiration and how long it waits for the creator.
+     * @throws std::invalid_argument If the capacity is 0 or too large, or the segment was created with another capacity or value type.
+     * @throws std::system_error If the segment cannot be opened, sized or mapped, or its creator did not initialize it within the openTimeout.
+     */
+    SharedMemoryTimedEventQueue(Callback callback, const std::string& name, const SharedMemoryTimedEventQueueOptions& options = SharedMemoryTimedEventQueueOptions())
+        : _callback(std::move(callback))
+    {
+        if(options.capacity == 0 || options.capacity >= FREE)
+        {
+            throw std::invalid_argument("SharedMemoryTimedEventQueue: the capacity must be positive and less than 2^32 - 1");
+        }
+        try
+        {
+            open(name, options);
+        }
+        catch(...)
+        {
+            close();
+            throw;
+        }
+        if(options.driver)
+        {
+            _expired.reserve(BATCH);
+            _thread = std::thread(&SharedMemoryTimedEventQueue::run, this);
+        }
+    }
+
+    /**
+     * @brief Stops the worker thread of this process and unmaps the segment, which stays available to the other processes.
+     */
+    ~SharedMemoryTimedEventQueue()
+    {
+        stop();
+        close();
+    }
+
+    SharedMemoryTimedEventQueue(const SharedMemoryTimedEventQueue&) = delete;
+
+    SharedMemoryTimedEventQueue& operator=(const SharedMemoryTimedEventQueue&) = delete;
+
+    /**
+     * @brief Removes the named shared memory segment. Processes that have it mapped keep using it until they unmap it.
+     *
+     * @param name The name of the segment.
+     * @return Whether the segment existed.
+     */
+    static bool remove(const std::string& name) { return shm_unlink(name.c_str()) == 0; }
+
+    /**
+     * @brief Adds an event with the specified timestamp and value to the segment.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the segment is at its capacity.
+     */
+    TimerHandle addEvent(const TIMESTAMP& timestamp, const T& value)
+    {
+        auto lock  = guard();
+        auto index = _header->freeList;
+        if(index == FREE)
+        {
+            return TimerHandle();
+        }
+        auto& slot        = _slots[index];
+        _header->freeList = slot.next;
+        slot.timestamp    = timestamp;
+        slot.sequence     = _header->sequence++;
+        slot.value        = value;
+        place(_header->size++, index);
+        siftUp(slot.position);
+        notifyIfEarlier(timestamp);
+        return TimerHandle{index, slot.generation};
+    }
+
+    /**
+     * @brief Removes the event the handle refers to, which may have been added by another process.
+     *
+     * @param handle The handle of the event to remove.
+     * @return Whether the event was still pending.
+     */
+    bool removeEvent(const TimerHandle& handle)
+    {
+        auto  lock = guard();
+        auto* slot = find(handle);
+        if(slot == nullptr)
+        {
+            return false;
+        }
+        release(handle.index);
+        return true;
+    }
+
+    /**
+     * @brief Updates the timestamp of the event the handle refers to, which may have been added by another process.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was still pending.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const TimerHandle& handle)
+    {
+        auto  lock = guard();
+        auto* slot = find(handle);
+        if(slot == nullptr)
+        {
+            return false;
+        }
+        slot->timestamp = timestamp;
+        slot->sequence  = _header->sequence++;
+        restore(slot->position);
+        notifyIfEarlier(timestamp);
+        return true;
+    }
+
+    /**
+     * @brief Returns whether the event the handle refers to is still pending.
+     */
+    bool contains(const TimerHandle& handle) const
+    {
+        auto lock = guard();
+        return find(handle) != nullptr;
+    }
+
+    /**
+     * @brief Returns the time left until the deadline of the event the handle refers to, or std::nullopt if it is no longer pending.
+     */
+    std::optional<TIMESTAMP::duration> timeUntil(const TimerHandle& handle) const
+    {
+        auto  lock = guard();
+        auto* slot = find(handle);
+        if(slot == nullptr)
+        {
+            return std::nullopt;
+        }
+        auto timestamp = slot->timestamp;
+        lock.unlock();
+        return timestamp - TIME::now();
+    }
+
+    /**
+     * @brief Returns the earliest deadline of the segment, or TIMESTAMP::max() while it is empty.
+     */
+    TIMESTAMP nextDeadline() const
+    {
+        auto lock = guard();
+        return front();
+    }
+
+    /**
+     * @brief Returns the number of pending events of all processes.
+     */
+    std::size_t size() const
+    {
+        auto lock = guard();
+        return _header->size;
+    }
+
+    /**
+     * @brief Returns the number of events the segment holds at most.
+     */
+    std::size_t capacity() const { return _header->capacity; }
+
+    /**
+     * @brief Stops the worker thread of this process, if it is a driver. The events stay in the segment.
+     */
+    void stop()
+    {
+        if(!_thread.joinable())
+        {
+            return;
+        }
+        {
+            auto lock = guard();
+            _exit.store(true);
+            _header->wakeup.notify_all();
+        }
+        _thread.join();
+    }
+};
+
+#endif
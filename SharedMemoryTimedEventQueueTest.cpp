@@ -0,0 +1,253 @@
+#include "SharedMemoryTimedEventQueue.hpp"
+#include "TimedEventQueueTest.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+
+/**
+ * @brief The events expired by the driver of a test, in order.
+ */
+struct Expired
+{
+    std::mutex                             mutex;
+    std::vector<std::pair<TIMESTAMP, int>> events;
+
+    std::vector<std::pair<TIMESTAMP, int>> get()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return events;
+    }
+};
+
+/**
+ * @brief The callback of the driver, recording the expired events.
+ */
+struct Record
+{
+    Expired* expired;
+
+    void operator()(const TIMESTAMP& timestamp, int&& value) const
+    {
+        std::lock_guard<std::mutex> lock(expired->mutex);
+        expired->events.emplace_back(timestamp, value);
+    }
+};
+
+using Queue = SharedMemoryTimedEventQueue<int, Record>;
+
+/**
+ * @brief Returns a segment name of this test process, so that concurrent test runs do not share a segment.
+ */
+std::string segmentName(const char* suite) { return "/timed_event_queue_test_" + std::string(suite) + "_" + std::to_string(getpid()); }
+
+/**
+ * @brief Runs @p fn in a child process and returns whether it exited with every check passed.
+ *
+ * The child is forked while this process has no other threads, and leaves
+ * with _exit so that it does not run the destructors of the parent.
+ */
+template<typename F>
+bool inChild(F fn)
+{
+    auto child = fork();
+    if(child == 0)
+    {
+        auto failed = failures;
+        fn();
+        _exit(failures == failed ? 0 : 1);
+    }
+    auto status = 0;
+    return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * @brief Checks that a process sees, cancels and reschedules the events of another one through their handles, and
+ * that only the driver process expires them.
+ */
+void testProcesses()
+{
+    using std::chrono::milliseconds;
+
+    auto name = segmentName("processes");
+    Queue::remove(name);
+    Expired expired;
+    {
+        Queue owner(Record{&expired}, name, {64});
+        auto  start     = TIME::now();
+        auto  cancelled = owner.addEvent(start + std::chrono::hours(1), 1);
+        auto  moved     = owner.addEvent(start + std::chrono::hours(1), 2);
+        CHECK(cancelled.valid() && moved.valid());
+
+        // The child hands the handle of one of its events back through a pipe.
+        int pipe[2];
+        CHECK(::pipe(pipe) == 0);
+        CHECK(inChild([&] {
+            Queue queue(Record{nullptr}, name, {64});
+            CHECK(queue.capacity() == 64 && queue.size() == 2);
+            CHECK(queue.contains(cancelled) && queue.removeEvent(cancelled) && !queue.removeEvent(cancelled));
+            CHECK(queue.updateTimestamp(start + milliseconds(60), moved));
+            CHECK(queue.addEvent(start + milliseconds(50), 3).valid());
+            auto handle = queue.addEvent(start + std::chrono::hours(1), 4);
+            CHECK(handle.valid() && write(pipe[1], &handle, sizeof(handle)) == sizeof(handle));
+        }));
+        auto handle = TimerHandle();
+        CHECK(read(pipe[0], &handle, sizeof(handle)) == sizeof(handle));
+        ::close(pipe[0]);
+        ::close(pipe[1]);
+        CHECK(!owner.contains(cancelled) && owner.size() == 3);
+        CHECK(owner.nextDeadline() == start + milliseconds(50));
+        auto left = owner.timeUntil(moved);
+        CHECK(left && *left <= milliseconds(60));
+
+        // The parent cancels the event of the child by its handle.
+        CHECK(owner.contains(handle) && owner.removeEvent(handle) && !owner.contains(handle));
+        CHECK(owner.size() == 2 && expired.get().empty());
+
+        Queue driver(Record{&expired}, name, {64, true});
+        CHECK(eventually([&] { return expired.get().size() == 2; }));
+        CHECK((expired.get() == std::vector<std::pair<TIMESTAMP, int>>{{start + milliseconds(50), 3}, {start + milliseconds(60), 2}}));
+        CHECK(driver.size() == 0 && owner.size() == 0);
+    }
+
+    // The capacity of every process must match the creator's.
+    {
+        Queue owner(Record{&expired}, name, {64});
+        auto  rejected = false;
+        try
+        {
+            Queue other(Record{&expired}, name, {32});
+        }
+        catch(const std::invalid_argument&)
+        {
+            rejected = true;
+        }
+        CHECK(rejected);
+    }
+    CHECK(Queue::remove(name) && !Queue::remove(name));
+}
+
+/**
+ * @brief Kills processes while they modify the segment, many of them holding its mutex half way through a change of
+ * the heap, and checks that the next process to lock it repairs the heap and the free list.
+ */
+void testDeadOwner()
+{
+    using std::chrono::microseconds;
+    using std::chrono::milliseconds;
+
+    constexpr std::size_t CAPACITY = 256;
+
+    auto name = segmentName("dead_owner");
+    Queue::remove(name);
+    auto byTimestamp = [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; };
+    {
+        Expired unused;
+        Queue   owner(Record{&unused}, name, {CAPACITY});
+        for(auto round = 0; round < 40; ++round)
+        {
+            auto child = fork();
+            if(child == 0)
+            {
+                // Keeps half of the slots busy and reschedules them at random, so most kills hit a sift of the heap.
+                Queue                    queue(Record{nullptr}, name, {CAPACITY});
+                std::mt19937             generator(static_cast<std::uint32_t>(round));
+                std::vector<TimerHandle> handles;
+                auto                     soon = [&generator] { return TIME::now() + microseconds(generator() % 20000); };
+                for(auto event = 0;; ++event)
+                {
+                    if(handles.size() < CAPACITY / 2)
+                    {
+                        handles.push_back(queue.addEvent(soon(), event));
+                        continue;
+                    }
+                    auto& handle = handles[generator() % handles.size()];
+                    if(event % 2 == 0)
+                    {
+                        queue.updateTimestamp(soon(), handle);
+                    }
+                    else
+                    {
+                        queue.removeEvent(handle);
+                        handle = queue.addEvent(soon(), event);
+                    }
+                }
+            }
+            std::this_thread::sleep_for(microseconds(2000 + round * 137));
+            kill(child, SIGKILL);
+            auto status = 0;
+            waitpid(child, &status, 0);
+            CHECK(WIFSIGNALED(status));
+
+            // Locking the segment repairs it if the child died holding the mutex, and a driver then expires every
+            // pending event in timestamp order. The driver is gone again before the next fork.
+            auto pending = owner.size();
+            CHECK(pending <= CAPACITY);
+            Expired drained;
+            {
+                Queue drain(Record{&drained}, name, {CAPACITY, true});
+                CHECK(eventually([&] { return drain.size() == 0; }));
+            }
+            CHECK(drained.events.size() == pending);
+            CHECK(std::is_sorted(drained.events.begin(), drained.events.end(), byTimestamp));
+        }
+
+        // The free list holds every slot exactly once.
+        std::vector<TimerHandle> handles;
+        for(auto handle = owner.addEvent(TIME::now() + std::chrono::hours(1), 0); handle.valid(); handle = owner.addEvent(TIME::now() + std::chrono::hours(1), 0))
+        {
+            handles.push_back(handle);
+        }
+        CHECK(handles.size() == CAPACITY);
+        std::sort(handles.begin(), handles.end(), [](const auto& lhs, const auto& rhs) { return lhs.index < rhs.index; });
+        CHECK(std::adjacent_find(handles.begin(), handles.end(), [](const auto& lhs, const auto& rhs) { return lhs.index == rhs.index; }) == handles.end());
+        for(const auto& handle : handles)
+        {
+            CHECK(owner.removeEvent(handle));
+        }
+        CHECK(owner.size() == 0);
+
+        // The heap expires events in timestamp order again.
+        Expired          ordered;
+        Queue            driver(Record{&ordered}, name, {CAPACITY, true});
+        std::vector<int> order(CAPACITY);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937(7));
+        auto start = TIME::now() + milliseconds(50);
+        for(auto value : order)
+        {
+            CHECK(driver.addEvent(start + microseconds(value * 100), value).valid());
+        }
+        CHECK(eventually([&] { return ordered.get().size() == CAPACITY; }));
+        auto events = ordered.get();
+        CHECK(std::is_sorted(events.begin(), events.end()));
+        CHECK(events.front().second == 0 && events.back().second == static_cast<int>(CAPACITY) - 1);
+    }
+    Queue::remove(name);
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    return runTestSuites(argc, argv, {
+        {"processes", testProcesses},
+        {"dead_owner", testDeadOwner},
+    });
+}
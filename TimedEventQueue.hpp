@@ -7,16 +7,56 @@
  * and update events with specified timestamps and values. The class uses a
  * separate worker thread to manage event expiration and invokes a
  * user-provided callback function when an event's timestamp expires.
+ *
+ * The events themselves are kept by a storage policy. Two policies are
+ * provided: OrderedMapStorage, which keeps the events in exact timestamp
+ * order, and TimingWheelStorage, a hierarchical timing wheel with O(1) insert
+ * and cancel that fires events with a configurable tick resolution.
  */
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <functional>
+#include <istream>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
 /**
  * @typedef TIME
  * @brief A type alias for std::chrono::steady_clock, representing the clock used for scheduling events.
@@ -30,217 +70,5507 @@ using TIME = std::chrono::steady_clock;
 using TIMESTAMP = std::chrono::time_point<TIME>;
 
 /**
- * @def CENTENNIAL
- * @brief A macro that defines a time point 100 years in the future, used as a placeholder for an event that will never be triggered (practically).
+ * @struct CoarseSteadyClock
+ * @brief A steady clock reading CLOCK_MONOTONIC_COARSE, which is much cheaper to read than steady_clock but only advances once per scheduler tick.
+ *
+ * Its time points are TIMESTAMPs: CLOCK_MONOTONIC_COARSE shares the epoch of
+ * CLOCK_MONOTONIC, which backs std::chrono::steady_clock on Linux. Where the
+ * coarse clock is not available it reads steady_clock.
  */
-#define CENTENNIAL (TIME::now() + std::chrono::hours(100 * 365 * 24))
+struct CoarseSteadyClock
+{
+    using duration                  = TIMESTAMP::duration;
+    using rep                       = duration::rep;
+    using period                    = duration::period;
+    using time_point                = TIMESTAMP;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept
+    {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        timespec spec{};
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &spec);
+        return time_point(std::chrono::duration_cast<duration>(std::chrono::seconds(spec.tv_sec) + std::chrono::nanoseconds(spec.tv_nsec)));
+#else
+        return TIME::now();
+#endif
+    }
+};
 
 /**
- * @class TimedEventQueue
- * @tparam T The type of value to be associated with each event in the queue.
- *
- * @brief A class that manages a queue of timed events, allowing users to schedule, update, and cancel events.
+ * @brief Hints the CPU that the calling thread is spinning, which saves power and frees resources for a sibling hyperthread.
+ */
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * @struct TimerHandle
+ * @brief A lightweight handle to an event, returned by TimedEventQueue::addEvent.
  *
- * The TimedEventQueue class is a template class that allows users to add,
- * remove, and update events with specified timestamps and associated values.
- * It uses a separate worker thread to manage event expiration, and when an
- * event's timestamp expires, it invokes a user-provided callback function.
- * This class is designed to be thread-safe, ensuring that its operations can
- * be called from multiple threads without causing data races or other
- * concurrency issues.
+ * A handle holds the index of the slot the event occupies in the slot array of
+ * the storage together with the generation of that slot. The generation
+ * changes whenever the event expires or is removed, so a stale handle never
+ * refers to a newer event that reused the slot. A default-constructed handle,
+ * and the handle returned when an event could not be added, is not valid.
+ */
+struct TimerHandle
+{
+    static constexpr std::uint32_t INVALID = std::numeric_limits<std::uint32_t>::max();
+
+    std::uint32_t index      = INVALID; ///< The index of the slot of the event.
+    std::uint32_t generation = 0;       ///< The generation of the slot when the event was added.
+
+    /**
+     * @brief Returns whether the handle was returned for an added event. It does not tell whether the event is still pending.
+     */
+    bool valid() const { return index != INVALID; }
+
+    friend bool operator==(const TimerHandle& lhs, const TimerHandle& rhs) { return lhs.index == rhs.index && lhs.generation == rhs.generation; }
+    friend bool operator!=(const TimerHandle& lhs, const TimerHandle& rhs) { return !(lhs == rhs); }
+};
+
+/**
+ * @enum Recurrence
+ * @brief Selects how a periodic event computes its next deadline when it expires.
+ */
+enum class Recurrence
+{
+    /**
+     * The next deadline is the previous one plus the interval, so the event
+     * keeps its phase however late the worker expires it. Occurrences that
+     * are already in the past when the event expires are skipped rather
+     * than fired back to back.
+     */
+    FixedRate,
+    /**
+     * The next deadline is the time the worker expired the event plus the
+     * interval, so late expirations shift every later occurrence.
+     */
+    FixedDelay,
+};
+
+/**
+ * @brief An event taken out of a storage with its value and its period, so that it can be added again elsewhere.
  */
 template<typename T>
-class TimedEventQueue
+struct ExtractedEvent
+{
+    T                   value;      ///< The value of the event.
+    TIMESTAMP::duration period;     ///< The interval of a periodic event, zero for a one-shot event.
+    Recurrence          recurrence; ///< How the next deadline of a periodic event is computed.
+};
+
+/**
+ * @brief Whether the function object F declares is_transparent, so that it accepts keys of other types than the values.
+ */
+template<typename F, typename = void>
+struct IsTransparent : std::false_type
+{
+};
+
+template<typename F>
+struct IsTransparent<F, std::void_t<typename F::is_transparent>> : std::true_type
+{
+};
+
+/**
+ * @brief Whether K is a key that a value index of T can find events by without constructing a T.
+ *
+ * Timestamps and handles are never keys, so the overloads taking them keep
+ * their meaning.
+ */
+template<typename ValueIndex, typename T, typename K>
+struct IsLookupKey
+    : std::bool_constant<ValueIndex::TRANSPARENT && !std::is_same_v<K, T> && !std::is_convertible_v<const K&, TIMESTAMP> && !std::is_convertible_v<const K&, TimerHandle>>
+{
+};
+
+/**
+ * @struct NoValueIndex
+ * @brief A value index policy that disables finding events by value.
+ *
+ * Events can then only be removed or rescheduled through their TimerHandle or
+ * their timestamp, values do not have to be unique and T needs no ordering or
+ * hash. Calling the value based members of the queue does not compile.
+ */
+struct NoValueIndex
+{
+    static constexpr bool ENABLED     = false;
+    static constexpr bool TRANSPARENT = false;
+
+    struct Empty
+    {
+    };
+
+    template<typename T, typename Slot>
+    using Hook = Empty;
+
+    template<typename T, typename Slot>
+    class Index
+    {
+    public:
+        explicit Index(std::pmr::memory_resource*) {}
+
+        void reserve(std::size_t) {}
+        bool insert(Slot*) { return true; }
+        void erase(Slot*) {}
+
+        template<typename K>
+        Slot* find(const K&) const
+        {
+            return nullptr;
+        }
+    };
+};
+
+/**
+ * @struct OrderedValueIndex
+ * @tparam Compare The ordering of the values, std::less<> by default.
+ *
+ * @brief A value index policy that finds events by value in an ordered set of slots.
+ *
+ * The set holds pointers to the slots rather than copies of the values, and
+ * every slot keeps its position in the set, so removing an event found
+ * through its handle does not search the set.
+ */
+template<typename Compare = std::less<>>
+struct OrderedValueIndex
+{
+    static constexpr bool ENABLED     = true;
+    static constexpr bool TRANSPARENT = IsTransparent<Compare>::value;
+
+    template<typename Slot>
+    struct Less
+    {
+        using is_transparent = void;
+
+        Compare compare;
+
+        bool operator()(Slot* lhs, Slot* rhs) const { return compare(*lhs->value, *rhs->value); }
+
+        template<typename K>
+        bool operator()(Slot* lhs, const K& rhs) const
+        {
+            return compare(*lhs->value, rhs);
+        }
+
+        template<typename K>
+        bool operator()(const K& lhs, Slot* rhs) const
+        {
+            return compare(lhs, *rhs->value);
+        }
+    };
+
+    template<typename T, typename Slot>
+    using Hook = typename std::pmr::set<Slot*, Less<Slot>>::iterator;
+
+    template<typename T, typename Slot>
+    class Index
+    {
+    private:
+        std::pmr::set<Slot*, Less<Slot>> _set;
+
+    public:
+        explicit Index(std::pmr::memory_resource* resource)
+            : _set(resource)
+        {
+        }
+
+        void reserve(std::size_t) {}
+
+        bool insert(Slot* slot)
+        {
+            auto [itr, inserted] = _set.insert(slot);
+            if(inserted)
+            {
+                slot->hook = itr;
+            }
+            return inserted;
+        }
+
+        void erase(Slot* slot) { _set.erase(slot->hook); }
+
+        template<typename K>
+        Slot* find(const K& key) const
+        {
+            auto itr = _set.find(key);
+            return itr != _set.end() ? *itr : nullptr;
+        }
+    };
+};
+
+/**
+ * @struct HashValueIndex
+ * @tparam Hash The hash function of the values.
+ * @tparam KeyEqual The equality predicate of the values.
+ *
+ * @brief A value index policy that finds events by value in an open-addressing hash table, in O(1) on average.
+ *
+ * The table is a flat array of buckets holding a pointer to the slot of an
+ * event and the hash of its value, so every value is still stored only once,
+ * probing compares cached hashes before comparing values, and the table only
+ * allocates when it grows. Collisions are resolved by linear probing, erasing
+ * shifts the following buckets back instead of leaving tombstones, and the
+ * hash is spread with a Fibonacci multiplication so identity hashes of
+ * integers do not cluster.
+ *
+ * When both Hash and KeyEqual declare is_transparent, events can also be
+ * found by any key type they accept, for example a std::string_view for
+ * std::string values, without constructing a T. The hash of such a key must
+ * equal the hash of the values it is equal to.
+ */
+template<typename Hash, typename KeyEqual = std::equal_to<>>
+struct HashValueIndex
+{
+    static constexpr bool ENABLED     = true;
+    static constexpr bool TRANSPARENT = IsTransparent<Hash>::value && IsTransparent<KeyEqual>::value;
+
+    template<typename T, typename Slot>
+    using Hook = NoValueIndex::Empty;
+
+    template<typename T, typename Slot>
+    class Index
+    {
+    private:
+        struct Bucket
+        {
+            Slot*       slot = nullptr; ///< The slot of the event, nullptr for an empty bucket.
+            std::size_t hash = 0;       ///< The hash of the value of the event.
+        };
+
+        std::pmr::vector<Bucket> _buckets;   ///< The buckets, a power of two of them once the table is used.
+        std::size_t              _size  = 0; ///< The number of occupied buckets.
+        unsigned                 _shift = 0; ///< 64 minus the log2 of the number of buckets.
+        Hash                     _hash;
+        KeyEqual                 _equal;
+
+        std::size_t home(std::size_t hash) const { return static_cast<std::size_t>((std::uint64_t(hash) * 0x9E3779B97F4A7C15ull) >> _shift); }
+
+        std::size_t mask() const { return _buckets.size() - 1; }
+
+        /**
+         * @brief Rebuilds the table with @p count buckets, a power of two, reusing the cached hashes.
+         */
+        void rehash(std::size_t count)
+        {
+            std::pmr::vector<Bucket> buckets(count, _buckets.get_allocator());
+            buckets.swap(_buckets);
+            _shift = 64;
+            for(auto size = count; size > 1; size >>= 1)
+            {
+                --_shift;
+            }
+            for(const auto& bucket : buckets)
+            {
+                if(bucket.slot != nullptr)
+                {
+                    auto position = home(bucket.hash);
+                    while(_buckets[position].slot != nullptr)
+                    {
+                        position = (position + 1) & mask();
+                    }
+                    _buckets[position] = bucket;
+                }
+            }
+        }
+
+        /**
+         * @brief Grows the table so that it holds @p size events at a load factor of at most 3/4.
+         */
+        void grow(std::size_t size)
+        {
+            auto count = std::max<std::size_t>(_buckets.size(), 8);
+            while(size * 4 > count * 3)
+            {
+                count *= 2;
+            }
+            if(count != _buckets.size())
+            {
+                rehash(count);
+            }
+        }
+
+    public:
+        explicit Index(std::pmr::memory_resource* resource)
+            : _buckets(resource)
+        {
+        }
+
+        void reserve(std::size_t size)
+        {
+            if(size != 0)
+            {
+                grow(size);
+            }
+        }
+
+        bool insert(Slot* slot)
+        {
+            grow(_size + 1);
+            auto hash     = _hash(*slot->value);
+            auto position = home(hash);
+            for(; _buckets[position].slot != nullptr; position = (position + 1) & mask())
+            {
+                if(_buckets[position].hash == hash && _equal(*_buckets[position].slot->value, *slot->value))
+                {
+                    return false;
+                }
+            }
+            _buckets[position] = Bucket{slot, hash};
+            ++_size;
+            return true;
+        }
+
+        void erase(Slot* slot)
+        {
+            auto position = home(_hash(*slot->value));
+            while(_buckets[position].slot != slot)
+            {
+                position = (position + 1) & mask();
+            }
+            for(auto next = (position + 1) & mask(); _buckets[next].slot != nullptr; next = (next + 1) & mask())
+            {
+                // A bucket can move back into the hole unless its home lies cyclically in (hole, next].
+                auto target = home(_buckets[next].hash);
+                if(((next - target) & mask()) >= ((next - position) & mask()))
+                {
+                    _buckets[position] = _buckets[next];
+                    position           = next;
+                }
+            }
+            _buckets[position] = Bucket();
+            --_size;
+        }
+
+        template<typename K>
+        Slot* find(const K& key) const
+        {
+            if(_size == 0)
+            {
+                return nullptr;
+            }
+            auto hash = _hash(key);
+            for(auto position = home(hash); _buckets[position].slot != nullptr; position = (position + 1) & mask())
+            {
+                if(_buckets[position].hash == hash && _equal(*_buckets[position].slot->value, key))
+                {
+                    return _buckets[position].slot;
+                }
+            }
+            return nullptr;
+        }
+    };
+};
+
+/**
+ * @class SegmentedArray
+ * @tparam Node The type of the elements, which has to be default constructible.
+ *
+ * @brief An array of up to 2^32 elements that grows without moving them, so that other threads can read its elements while it grows.
+ *
+ * The elements live in segments that double in size and are only freed with
+ * the array. Segment k holds the indices from (2^k - 1) times the size of the
+ * first segment on, and is published through an atomic pointer, so find can
+ * be called from any thread while another one grows the array. When grow is
+ * asked for the middle of a segment, it also allocates the next one, so the
+ * threads growing the array rarely find their segment missing. Two threads
+ * growing the same segment both allocate it, and the one losing the race
+ * frees its copy.
+ */
+template<typename Node>
+class SegmentedArray
 {
 private:
-    std::map<TIMESTAMP, T>  _ts2Val;       ///< A map of timestamps to their associated values, used to efficiently find the next event to expire.
-    std::map<T, TIMESTAMP>  _val2Ts;       ///< A reverse map of values to their associated timestamps, used to efficiently update or remove events by value.
-    std::mutex              _mutex;        ///< A mutex used to protect concurrent access to the data members, ensuring thread safety.
-    std::condition_variable _cv;           ///< A condition variable used to signal the internal worker thread when events are added, removed, or updated.
-    std::atomic<bool>       _exit = false; ///< An atomic flag used to indicate whether the worker thread should exit, allowing for clean shutdown of the thread.
-    std::thread             _thread;       ///< The worker thread that manages event expiration and calls the user-provided callback function.
+    static constexpr std::size_t SEGMENTS = 32; ///< The number of segments at most, enough for every 32-bit index.
+
+    unsigned                                 _shift;    ///< The log2 of the size of the first segment.
+    std::array<std::atomic<Node*>, SEGMENTS> _segments; ///< The segments, null until they are allocated.
+
+    static unsigned highestBit(std::uint64_t bits)
+    {
+#if defined(__GNUC__)
+        return 63 - static_cast<unsigned>(__builtin_clzll(bits));
+#else
+        unsigned index = 0;
+        for(; bits > 1; bits >>= 1)
+        {
+            ++index;
+        }
+        return index;
+#endif
+    }
+
+    std::size_t segmentOf(std::uint32_t index) const { return highestBit((std::uint64_t(index) >> _shift) + 1); }
+
+    std::size_t offsetOf(std::uint32_t index, std::size_t segment) const { return index - (((std::uint64_t(1) << segment) - 1) << _shift); }
 
     /**
-     * @brief The internal function executed by the worker thread, which manages event expiration and calls the user-provided callback function.
-     *
-     * This function continuously checks for expired events in the queue and
-     * calls the user-provided callback function when an event's timestamp
-     * expires. It also handles waiting for the next event to expire and
-     * responding to updates from other threads that modify the event queue.
+     * @brief Allocates the specified segment unless another thread already has.
      */
-    void run()
+    void allocate(std::size_t segment)
     {
-        while(!_exit.load())
+        if(_segments[segment].load(std::memory_order_acquire) == nullptr)
         {
-            std::unique_lock lock(_mutex);
-            _cv.wait_until(lock, _ts2Val.begin()->first);
+            auto* nodes    = new Node[std::size_t(1) << (_shift + segment)];
+            Node* expected = nullptr;
+            if(!_segments[segment].compare_exchange_strong(expected, nodes, std::memory_order_acq_rel))
+            {
+                delete[] nodes;
+            }
+        }
+    }
 
-            if(_exit.load())
+public:
+    /**
+     * @param first The number of elements allocated up front, rounded up to a power of two.
+     */
+    explicit SegmentedArray(std::size_t first)
+        : _shift(highestBit(std::max<std::size_t>(first, 2) - 1) + 1)
+    {
+        for(auto& segment : _segments)
+        {
+            segment.store(nullptr, std::memory_order_relaxed);
+        }
+        _segments[0].store(new Node[std::size_t(1) << _shift], std::memory_order_release);
+    }
+
+    /**
+     * @brief Takes over the segments of @p other, which must not be accessed concurrently.
+     */
+    SegmentedArray(SegmentedArray&& other) noexcept
+        : _shift(other._shift)
+    {
+        for(std::size_t segment = 0; segment < SEGMENTS; ++segment)
+        {
+            _segments[segment].store(other._segments[segment].exchange(nullptr, std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    SegmentedArray(const SegmentedArray&) = delete;
+
+    SegmentedArray& operator=(const SegmentedArray&) = delete;
+
+    ~SegmentedArray()
+    {
+        for(auto& segment : _segments)
+        {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Makes sure the element with the specified index exists, and returns it.
+     * @throws std::bad_alloc If its segment cannot be allocated.
+     */
+    Node& grow(std::uint32_t index)
+    {
+        auto segment = segmentOf(index);
+        if(offsetOf(index, segment) == std::size_t(1) << (_shift + segment - 1) && segment + 1 < SEGMENTS)
+        {
+            try
             {
-                break;
+                allocate(segment + 1);
+            }
+            catch(const std::bad_alloc&)
+            {
+                // The threads growing into the next segment try again.
+            }
+        }
+        allocate(segment);
+        return (*this)[index];
+    }
+
+    /**
+     * @brief Returns the element with the specified index, or nullptr if its segment was not allocated. Can be called from any thread.
+     */
+    Node* find(std::uint32_t index) const
+    {
+        auto  segment = segmentOf(index);
+        auto* nodes   = _segments[segment].load(std::memory_order_acquire);
+        return nodes != nullptr ? &nodes[offsetOf(index, segment)] : nullptr;
+    }
+
+    /**
+     * @brief Returns the element with the specified index, whose segment must have been allocated.
+     */
+    Node& operator[](std::uint32_t index) const
+    {
+        auto segment = segmentOf(index);
+        return _segments[segment].load(std::memory_order_acquire)[offsetOf(index, segment)];
+    }
+};
+
+/**
+ * @class EventSlots
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam Position The storage specific data every event keeps, such as its position in a timestamp index.
+ * @tparam ValueIndex The value index policy of the storage.
+ *
+ * @brief The slot array the storage policies keep their events in.
+ *
+ * Every pending event occupies one slot holding its value, which is stored
+ * only once and constructed in place, and the storage specific position of
+ * the event. Released slots destroy their value and are kept in a free list
+ * for reuse, and their generation is advanced so that
+ * TimerHandle objects of earlier events no longer match. The slots live in a
+ * std::deque, so their addresses stay stable while the array grows and the
+ * value indexes can refer to them by pointer.
+ *
+ * Next to every slot, a SegmentedArray holds a copy of its generation and of
+ * the timestamp the storage published for its event, in atomics, so that
+ * publishedTimestampOf can look up an event by handle from any thread while
+ * the storage is modified. The generation doubles as the version of the
+ * timestamp: a reader that sees the same generation before and after reading
+ * the timestamp read the timestamp of the event the handle refers to.
+ */
+template<typename T, typename Position, typename ValueIndex>
+class EventSlots
+{
+public:
+    struct Slot
+    {
+        std::optional<T>                                 value;          ///< The value of the event, empty while the slot is released.
+        Position                                         position;
+        typename ValueIndex::template Hook<T, Slot>      hook;
+        TIMESTAMP::duration                              period{0};      ///< The interval of a periodic event, zero for a one-shot event.
+        Recurrence                                       recurrence = Recurrence::FixedRate;
+        std::uint32_t                                    index      = 0;
+        std::uint32_t                                    generation = 0; ///< Odd while the slot is in use.
+
+        /**
+         * @brief Returns the next deadline of a periodic event that was due at @p due and expired at @p now, which is always later than @p now.
+         */
+        TIMESTAMP recur(const TIMESTAMP& due, const TIMESTAMP& now) const
+        {
+            if(recurrence == Recurrence::FixedDelay)
+            {
+                return now < TIMESTAMP::max() - period ? now + period : TIMESTAMP::max();
             }
+            auto missed = (now - due) / period;
+            return due + (missed + 1) * period;
+        }
+    };
+
+    using Index = typename ValueIndex::template Index<T, Slot>;
+
+private:
+    /**
+     * @brief The copy of the generation and the timestamp of a slot that is read without the mutex.
+     */
+    struct Published
+    {
+        std::atomic<std::uint32_t> generation = 0;           ///< The generation of the slot once its timestamp is published, even while its event is not pending.
+        std::atomic<TIMESTAMP>     timestamp  = TIMESTAMP(); ///< The timestamp of the event.
+    };
+
+    std::pmr::deque<Slot>           _slots;     ///< The slots, in index order.
+    std::pmr::vector<std::uint32_t> _free;      ///< The indices of the released slots.
+    SegmentedArray<Published>       _published; ///< The published generations and timestamps, by slot index.
 
-            auto current_time = TIME::now();
-            while(_ts2Val.begin()->first <= current_time)
+public:
+    explicit EventSlots(std::pmr::memory_resource* resource)
+        : _slots(resource)
+        , _free(resource)
+        , _published(64)
+    {
+    }
+
+    void reserve(std::size_t size) { _free.reserve(size); }
+
+    /**
+     * @brief Returns an unused slot holding a value constructed in place from @p args.
+     *
+     * If the constructor of the value throws, the slot stays unused.
+     */
+    template<typename... Args>
+    Slot& acquire(Args&&... args)
+    {
+        if(_free.empty())
+        {
+            auto index = static_cast<std::uint32_t>(_slots.size());
+            _published.grow(index);
+            _slots.emplace_back().index = index;
+            _free.push_back(index);
+        }
+        auto& slot = _slots[_free.back()];
+        slot.value.emplace(std::forward<Args>(args)...);
+        _free.pop_back();
+        ++slot.generation;
+        return slot;
+    }
+
+    /**
+     * @brief Destroys the value of the slot and returns it to the free list, invalidating the handles referring to it.
+     */
+    void release(Slot& slot)
+    {
+        slot.value.reset();
+        slot.period = TIMESTAMP::duration(0);
+        ++slot.generation;
+        _published[slot.index].generation.store(slot.generation, std::memory_order_relaxed);
+        _free.push_back(slot.index);
+    }
+
+    /**
+     * @brief Publishes the timestamp of the event in the slot, which publishedTimestampOf returns from then on.
+     *
+     * The storage calls it whenever it gives an event a new timestamp. A new
+     * event publishes its timestamp before its generation, so a reader that
+     * sees the generation also sees the timestamp, and a reader that sees a
+     * timestamp of a later event in the slot also sees its changed generation.
+     */
+    void publish(const Slot& slot, const TIMESTAMP& timestamp)
+    {
+        auto& published = _published[slot.index];
+        published.timestamp.store(timestamp, std::memory_order_release);
+        if(published.generation.load(std::memory_order_relaxed) != slot.generation)
+        {
+            published.generation.store(slot.generation, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Withdraws the published timestamp of an event that left the storage before its slot is released.
+     */
+    void unpublish(const Slot& slot) { _published[slot.index].generation.store(slot.generation + 1, std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the published timestamp of the event the handle refers to, or std::nullopt if it is no longer pending.
+     *
+     * Unlike the other members, it can be called from any thread while the
+     * slots are modified.
+     */
+    std::optional<TIMESTAMP> publishedTimestampOf(const TimerHandle& handle) const
+    {
+        const auto* published = (handle.generation & 1) != 0 ? _published.find(handle.index) : nullptr;
+        if(published == nullptr || published->generation.load(std::memory_order_acquire) != handle.generation)
+        {
+            return std::nullopt;
+        }
+        auto timestamp = published->timestamp.load(std::memory_order_acquire);
+        if(published->generation.load(std::memory_order_relaxed) != handle.generation)
+        {
+            return std::nullopt;
+        }
+        return timestamp;
+    }
+
+    /**
+     * @brief Returns the slot the handle refers to, or nullptr if its event is no longer pending.
+     */
+    Slot* find(const TimerHandle& handle)
+    {
+        if(handle.index < _slots.size() && _slots[handle.index].generation == handle.generation)
+        {
+            return &_slots[handle.index];
+        }
+        return nullptr;
+    }
+
+    const Slot* find(const TimerHandle& handle) const
+    {
+        if(handle.index < _slots.size() && _slots[handle.index].generation == handle.generation)
+        {
+            return &_slots[handle.index];
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Calls @p fn with every slot in use, in index order.
+     */
+    template<typename F>
+    void forEach(F&& fn) const
+    {
+        for(const auto& slot : _slots)
+        {
+            if((slot.generation & 1) != 0)
+            {
+                fn(slot);
+            }
+        }
+    }
+
+    TimerHandle handle(const Slot& slot) const { return TimerHandle{slot.index, slot.generation}; }
+
+    Slot& operator[](std::uint32_t index) { return _slots[index]; }
+
+    const Slot& operator[](std::uint32_t index) const { return _slots[index]; }
+};
+
+/**
+ * @class StorageMemory
+ * @brief The memory resource the containers of a storage policy allocate from, and its optional capacity limit.
+ *
+ * Without a capacity, the storage allocates directly from the given memory
+ * resource, which can be any std::pmr::memory_resource. With a capacity, the
+ * storage owns a std::pmr::unsynchronized_pool_resource on top of it and
+ * refuses to hold more events than the capacity. The pool keeps the nodes of
+ * removed and expired events for reuse, so once the storage has grown to its
+ * peak size, adding, removing and expiring events no longer allocates. The
+ * pool needs no synchronization of its own since the queue mutex already
+ * serializes the storage.
+ */
+class StorageMemory
+{
+private:
+    std::size_t                                             _capacity; ///< The maximum number of events, or 0 for no limit.
+    std::shared_ptr<std::pmr::unsynchronized_pool_resource> _pool;     ///< The pool owned with a capacity, shared with the storages moved from this one.
+    std::pmr::memory_resource*                              _resource; ///< The resource the containers allocate from.
+
+public:
+    /**
+     * @param capacity The maximum number of events, or 0 for no limit and no pool.
+     * @param upstream The resource to allocate from, or the upstream of the pool with a capacity.
+     */
+    explicit StorageMemory(std::size_t capacity = 0, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : _capacity(capacity)
+        , _pool(capacity != 0 ? std::make_shared<std::pmr::unsynchronized_pool_resource>(std::pmr::pool_options{capacity, 0}, upstream) : nullptr)
+        , _resource(_pool ? _pool.get() : upstream)
+    {
+    }
+
+    /**
+     * @brief Shares the pool, also when moving: the containers of a moved-from storage may still hold memory from it.
+     */
+    StorageMemory(const StorageMemory&) = default;
+
+    std::pmr::memory_resource* resource() const { return _resource; }
+
+    std::size_t capacity() const { return _capacity; }
+
+    bool full(std::size_t size) const { return _capacity != 0 && size >= _capacity; }
+};
+
+/**
+ * @class OrderedMapStorage
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam ValueIndex The value index policy, OrderedValueIndex<> by default. NoValueIndex disables finding events by value.
+ *
+ * @brief The default storage policy of TimedEventQueue, keeping the events in exact timestamp order.
+ *
+ * Events are kept in a multimap of timestamps to slots, which makes the
+ * earliest event available in constant time and every insertion an O(log n)
+ * operation. Any number of events can share a timestamp; they expire in the
+ * order they were added. Every slot keeps its position in the multimap, so
+ * removing an event through its handle does not search the multimap. With a
+ * value index, values have to be unique.
+ *
+ * A storage policy has to provide the members used by TimedEventQueue:
+ * insert (of one event, copied or moved, and of a range), emplace, erase
+ * (by handle, value and timestamp), extract, updateValue, updateTimestamp
+ * (by handle and value), setPeriod, timestampOf (by handle and value),
+ * nextDeadline, forEach, expire (with an optional limit), empty, full and
+ * size. None of them are synchronized, the queue calls them with its mutex
+ * held, and only timestampOf concurrently with itself. A storage can also provide
+ * publishedTimestampOf, which the queue then calls for lookups by handle
+ * without the mutex, concurrently with every other member.
+ *
+ * The containers allocate from the memory resource of a StorageMemory, which
+ * can also limit the storage to a fixed capacity backed by a node pool.
+ */
+template<typename T, typename ValueIndex = OrderedValueIndex<>>
+class OrderedMapStorage
+{
+private:
+    using TimestampIndex = std::pmr::multimap<TIMESTAMP, std::uint32_t>;
+    using Slots          = EventSlots<T, typename TimestampIndex::iterator, ValueIndex>;
+    using Slot           = typename Slots::Slot;
+
+    StorageMemory         _memory; ///< The memory resource of the containers and the capacity limit.
+    TimestampIndex        _ts2Val; ///< A multimap of timestamps to the slots of their events, used to efficiently find the next event to expire.
+    Slots                 _slots;  ///< The slot array holding the values of the events.
+    typename Slots::Index _val2Ts; ///< A reverse index of values to their slots, used to efficiently update or remove events by value.
+
+    void remove(Slot& slot)
+    {
+        _ts2Val.erase(slot.position);
+        _val2Ts.erase(&slot);
+        _slots.release(slot);
+    }
+
+    void reschedule(Slot& slot, const TIMESTAMP& timestamp)
+    {
+        auto nodeHandler  = _ts2Val.extract(slot.position);
+        nodeHandler.key() = timestamp;
+        slot.position     = _ts2Val.insert(std::move(nodeHandler));
+        _slots.publish(slot, timestamp);
+    }
+
+    /**
+     * @brief Inserts an event, using @p hint when it is the position the event belongs at, and advances the hint past it.
+     *
+     * The hint is only used when it keeps events with equal timestamps in
+     * insertion order, that is, when it follows every event with a timestamp
+     * not later than the new one and precedes the later ones.
+     */
+    template<typename... Args>
+    TimerHandle emplaceHinted(typename TimestampIndex::iterator& hint, const TIMESTAMP& timestamp, Args&&... args)
+    {
+        if(full())
+        {
+            return TimerHandle();
+        }
+        auto& slot    = _slots.acquire(std::forward<Args>(args)...);
+        auto  indexed = false;
+        try
+        {
+            indexed = _val2Ts.insert(&slot);
+            if(indexed)
+            {
+                if((hint == _ts2Val.end() || timestamp < hint->first) && (hint == _ts2Val.begin() || std::prev(hint)->first <= timestamp))
+                {
+                    slot.position = _ts2Val.emplace_hint(hint, timestamp, slot.index);
+                }
+                else
+                {
+                    slot.position = _ts2Val.emplace(timestamp, slot.index);
+                }
+            }
+        }
+        catch(...)
+        {
+            // An allocation failed: roll back so that neither index refers to the slot.
+            if(indexed)
+            {
+                _val2Ts.erase(&slot);
+            }
+            _slots.release(slot);
+            throw;
+        }
+        if(!indexed)
+        {
+            _slots.release(slot);
+            return TimerHandle();
+        }
+        _slots.publish(slot, timestamp);
+        hint = std::next(slot.position);
+        return _slots.handle(slot);
+    }
+
+public:
+    template<typename K>
+    static constexpr bool LOOKUP_KEY = IsLookupKey<ValueIndex, T, K>::value; ///< Whether K finds events by value without constructing a T.
+
+    /**
+     * @brief Constructs an empty storage.
+     *
+     * @param memory The memory resource and the capacity of the storage.
+     */
+    explicit OrderedMapStorage(StorageMemory memory = StorageMemory())
+        : _memory(std::move(memory))
+        , _ts2Val(_memory.resource())
+        , _slots(_memory.resource())
+        , _val2Ts(_memory.resource())
+    {
+        _slots.reserve(_memory.capacity());
+        _val2Ts.reserve(_memory.capacity());
+    }
+
+    OrderedMapStorage(OrderedMapStorage&&) = default;
+
+    OrderedMapStorage& operator=(OrderedMapStorage&&) = delete;
+
+    /**
+     * @brief Inserts an event with the specified timestamp and value.
+     *
+     * Events with equal timestamps are kept in insertion order. The insertion
+     * is hinted at the end of the timestamp index, which makes it constant
+     * time for the common case of deadlines that are equal to or later than
+     * every pending one.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the value is already in the storage or the storage is full.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, const T& value) { return emplace(timestamp, value); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp, moving the value into the storage.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, T&& value) { return emplace(timestamp, std::move(value)); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp and a value constructed in place from @p args.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param args The arguments of the constructor of the value.
+     * @return The handle of the event, or an invalid handle if the value is already in the storage or the storage is full.
+     */
+    template<typename... Args>
+    TimerHandle emplace(const TIMESTAMP& timestamp, Args&&... args)
+    {
+        auto hint = _ts2Val.end();
+        return emplaceHinted(hint, timestamp, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Inserts the events of a range of (timestamp, value) pairs.
+     *
+     * Every insertion is hinted right after the previously inserted event, so
+     * a range sorted by timestamp costs amortized constant time per event.
+     * Events that are out of order fall back to a regular insertion.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @param sink A callable invoked with the handle of every event of the range, which is invalid for rejected events.
+     */
+    template<typename InputIt, typename F>
+    void insert(InputIt first, InputIt last, F&& sink)
+    {
+        auto hint = _ts2Val.end();
+        for(; first != last; ++first)
+        {
+            const auto& [timestamp, value] = *first;
+            sink(emplaceHinted(hint, timestamp, value));
+        }
+    }
+
+    /**
+     * @brief Erases the event the handle refers to in O(1) amortized, if it is still pending.
+     *
+     * @param handle The handle of the event to erase.
+     * @return Whether the event was pending.
+     */
+    bool erase(const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            remove(*slot);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Erases the event with the specified value, if it exists.
+     *
+     * @param value The value of the event to erase.
+     */
+    void erase(const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "erasing events by value requires a value index");
+        if(auto* slot = _val2Ts.find(value))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases the event whose value is equal to @p key, found without constructing a T, if it exists.
+     *
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void erase(const K& key)
+    {
+        if(auto* slot = _val2Ts.find(key))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases all events with the specified timestamp.
+     *
+     * @param timestamp The timestamp of the events to erase.
+     */
+    void erase(const TIMESTAMP& timestamp)
+    {
+        auto [first, last] = _ts2Val.equal_range(timestamp);
+        for(auto itr = first; itr != last; ++itr)
+        {
+            _val2Ts.erase(&_slots[itr->second]);
+            _slots.release(_slots[itr->second]);
+        }
+        _ts2Val.erase(first, last);
+    }
+
+    /**
+     * @brief Replaces the value of the earliest added event with the specified timestamp, unless the new value is already in the storage.
+     *
+     * @param timestamp The timestamp of the event to update.
+     * @param value The new value to associate with the timestamp.
+     */
+    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    {
+        if(auto itr = _ts2Val.lower_bound(timestamp); _ts2Val.end() != itr && itr->first == timestamp && _val2Ts.find(value) == nullptr)
+        {
+            auto& slot = _slots[itr->second];
+            _val2Ts.erase(&slot);
+            slot.value = value;
+            _val2Ts.insert(&slot);
+        }
+    }
+
+    /**
+     * @brief Removes the earliest added event with the specified timestamp and returns it, if there is one.
+     *
+     * @param timestamp The timestamp of the event to extract.
+     * @return The value and the period of the removed event.
+     */
+    std::optional<ExtractedEvent<T>> extract(const TIMESTAMP& timestamp)
+    {
+        if(auto itr = _ts2Val.lower_bound(timestamp); _ts2Val.end() != itr && itr->first == timestamp)
+        {
+            auto& slot  = _slots[itr->second];
+            auto  event = ExtractedEvent<T>{*slot.value, slot.period, slot.recurrence};
+            remove(slot);
+            return event;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Makes the event the handle refers to periodic, if it is still pending.
+     *
+     * @param handle The handle of the event.
+     * @param period The interval between two occurrences, which must be positive.
+     * @param recurrence How the next deadline is computed when the event expires.
+     * @return Whether the event was pending.
+     */
+    bool setPeriod(const TimerHandle& handle, TIMESTAMP::duration period, Recurrence recurrence)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            slot->period     = period;
+            slot->recurrence = recurrence;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event the handle refers to to a new timestamp without searching for it, if it is still pending.
+     *
+     * The event is placed after the events that already have the new timestamp.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was pending.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            reschedule(*slot, timestamp);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event with the specified value to a new timestamp, if it exists.
+     *
+     * The event is placed after the events that already have the new timestamp.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param value The value of the event to update.
+     */
+    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "updating events by value requires a value index");
+        if(auto* slot = _val2Ts.find(value))
+        {
+            reschedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Moves the event whose value is equal to @p key to a new timestamp, found without constructing a T, if it exists.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void updateTimestamp(const TIMESTAMP& timestamp, const K& key)
+    {
+        if(auto* slot = _val2Ts.find(key))
+        {
+            reschedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to, or std::nullopt if it is no longer pending.
+     */
+    std::optional<TIMESTAMP> timestampOf(const TimerHandle& handle) const
+    {
+        if(const auto* slot = _slots.find(handle))
+        {
+            return slot->position->first;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to without the mutex, see EventSlots::publishedTimestampOf.
+     *
+     * Unlike the other members, it can be called from any thread while the storage is modified.
+     */
+    std::optional<TIMESTAMP> publishedTimestampOf(const TimerHandle& handle) const { return _slots.publishedTimestampOf(handle); }
+
+    /**
+     * @brief Returns the timestamp of the event with the specified value, or std::nullopt if there is none.
+     */
+    std::optional<TIMESTAMP> timestampOf(const T& value) const
+    {
+        static_assert(ValueIndex::ENABLED, "looking up events by value requires a value index");
+        if(const auto* slot = _val2Ts.find(value))
+        {
+            return slot->position->first;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event whose value is equal to @p key, found without constructing a T, or std::nullopt if there is none.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    std::optional<TIMESTAMP> timestampOf(const K& key) const
+    {
+        if(const auto* slot = _val2Ts.find(key))
+        {
+            return slot->position->first;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the time point at which the next event expires. The storage must not be empty, the queue checks empty() first.
+     */
+    TIMESTAMP nextDeadline() const { return _ts2Val.begin()->first; }
+
+    /**
+     * @brief Calls @p fn as fn(timestamp, value, period, recurrence) for every pending event, in timestamp order.
+     *
+     * The period is zero for one-shot events.
+     */
+    template<typename F>
+    void forEach(F&& fn) const
+    {
+        for(const auto& [timestamp, index] : _ts2Val)
+        {
+            const auto& slot = _slots[index];
+            fn(timestamp, *slot.value, slot.period, slot.recurrence);
+        }
+    }
+
+    /**
+     * @brief Erases every event whose timestamp is not later than @p now, calling @p fn for each one in timestamp order.
+     *
+     * @param now The current time.
+     * @param fn A callable invoked as fn(timestamp, value) with the value as an rvalue, once the event has left the
+     *           indexes, so it can take ownership of the value. A periodic event is rescheduled in place, reusing its
+     *           node, and fn receives a copy of its value.
+     * @param limit The number of events to expire at most.
+     */
+    template<typename F>
+    void expire(const TIMESTAMP& now, F&& fn, std::size_t limit = std::numeric_limits<std::size_t>::max())
+    {
+        for(; limit != 0 && !_ts2Val.empty() && _ts2Val.begin()->first <= now; --limit)
+        {
+            auto  timestamp = _ts2Val.begin()->first;
+            auto& slot      = _slots[_ts2Val.begin()->second];
+            if constexpr(std::is_copy_constructible_v<T>)
+            {
+                if(slot.period.count() != 0)
+                {
+                    reschedule(slot, slot.recur(timestamp, now));
+                    fn(timestamp, T(*slot.value));
+                    continue;
+                }
+            }
+            _ts2Val.erase(_ts2Val.begin());
+            _val2Ts.erase(&slot);
+            _slots.unpublish(slot);
+            fn(timestamp, std::move(*slot.value));
+            _slots.release(slot);
+        }
+    }
+
+    bool        empty() const { return _ts2Val.empty(); }
+    bool        full() const { return _memory.full(size()); }
+    std::size_t size() const { return _ts2Val.size(); }
+};
+
+/**
+ * @class TimingWheelStorage
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam ValueIndex The value index policy, a HashValueIndex using std::hash<T> by default.
+ *
+ * @brief A hierarchical timing wheel storage policy with O(1) insert and cancel.
+ *
+ * Time is divided into ticks of a configurable resolution. The wheel has a
+ * configurable number of levels of 64 slots each: level 0 holds the events of
+ * the next 64 ticks slot by slot, and every further level covers 64 times the
+ * span of the level below it. Events beyond the last level are parked in an
+ * overflow list. When time reaches the start of a higher level slot, its
+ * events are cascaded down to the finer levels, so expiring events only ever
+ * walks the current level 0 slot. Per level occupancy bitmaps let the wheel
+ * jump straight to the next non-empty slot instead of visiting idle ticks.
+ *
+ * An event is rounded up to the tick boundary at or after its timestamp, so it
+ * is never fired early but may fire up to one tick late. Events falling in the
+ * same tick fire in insertion order, not in timestamp order; use
+ * OrderedMapStorage when exact ordering matters. Events with equal timestamps
+ * always fall in the same tick and therefore fire in the order they were
+ * added. Removing an event by timestamp scans the slot holding that timestamp.
+ *
+ * Ticks are counted from the construction of the wheel on TIME. A queue
+ * moves tick 0 to the current time of its own clock with resetOrigin, so
+ * the wheel also works with another Clock and with simulatedTime.
+ *
+ * The slot lists are intrusive lists threaded through the event slots, so the
+ * wheel itself does not allocate once the slot array has grown to the peak
+ * number of pending events. The value index allocates from the memory
+ * resource of the StorageMemory, like the containers of OrderedMapStorage.
+ */
+template<typename T, typename ValueIndex = HashValueIndex<std::hash<T>>>
+class TimingWheelStorage
+{
+public:
+    static constexpr std::size_t SLOT_BITS  = 6;              ///< The number of tick bits resolved by each level.
+    static constexpr std::size_t SLOTS      = 1 << SLOT_BITS; ///< The number of slots in each level.
+    static constexpr std::size_t MAX_LEVELS = 64 / SLOT_BITS; ///< The maximum number of levels, limited by the 64 bit tick counter.
+
+    template<typename K>
+    static constexpr bool LOOKUP_KEY = IsLookupKey<ValueIndex, T, K>::value; ///< Whether K finds events by value without constructing a T.
+
+private:
+    static constexpr std::uint32_t NIL       = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint64_t SLOT_MASK = SLOTS - 1;
+
+    struct Node
+    {
+        TIMESTAMP     timestamp;
+        std::int64_t  tick;
+        std::uint32_t prev;
+        std::uint32_t next;
+        std::uint32_t list;
+    };
+
+    struct List
+    {
+        std::uint32_t head = NIL;
+        std::uint32_t tail = NIL;
+    };
+
+    using Duration = TIMESTAMP::duration;
+    using Slots    = EventSlots<T, Node, ValueIndex>;
+    using Slot     = typename Slots::Slot;
+
+    StorageMemory              _memory;      ///< The memory resource of the containers and the capacity limit.
+    TIMESTAMP                  _origin;      ///< The time point of tick 0.
+    Duration                   _tick;        ///< The duration of one tick.
+    std::size_t                _levels;      ///< The number of levels of the wheel.
+    std::int64_t               _current = 0; ///< The last tick that has been processed.
+    std::size_t                _size    = 0; ///< The number of pending events.
+    Slots                      _slots;       ///< The slot array holding the events and their list links.
+    std::vector<List>          _lists;       ///< The slot lists of all levels, followed by the overflow and due lists.
+    std::vector<std::uint64_t> _occupied;    ///< A bitmap of the non-empty slots of each level.
+    typename Slots::Index      _val2Node;    ///< A reverse index of values to their slots, used to efficiently update or remove events by value.
+
+    static std::int64_t lowestBit(std::uint64_t bits)
+    {
+#if defined(__GNUC__)
+        return __builtin_ctzll(bits);
+#else
+        std::int64_t index = 0;
+        for(; (bits & 1) == 0; bits >>= 1)
+        {
+            ++index;
+        }
+        return index;
+#endif
+    }
+
+    Node& node(std::uint32_t index) { return _slots[index].position; }
+
+    const Node& node(std::uint32_t index) const { return _slots[index].position; }
+
+    std::uint32_t overflowList() const { return static_cast<std::uint32_t>(_levels * SLOTS); }
+    std::uint32_t dueList() const { return overflowList() + 1; }
+
+    std::int64_t tickOf(const TIMESTAMP& timestamp) const
+    {
+        auto elapsed = (timestamp - _origin).count();
+        if(elapsed <= 0)
+        {
+            return 0;
+        }
+        auto tick = _tick.count();
+        return elapsed / tick + (elapsed % tick != 0 ? 1 : 0);
+    }
+
+    /**
+     * @brief Returns the list an event of the given tick belongs in, relative to the current tick.
+     *
+     * An event is placed on the lowest level whose parent block also holds the
+     * current tick, that is, the level of the highest SLOT_BITS group in which
+     * the two ticks differ. Events that are already due go to the due list.
+     */
+    std::uint32_t listOf(std::int64_t tick) const
+    {
+        if(tick <= _current)
+        {
+            return dueList();
+        }
+        for(std::size_t level = 0; level < _levels; ++level)
+        {
+            auto shift = SLOT_BITS * (level + 1);
+            if((tick >> shift) == (_current >> shift))
+            {
+                return static_cast<std::uint32_t>(level * SLOTS + ((tick >> (SLOT_BITS * level)) & SLOT_MASK));
+            }
+        }
+        return overflowList();
+    }
+
+    void link(std::uint32_t index, std::uint32_t list)
+    {
+        auto& entry = node(index);
+        auto& slot  = _lists[list];
+        entry.list  = list;
+        entry.next  = NIL;
+        entry.prev  = slot.tail;
+        if(slot.tail != NIL)
+        {
+            node(slot.tail).next = index;
+        }
+        else
+        {
+            slot.head = index;
+        }
+        slot.tail = index;
+        if(list < overflowList())
+        {
+            _occupied[list / SLOTS] |= std::uint64_t(1) << (list % SLOTS);
+        }
+    }
+
+    void unlink(std::uint32_t index)
+    {
+        auto& entry = node(index);
+        auto& slot  = _lists[entry.list];
+        (entry.prev != NIL ? node(entry.prev).next : slot.head) = entry.next;
+        (entry.next != NIL ? node(entry.next).prev : slot.tail) = entry.prev;
+        if(slot.head == NIL && entry.list < overflowList())
+        {
+            _occupied[entry.list / SLOTS] &= ~(std::uint64_t(1) << (entry.list % SLOTS));
+        }
+    }
+
+    /**
+     * @brief Detaches the whole list and returns its first node; the nodes stay chained through next.
+     */
+    std::uint32_t take(std::uint32_t list)
+    {
+        auto head    = _lists[list].head;
+        _lists[list] = List();
+        if(list < overflowList())
+        {
+            _occupied[list / SLOTS] &= ~(std::uint64_t(1) << (list % SLOTS));
+        }
+        return head;
+    }
+
+    void schedule(Slot& slot, const TIMESTAMP& timestamp)
+    {
+        slot.position.timestamp = timestamp;
+        slot.position.tick      = tickOf(timestamp);
+        link(slot.index, listOf(slot.position.tick));
+        _slots.publish(slot, timestamp);
+    }
+
+    void release(Slot& slot)
+    {
+        _val2Node.erase(&slot);
+        _slots.release(slot);
+        --_size;
+    }
+
+    void remove(Slot& slot)
+    {
+        unlink(slot.index);
+        release(slot);
+    }
+
+    /**
+     * @brief Returns the next tick at which a slot has to be fired or cascaded, or the current tick if events are due.
+     */
+    std::int64_t nextTick() const
+    {
+        if(_lists[dueList()].head != NIL)
+        {
+            return _current;
+        }
+        for(std::size_t level = 0; level < _levels; ++level)
+        {
+            auto shift = SLOT_BITS * level;
+            auto index = static_cast<std::uint64_t>(_current >> shift) & SLOT_MASK;
+            auto bits  = index == SLOT_MASK ? std::uint64_t(0) : _occupied[level] & (~std::uint64_t(0) << (index + 1));
+            if(bits != 0)
+            {
+                auto slot = lowestBit(bits);
+                return ((_current >> (shift + SLOT_BITS)) << (shift + SLOT_BITS)) | (slot << shift);
+            }
+        }
+        auto shift = SLOT_BITS * _levels;
+        return ((_current >> shift) + 1) << shift;
+    }
+
+    /**
+     * @brief Moves the nodes of the higher level slots starting at the current tick down to the finer levels.
+     */
+    void cascade()
+    {
+        auto replace = [this](std::uint32_t list) {
+            for(auto index = take(list); index != NIL;)
+            {
+                auto next = node(index).next;
+                link(index, listOf(node(index).tick));
+                index = next;
+            }
+        };
+
+        if((_current & ((std::int64_t(1) << (SLOT_BITS * _levels)) - 1)) == 0)
+        {
+            replace(overflowList());
+        }
+        for(auto level = _levels - 1; level > 0; --level)
+        {
+            auto shift = SLOT_BITS * level;
+            if((_current & ((std::int64_t(1) << shift) - 1)) == 0)
+            {
+                replace(static_cast<std::uint32_t>(level * SLOTS + ((_current >> shift) & SLOT_MASK)));
+            }
+        }
+    }
+
+    template<typename F>
+    void fire(std::uint32_t list, const TIMESTAMP& now, F& fn, std::size_t& limit)
+    {
+        for(auto index = take(list); index != NIL;)
+        {
+            if(limit == 0)
+            {
+                // Out of budget: the rest of the list is due and waits in the due list for the next call.
+                auto next = node(index).next;
+                link(index, dueList());
+                index = next;
+                continue;
+            }
+            --limit;
+            auto& slot = _slots[index];
+            index      = slot.position.next;
+            if constexpr(std::is_copy_constructible_v<T>)
+            {
+                if(slot.period.count() != 0)
+                {
+                    auto timestamp = slot.position.timestamp;
+                    schedule(slot, slot.recur(timestamp, now));
+                    fn(timestamp, T(*slot.value));
+                    continue;
+                }
+            }
+            _val2Node.erase(&slot);
+            _slots.unpublish(slot);
+            fn(slot.position.timestamp, std::move(*slot.value));
+            _slots.release(slot);
+            --_size;
+        }
+    }
+
+    std::uint32_t findByTimestamp(const TIMESTAMP& timestamp) const
+    {
+        for(auto index = _lists[listOf(tickOf(timestamp))].head; index != NIL; index = node(index).next)
+        {
+            if(node(index).timestamp == timestamp)
+            {
+                return index;
+            }
+        }
+        return NIL;
+    }
+
+public:
+    /**
+     * @brief Constructs an empty timing wheel.
+     *
+     * @param tick The tick resolution of the wheel. Events fire at most one tick late.
+     * @param levels The number of levels of the wheel, between 1 and MAX_LEVELS. The wheel covers 64^levels ticks
+     *               before events have to be parked in the overflow list.
+     * @param memory The memory resource and the capacity of the storage.
+     */
+    explicit TimingWheelStorage(std::chrono::nanoseconds tick = std::chrono::milliseconds(1), std::size_t levels = 4, StorageMemory memory = StorageMemory())
+        : _memory(std::move(memory))
+        , _origin(TIME::now())
+        , _tick(std::chrono::duration_cast<Duration>(tick))
+        , _levels(levels)
+        , _slots(_memory.resource())
+        , _lists(levels * SLOTS + 2)
+        , _occupied(levels, 0)
+        , _val2Node(_memory.resource())
+    {
+        if(_tick.count() <= 0)
+        {
+            throw std::invalid_argument("TimingWheelStorage: the tick must be positive");
+        }
+        if(levels == 0 || levels > MAX_LEVELS)
+        {
+            throw std::invalid_argument("TimingWheelStorage: the number of levels must be between 1 and MAX_LEVELS");
+        }
+        _slots.reserve(_memory.capacity());
+        _val2Node.reserve(_memory.capacity());
+    }
+
+    TimingWheelStorage(TimingWheelStorage&&) = default;
+
+    TimingWheelStorage& operator=(TimingWheelStorage&&) = delete;
+
+    /**
+     * @brief Moves tick 0 of the wheel to @p origin, for a queue whose clock is not TIME, such as the virtual clock of
+     * simulatedTime. Does nothing while the wheel holds events, whose ticks are relative to the old origin.
+     *
+     * @param origin The current time of the clock the wheel is expired with.
+     */
+    void resetOrigin(const TIMESTAMP& origin)
+    {
+        if(_size == 0)
+        {
+            _origin  = origin;
+            _current = 0;
+        }
+    }
+
+    /**
+     * @brief Inserts an event with the specified timestamp and value in O(1).
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the value is already in the wheel or the wheel is full.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, const T& value) { return emplace(timestamp, value); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp in O(1), moving the value into the wheel.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, T&& value) { return emplace(timestamp, std::move(value)); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp and a value constructed in place from @p args, in O(1).
+     *
+     * @param timestamp The timestamp of the event.
+     * @param args The arguments of the constructor of the value.
+     * @return The handle of the event, or an invalid handle if the value is already in the wheel or the wheel is full.
+     */
+    template<typename... Args>
+    TimerHandle emplace(const TIMESTAMP& timestamp, Args&&... args)
+    {
+        if(full())
+        {
+            return TimerHandle();
+        }
+        auto& slot    = _slots.acquire(std::forward<Args>(args)...);
+        auto  indexed = false;
+        try
+        {
+            indexed = _val2Node.insert(&slot);
+        }
+        catch(...)
+        {
+            _slots.release(slot);
+            throw;
+        }
+        if(!indexed)
+        {
+            _slots.release(slot);
+            return TimerHandle();
+        }
+        schedule(slot, timestamp);
+        ++_size;
+        return _slots.handle(slot);
+    }
+
+    /**
+     * @brief Inserts the events of a range of (timestamp, value) pairs, each in O(1).
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @param sink A callable invoked with the handle of every event of the range, which is invalid for rejected events.
+     */
+    template<typename InputIt, typename F>
+    void insert(InputIt first, InputIt last, F&& sink)
+    {
+        for(; first != last; ++first)
+        {
+            const auto& [timestamp, value] = *first;
+            sink(insert(timestamp, value));
+        }
+    }
+
+    /**
+     * @brief Erases the event the handle refers to in O(1), if it is still pending.
+     *
+     * @param handle The handle of the event to erase.
+     * @return Whether the event was pending.
+     */
+    bool erase(const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            remove(*slot);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Erases the event with the specified value, if it exists.
+     *
+     * @param value The value of the event to erase.
+     */
+    void erase(const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "erasing events by value requires a value index");
+        if(auto* slot = _val2Node.find(value))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases the event whose value is equal to @p key, found without constructing a T, if it exists.
+     *
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void erase(const K& key)
+    {
+        if(auto* slot = _val2Node.find(key))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases all events with the specified timestamp.
+     *
+     * @param timestamp The timestamp of the events to erase.
+     */
+    void erase(const TIMESTAMP& timestamp)
+    {
+        for(auto index = _lists[listOf(tickOf(timestamp))].head; index != NIL;)
+        {
+            auto& slot = _slots[index];
+            index      = slot.position.next;
+            if(slot.position.timestamp == timestamp)
+            {
+                remove(slot);
+            }
+        }
+    }
+
+    /**
+     * @brief Replaces the value of the earliest added event with the specified timestamp, unless the new value is already in the wheel.
+     *
+     * @param timestamp The timestamp of the event to update.
+     * @param value The new value to associate with the timestamp.
+     */
+    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    {
+        if(auto index = findByTimestamp(timestamp); index != NIL && _val2Node.find(value) == nullptr)
+        {
+            auto& slot = _slots[index];
+            _val2Node.erase(&slot);
+            slot.value = value;
+            _val2Node.insert(&slot);
+        }
+    }
+
+    /**
+     * @brief Removes the earliest added event with the specified timestamp and returns it, if there is one.
+     *
+     * @param timestamp The timestamp of the event to extract.
+     * @return The value and the period of the removed event.
+     */
+    std::optional<ExtractedEvent<T>> extract(const TIMESTAMP& timestamp)
+    {
+        if(auto index = findByTimestamp(timestamp); index != NIL)
+        {
+            auto& slot  = _slots[index];
+            auto  event = ExtractedEvent<T>{*slot.value, slot.period, slot.recurrence};
+            remove(slot);
+            return event;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Makes the event the handle refers to periodic, if it is still pending.
+     *
+     * @param handle The handle of the event.
+     * @param period The interval between two occurrences, which must be positive.
+     * @param recurrence How the next deadline is computed when the event expires.
+     * @return Whether the event was pending.
+     */
+    bool setPeriod(const TimerHandle& handle, TIMESTAMP::duration period, Recurrence recurrence)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            slot->period     = period;
+            slot->recurrence = recurrence;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event the handle refers to to a new timestamp in O(1), if it is still pending.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was pending.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            unlink(slot->index);
+            schedule(*slot, timestamp);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event with the specified value to a new timestamp, if it exists.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param value The value of the event to update.
+     */
+    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "updating events by value requires a value index");
+        if(auto* slot = _val2Node.find(value))
+        {
+            unlink(slot->index);
+            schedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Moves the event whose value is equal to @p key to a new timestamp, found without constructing a T, if it exists.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void updateTimestamp(const TIMESTAMP& timestamp, const K& key)
+    {
+        if(auto* slot = _val2Node.find(key))
+        {
+            unlink(slot->index);
+            schedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to, or std::nullopt if it is no longer pending.
+     */
+    std::optional<TIMESTAMP> timestampOf(const TimerHandle& handle) const
+    {
+        if(const auto* slot = _slots.find(handle))
+        {
+            return slot->position.timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to without the mutex, see EventSlots::publishedTimestampOf.
+     *
+     * Unlike the other members, it can be called from any thread while the storage is modified.
+     */
+    std::optional<TIMESTAMP> publishedTimestampOf(const TimerHandle& handle) const { return _slots.publishedTimestampOf(handle); }
+
+    /**
+     * @brief Returns the timestamp of the event with the specified value, or std::nullopt if there is none.
+     */
+    std::optional<TIMESTAMP> timestampOf(const T& value) const
+    {
+        static_assert(ValueIndex::ENABLED, "looking up events by value requires a value index");
+        if(const auto* slot = _val2Node.find(value))
+        {
+            return slot->position.timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event whose value is equal to @p key, found without constructing a T, or std::nullopt if there is none.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    std::optional<TIMESTAMP> timestampOf(const K& key) const
+    {
+        if(const auto* slot = _val2Node.find(key))
+        {
+            return slot->position.timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the time point at which the wheel next has to fire or cascade a slot. The storage must not be empty.
+     */
+    TIMESTAMP nextDeadline() const
+    {
+        auto tick = nextTick();
+        if(tick > (TIMESTAMP::max() - _origin) / _tick)
+        {
+            return TIMESTAMP::max();
+        }
+        return _origin + tick * _tick;
+    }
+
+    /**
+     * @brief Calls @p fn as fn(timestamp, value, period, recurrence) for every pending event, in timestamp order.
+     *
+     * The period is zero for one-shot events. The events are collected from
+     * the slot array and sorted first, which costs O(n log n); events with
+     * equal timestamps are visited in slot order.
+     */
+    template<typename F>
+    void forEach(F&& fn) const
+    {
+        std::vector<std::pair<TIMESTAMP, const Slot*>> events;
+        events.reserve(_size);
+        _slots.forEach([&events](const Slot& slot) { events.emplace_back(slot.position.timestamp, &slot); });
+        std::stable_sort(events.begin(), events.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        for(const auto& [timestamp, slot] : events)
+        {
+            fn(timestamp, *slot->value, slot->period, slot->recurrence);
+        }
+    }
+
+    /**
+     * @brief Advances the wheel up to @p now, calling @p fn for every event of the ticks that have passed.
+     *
+     * @param now The current time.
+     * @param fn A callable invoked as fn(timestamp, value) with the value as an rvalue, once the event has left the
+     *           value index, so it can take ownership of the value. A periodic event is relinked for its next
+     *           deadline instead, and fn receives a copy of its value.
+     * @param limit The number of events to expire at most. The wheel then stops at the current tick and keeps the
+     *              remaining due events in its due list, so nextDeadline() is not later than @p now.
+     */
+    template<typename F>
+    void expire(const TIMESTAMP& now, F&& fn, std::size_t limit = std::numeric_limits<std::size_t>::max())
+    {
+        fire(dueList(), now, fn, limit);
+
+        auto target = (now - _origin).count() / _tick.count();
+        while(_size != 0 && limit != 0)
+        {
+            auto tick = nextTick();
+            if(tick > target)
+            {
+                break;
+            }
+            _current = tick;
+            cascade();
+            fire(static_cast<std::uint32_t>(_current & SLOT_MASK), now, fn, limit);
+            fire(dueList(), now, fn, limit);
+        }
+        if(limit != 0 && _current < target)
+        {
+            _current = target;
+        }
+    }
+
+    bool        empty() const { return _size == 0; }
+    bool        full() const { return _memory.full(_size); }
+    std::size_t size() const { return _size; }
+};
+
+/**
+ * @class HeapStorage
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam ValueIndex The value index policy, a HashValueIndex using std::hash<T> by default.
+ * @tparam Arity The number of children of every node of the heap, 4 by default.
+ *
+ * @brief A storage policy keeping the events in a flat d-ary min-heap, for exact ordering without node allocations.
+ *
+ * The heap is a contiguous vector of (timestamp, sequence, slot) entries, so
+ * sifting an entry touches a few adjacent cache lines per level instead of a
+ * tree node per level, and a 4-ary heap is half as deep as a binary one. Every
+ * slot keeps its position in the heap, so erasing or rescheduling an event
+ * through its handle or value is an O(log n) sift without a search. The
+ * sequence number breaks ties, so events with equal timestamps expire in the
+ * order they were added or rescheduled, like with OrderedMapStorage.
+ *
+ * The heap and the slot array do not allocate once they have grown to the
+ * peak number of pending events. Erasing events by timestamp and updateValue
+ * only visit the entries not later than the timestamp.
+ */
+template<typename T, typename ValueIndex = HashValueIndex<std::hash<T>>, std::size_t Arity = 4>
+class HeapStorage
+{
+    static_assert(Arity >= 2, "HeapStorage: the arity of the heap must be at least 2");
+
+private:
+    struct Entry
+    {
+        TIMESTAMP     timestamp; ///< The deadline of the event.
+        std::uint64_t sequence;  ///< The order the event was added or rescheduled in, breaking ties between equal timestamps.
+        std::uint32_t slot;      ///< The index of the slot of the event.
+
+        bool operator<(const Entry& other) const { return timestamp < other.timestamp || (timestamp == other.timestamp && sequence < other.sequence); }
+    };
+
+    using Slots = EventSlots<T, std::uint32_t, ValueIndex>;
+    using Slot  = typename Slots::Slot;
+
+    StorageMemory                   _memory;       ///< The memory resource of the containers and the capacity limit.
+    std::pmr::vector<Entry>         _heap;         ///< The heap of the pending events, the earliest at the front.
+    Slots                           _slots;        ///< The slot array holding the values of the events.
+    typename Slots::Index           _val2Ts;       ///< A reverse index of values to their slots, used to efficiently update or remove events by value.
+    std::pmr::vector<std::uint32_t> _matches;      ///< The slots found by erase(timestamp), kept to reuse its memory.
+    std::uint64_t                   _sequence = 0; ///< The sequence number of the next added or rescheduled event.
+
+    void place(std::size_t position, const Entry& entry)
+    {
+        _heap[position]             = entry;
+        _slots[entry.slot].position = static_cast<std::uint32_t>(position);
+    }
+
+    void siftUp(std::size_t position)
+    {
+        auto entry = _heap[position];
+        while(position != 0)
+        {
+            auto parent = (position - 1) / Arity;
+            if(!(entry < _heap[parent]))
+            {
+                break;
+            }
+            place(position, _heap[parent]);
+            position = parent;
+        }
+        place(position, entry);
+    }
+
+    void siftDown(std::size_t position)
+    {
+        auto entry = _heap[position];
+        while(true)
+        {
+            auto first = position * Arity + 1;
+            if(first >= _heap.size())
+            {
+                break;
+            }
+            auto last  = std::min(first + Arity, _heap.size());
+            auto child = first;
+            for(auto other = first + 1; other < last; ++other)
+            {
+                if(_heap[other] < _heap[child])
+                {
+                    child = other;
+                }
+            }
+            if(!(_heap[child] < entry))
+            {
+                break;
+            }
+            place(position, _heap[child]);
+            position = child;
+        }
+        place(position, entry);
+    }
+
+    /**
+     * @brief Moves the entry at @p position to where its key belongs after it was changed.
+     */
+    void restore(std::size_t position)
+    {
+        if(position != 0 && _heap[position] < _heap[(position - 1) / Arity])
+        {
+            siftUp(position);
+        }
+        else
+        {
+            siftDown(position);
+        }
+    }
+
+    /**
+     * @brief Removes the entry at @p position from the heap, filling its place with the last entry.
+     */
+    void removeAt(std::size_t position)
+    {
+        auto last = _heap.back();
+        _heap.pop_back();
+        if(position < _heap.size())
+        {
+            place(position, last);
+            restore(position);
+        }
+    }
+
+    void remove(Slot& slot)
+    {
+        removeAt(slot.position);
+        _val2Ts.erase(&slot);
+        _slots.release(slot);
+    }
+
+    void reschedule(Slot& slot, const TIMESTAMP& timestamp)
+    {
+        auto& entry     = _heap[slot.position];
+        entry.timestamp = timestamp;
+        entry.sequence  = _sequence++;
+        restore(slot.position);
+        _slots.publish(slot, timestamp);
+    }
+
+    /**
+     * @brief Calls @p fn with the position of every entry with the specified timestamp in the subtree at @p position.
+     *
+     * Subtrees whose root is later than the timestamp are skipped, since none of their entries can match.
+     */
+    template<typename F>
+    void visit(std::size_t position, const TIMESTAMP& timestamp, F& fn) const
+    {
+        if(position >= _heap.size() || timestamp < _heap[position].timestamp)
+        {
+            return;
+        }
+        if(_heap[position].timestamp == timestamp)
+        {
+            fn(position);
+        }
+        for(auto child = position * Arity + 1; child <= position * Arity + Arity; ++child)
+        {
+            visit(child, timestamp, fn);
+        }
+    }
+
+public:
+    template<typename K>
+    static constexpr bool LOOKUP_KEY = IsLookupKey<ValueIndex, T, K>::value; ///< Whether K finds events by value without constructing a T.
+
+    /**
+     * @brief Constructs an empty storage.
+     *
+     * @param memory The memory resource and the capacity of the storage.
+     */
+    explicit HeapStorage(StorageMemory memory = StorageMemory())
+        : _memory(std::move(memory))
+        , _heap(_memory.resource())
+        , _slots(_memory.resource())
+        , _val2Ts(_memory.resource())
+        , _matches(_memory.resource())
+    {
+        _heap.reserve(_memory.capacity());
+        _slots.reserve(_memory.capacity());
+        _val2Ts.reserve(_memory.capacity());
+    }
+
+    HeapStorage(HeapStorage&&) = default;
+
+    HeapStorage& operator=(HeapStorage&&) = delete;
+
+    /**
+     * @brief Inserts an event with the specified timestamp and value in O(log n).
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the value is already in the storage or the storage is full.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, const T& value) { return emplace(timestamp, value); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp, moving the value into the storage.
+     */
+    TimerHandle insert(const TIMESTAMP& timestamp, T&& value) { return emplace(timestamp, std::move(value)); }
+
+    /**
+     * @brief Inserts an event with the specified timestamp and a value constructed in place from @p args.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param args The arguments of the constructor of the value.
+     * @return The handle of the event, or an invalid handle if the value is already in the storage or the storage is full.
+     */
+    template<typename... Args>
+    TimerHandle emplace(const TIMESTAMP& timestamp, Args&&... args)
+    {
+        if(full())
+        {
+            return TimerHandle();
+        }
+        auto& slot    = _slots.acquire(std::forward<Args>(args)...);
+        auto  indexed = false;
+        try
+        {
+            indexed = _val2Ts.insert(&slot);
+            if(indexed)
+            {
+                _heap.push_back(Entry{timestamp, _sequence++, slot.index});
+            }
+        }
+        catch(...)
+        {
+            // An allocation failed: roll back so that neither index refers to the slot.
+            if(indexed)
+            {
+                _val2Ts.erase(&slot);
+            }
+            _slots.release(slot);
+            throw;
+        }
+        if(!indexed)
+        {
+            _slots.release(slot);
+            return TimerHandle();
+        }
+        _slots.publish(slot, timestamp);
+        siftUp(_heap.size() - 1);
+        return _slots.handle(slot);
+    }
+
+    /**
+     * @brief Inserts the events of a range of (timestamp, value) pairs.
+     *
+     * A range sorted by timestamp costs constant time per event, since every
+     * new entry is already in place at the end of the heap.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @param sink A callable invoked with the handle of every event of the range, which is invalid for rejected events.
+     */
+    template<typename InputIt, typename F>
+    void insert(InputIt first, InputIt last, F&& sink)
+    {
+        for(; first != last; ++first)
+        {
+            const auto& [timestamp, value] = *first;
+            sink(emplace(timestamp, value));
+        }
+    }
+
+    /**
+     * @brief Erases the event the handle refers to in O(log n), if it is still pending.
+     *
+     * @param handle The handle of the event to erase.
+     * @return Whether the event was pending.
+     */
+    bool erase(const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            remove(*slot);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Erases the event with the specified value, if it exists.
+     *
+     * @param value The value of the event to erase.
+     */
+    void erase(const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "erasing events by value requires a value index");
+        if(auto* slot = _val2Ts.find(value))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases the event whose value is equal to @p key, found without constructing a T, if it exists.
+     *
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void erase(const K& key)
+    {
+        if(auto* slot = _val2Ts.find(key))
+        {
+            remove(*slot);
+        }
+    }
+
+    /**
+     * @brief Erases all events with the specified timestamp.
+     *
+     * @param timestamp The timestamp of the events to erase.
+     */
+    void erase(const TIMESTAMP& timestamp)
+    {
+        _matches.clear();
+        auto collect = [this](std::size_t position) { _matches.push_back(_heap[position].slot); };
+        visit(0, timestamp, collect);
+        for(auto index : _matches)
+        {
+            remove(_slots[index]);
+        }
+    }
+
+    /**
+     * @brief Replaces the value of the earliest added event with the specified timestamp, unless the new value is already in the storage.
+     *
+     * @param timestamp The timestamp of the event to update.
+     * @param value The new value to associate with the timestamp.
+     */
+    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    {
+        auto earliest = _heap.size();
+        auto find     = [this, &earliest](std::size_t position) {
+            if(earliest == _heap.size() || _heap[position].sequence < _heap[earliest].sequence)
+            {
+                earliest = position;
+            }
+        };
+        visit(0, timestamp, find);
+        if(earliest != _heap.size() && _val2Ts.find(value) == nullptr)
+        {
+            auto& slot = _slots[_heap[earliest].slot];
+            _val2Ts.erase(&slot);
+            slot.value = value;
+            _val2Ts.insert(&slot);
+        }
+    }
+
+    /**
+     * @brief Removes the earliest added event with the specified timestamp and returns it, if there is one.
+     *
+     * @param timestamp The timestamp of the event to extract.
+     * @return The value and the period of the removed event.
+     */
+    std::optional<ExtractedEvent<T>> extract(const TIMESTAMP& timestamp)
+    {
+        auto earliest = _heap.size();
+        auto find     = [this, &earliest](std::size_t position) {
+            if(earliest == _heap.size() || _heap[position].sequence < _heap[earliest].sequence)
+            {
+                earliest = position;
+            }
+        };
+        visit(0, timestamp, find);
+        if(earliest == _heap.size())
+        {
+            return std::nullopt;
+        }
+        auto& slot  = _slots[_heap[earliest].slot];
+        auto  event = ExtractedEvent<T>{*slot.value, slot.period, slot.recurrence};
+        remove(slot);
+        return event;
+    }
+
+    /**
+     * @brief Makes the event the handle refers to periodic, if it is still pending.
+     *
+     * @param handle The handle of the event.
+     * @param period The interval between two occurrences, which must be positive.
+     * @param recurrence How the next deadline is computed when the event expires.
+     * @return Whether the event was pending.
+     */
+    bool setPeriod(const TimerHandle& handle, TIMESTAMP::duration period, Recurrence recurrence)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            slot->period     = period;
+            slot->recurrence = recurrence;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event the handle refers to to a new timestamp in O(log n), if it is still pending.
+     *
+     * The event is placed after the events that already have the new timestamp.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was pending.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const TimerHandle& handle)
+    {
+        if(auto* slot = _slots.find(handle))
+        {
+            reschedule(*slot, timestamp);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Moves the event with the specified value to a new timestamp, if it exists.
+     *
+     * The event is placed after the events that already have the new timestamp.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param value The value of the event to update.
+     */
+    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    {
+        static_assert(ValueIndex::ENABLED, "updating events by value requires a value index");
+        if(auto* slot = _val2Ts.find(value))
+        {
+            reschedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Moves the event whose value is equal to @p key to a new timestamp, found without constructing a T, if it exists.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param key A key the hash and equality, or the ordering, of the value index accept.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    void updateTimestamp(const TIMESTAMP& timestamp, const K& key)
+    {
+        if(auto* slot = _val2Ts.find(key))
+        {
+            reschedule(*slot, timestamp);
+        }
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to, or std::nullopt if it is no longer pending.
+     */
+    std::optional<TIMESTAMP> timestampOf(const TimerHandle& handle) const
+    {
+        if(const auto* slot = _slots.find(handle))
+        {
+            return _heap[slot->position].timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event the handle refers to without the mutex, see EventSlots::publishedTimestampOf.
+     *
+     * Unlike the other members, it can be called from any thread while the storage is modified.
+     */
+    std::optional<TIMESTAMP> publishedTimestampOf(const TimerHandle& handle) const { return _slots.publishedTimestampOf(handle); }
+
+    /**
+     * @brief Returns the timestamp of the event with the specified value, or std::nullopt if there is none.
+     */
+    std::optional<TIMESTAMP> timestampOf(const T& value) const
+    {
+        static_assert(ValueIndex::ENABLED, "looking up events by value requires a value index");
+        if(const auto* slot = _val2Ts.find(value))
+        {
+            return _heap[slot->position].timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the timestamp of the event whose value is equal to @p key, found without constructing a T, or std::nullopt if there is none.
+     */
+    template<typename K, typename = std::enable_if_t<LOOKUP_KEY<K>>>
+    std::optional<TIMESTAMP> timestampOf(const K& key) const
+    {
+        if(const auto* slot = _val2Ts.find(key))
+        {
+            return _heap[slot->position].timestamp;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief Returns the time point at which the next event expires. The storage must not be empty, the queue checks empty() first.
+     */
+    TIMESTAMP nextDeadline() const { return _heap.front().timestamp; }
+
+    /**
+     * @brief Calls @p fn as fn(timestamp, value, period, recurrence) for every pending event, in timestamp order.
+     *
+     * The period is zero for one-shot events. The heap is copied and sorted
+     * first, which costs O(n log n).
+     */
+    template<typename F>
+    void forEach(F&& fn) const
+    {
+        std::vector<Entry> entries(_heap.begin(), _heap.end());
+        std::sort(entries.begin(), entries.end());
+        for(const auto& entry : entries)
+        {
+            const auto& slot = _slots[entry.slot];
+            fn(entry.timestamp, *slot.value, slot.period, slot.recurrence);
+        }
+    }
+
+    /**
+     * @brief Erases every event whose timestamp is not later than @p now, calling @p fn for each one in timestamp order.
+     *
+     * @param now The current time.
+     * @param fn A callable invoked as fn(timestamp, value) with the value as an rvalue, once the event has left the
+     *           indexes, so it can take ownership of the value. A periodic event is sifted to its next deadline
+     *           instead, and fn receives a copy of its value.
+     * @param limit The number of events to expire at most.
+     */
+    template<typename F>
+    void expire(const TIMESTAMP& now, F&& fn, std::size_t limit = std::numeric_limits<std::size_t>::max())
+    {
+        for(; limit != 0 && !_heap.empty() && _heap.front().timestamp <= now; --limit)
+        {
+            auto  timestamp = _heap.front().timestamp;
+            auto& slot      = _slots[_heap.front().slot];
+            if constexpr(std::is_copy_constructible_v<T>)
+            {
+                if(slot.period.count() != 0)
+                {
+                    reschedule(slot, slot.recur(timestamp, now));
+                    fn(timestamp, T(*slot.value));
+                    continue;
+                }
+            }
+            removeAt(0);
+            _val2Ts.erase(&slot);
+            _slots.unpublish(slot);
+            fn(timestamp, std::move(*slot.value));
+            _slots.release(slot);
+        }
+    }
+
+    bool        empty() const { return _heap.empty(); }
+    bool        full() const { return _memory.full(size()); }
+    std::size_t size() const { return _heap.size(); }
+};
+
+/**
+ * @class MpscQueue
+ * @tparam Node The node type, which has to provide a std::atomic<Node*> member named next.
+ *
+ * @brief An intrusive, unbounded, lock-free multi-producer single-consumer queue.
+ *
+ * Producers link a node with one atomic exchange and never wait for each
+ * other or for the consumer. A push that has exchanged the head but not yet
+ * linked its predecessor is invisible to pop() for a moment, while empty()
+ * already reports the queue as non-empty, so the consumer never misses it.
+ * The queue does not own its nodes.
+ */
+template<typename Node>
+class MpscQueue
+{
+private:
+    std::atomic<Node*> _head; ///< The most recently pushed node, written by the producers.
+    Node*              _tail; ///< The next node to pop, only used by the consumer.
+    Node               _stub; ///< The node the queue holds while it is empty.
+
+public:
+    MpscQueue()
+        : _head(&_stub)
+        , _tail(&_stub)
+    {
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * @brief Appends a node. Can be called from any thread.
+     */
+    void push(Node* node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto* prev = _head.exchange(node);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief Removes the oldest node. Must only be called from the consumer thread.
+     *
+     * @return The oldest node, or nullptr if the queue is empty or its oldest node is still being linked.
+     */
+    Node* pop()
+    {
+        auto* tail = _tail;
+        auto* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &_stub)
+        {
+            if(next == nullptr)
+            {
+                return nullptr;
+            }
+            _tail = next;
+            tail  = next;
+            next  = next->next.load(std::memory_order_acquire);
+        }
+        if(next != nullptr)
+        {
+            _tail = next;
+            return tail;
+        }
+        if(tail != _head.load())
+        {
+            return nullptr;
+        }
+        push(&_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next != nullptr)
+        {
+            _tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief Returns whether no node has been pushed since the queue was last drained. Must only be called from the consumer thread.
+     */
+    bool empty() const { return _tail == &_stub && _head.load() == &_stub; }
+};
+
+/**
+ * @class LockFreePool
+ * @tparam Node The type of the pooled objects, which has to be default constructible.
+ *
+ * @brief A growable pool of objects addressed by 32-bit indices, acquired and released from any thread without locks.
+ *
+ * The released objects form a Treiber stack whose head carries a tag that
+ * changes on every update, so a pop preempted between reading the head and
+ * swapping it never installs a stale successor. The objects live in a
+ * SegmentedArray, so an index stays valid for the lifetime of the pool and a
+ * thread that was handed one may read its object. When the free list is
+ * empty, acquire claims the next unused index and grows the array, so the pool
+ * only allocates while it grows past its peak. Released objects are not
+ * destroyed, they are handed out again as they are.
+ */
+template<typename Node>
+class LockFreePool
+{
+public:
+    static constexpr std::uint32_t NONE = std::numeric_limits<std::uint32_t>::max(); ///< The index acquire returns once every index is in use.
+
+private:
+    struct Entry
+    {
+        Node                       node;        ///< The pooled object.
+        std::atomic<std::uint32_t> next = NONE; ///< The next index of the free list while the object is released.
+    };
+
+    SegmentedArray<Entry>      _entries;     ///< The objects, by index.
+    std::atomic<std::uint64_t> _free;        ///< The head index of the free list in the low half and its tag in the high half.
+    std::atomic<std::uint64_t> _claimed = 0; ///< The number of indices handed out at least once.
+
+    static std::uint64_t pack(std::uint32_t index, std::uint64_t head) { return ((head >> 32) + 1) << 32 | index; }
+
+    static std::uint32_t indexOf(std::uint64_t head) { return static_cast<std::uint32_t>(head); }
+
+    /**
+     * @brief Returns an index that was never handed out, allocating its segment if needed, or NONE.
+     */
+    std::uint32_t claim()
+    {
+        auto index = _claimed.fetch_add(1, std::memory_order_relaxed);
+        if(index >= NONE)
+        {
+            return NONE;
+        }
+        _entries.grow(static_cast<std::uint32_t>(index));
+        return static_cast<std::uint32_t>(index);
+    }
+
+public:
+    /**
+     * @param reserve The number of objects allocated up front, rounded up to a power of two.
+     */
+    explicit LockFreePool(std::size_t reserve)
+        : _entries(reserve)
+        , _free(NONE)
+    {
+    }
+
+    LockFreePool(const LockFreePool&) = delete;
+
+    LockFreePool& operator=(const LockFreePool&) = delete;
+
+    /**
+     * @brief Takes an object out of the pool and returns its index, or NONE if every 32-bit index is in use.
+     * @throws std::bad_alloc If the pool has to grow and the segment cannot be allocated.
+     */
+    std::uint32_t acquire()
+    {
+        auto head = _free.load(std::memory_order_acquire);
+        while(indexOf(head) != NONE)
+        {
+            auto next = _entries[indexOf(head)].next.load(std::memory_order_relaxed);
+            if(_free.compare_exchange_weak(head, pack(next, head), std::memory_order_acquire, std::memory_order_acquire))
+            {
+                return indexOf(head);
+            }
+        }
+        return claim();
+    }
+
+    /**
+     * @brief Returns the object with the specified index to the pool. Can be called from any thread.
+     */
+    void release(std::uint32_t index)
+    {
+        auto& released = _entries[index];
+        auto  head     = _free.load(std::memory_order_relaxed);
+        do
+        {
+            released.next.store(indexOf(head), std::memory_order_relaxed);
+        } while(!_free.compare_exchange_weak(head, pack(index, head), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Returns the object with the specified index, or nullptr if the index was never handed out.
+     */
+    Node* find(std::uint32_t index)
+    {
+        if(index >= _claimed.load(std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        auto* entry = _entries.find(index);
+        return entry != nullptr ? &entry->node : nullptr;
+    }
+
+    Node& operator[](std::uint32_t index) { return _entries[index].node; }
+};
+
+/**
+ * @enum DispatchOrdering
+ * @brief Selects which expirations a DispatchPool keeps in order.
+ */
+enum class DispatchOrdering
+{
+    /**
+     * All callbacks are called one after another in expiration order, on a
+     * single dispatch thread.
+     */
+    Strict,
+    /**
+     * Callbacks of events with the same dispatch key are called one after
+     * another in expiration order; events with different keys are dispatched
+     * concurrently. The key is TimedEventQueue::dispatchKey, the hash of the
+     * value by default.
+     */
+    PerKey,
+    /**
+     * Every dispatch thread takes the next expired event, so callbacks run
+     * concurrently and in no particular order.
+     */
+    None,
+};
+
+/**
+ * @class DispatchPool
+ * @tparam T The type of value of the dispatched events.
+ * @tparam Dispatch The callable invoked as dispatch(timestamp, value) for every event, with the value as an rvalue.
+ *
+ * @brief A pool of threads calling the expiration callback, so the worker thread of a queue only keeps time.
+ *
+ * The pool consists of lanes, each a FIFO of expired events served by its
+ * own threads. DispatchOrdering::Strict uses one lane with one thread,
+ * PerKey one lane with one thread per dispatch thread, routed by key, and
+ * None one shared lane served by all threads. The worker stages the events
+ * of a drain with post() and hands them to the lanes with flush(), locking
+ * every lane once per drain.
+ */
+template<typename T, typename Dispatch = std::function<void(const TIMESTAMP&, const T&)>>
+class DispatchPool
+{
+public:
+    using Event = std::pair<TIMESTAMP, T>;
+
+private:
+    struct Lane
+    {
+        std::mutex              mutex;        ///< Protects the events and the exit flag of the lane.
+        std::condition_variable cv;           ///< Signals the threads of the lane when events are flushed or the pool stops.
+        std::deque<Event>       events;       ///< The events waiting to be dispatched, in expiration order.
+        bool                    exit = false; ///< Whether the threads of the lane exit once the events are dispatched.
+    };
+
+    Dispatch                        _dispatch; ///< Calls the expiration callback.
+    std::deque<Lane>                _lanes;    ///< The lanes of the pool.
+    std::vector<std::vector<Event>> _staging;  ///< The events posted to every lane since the last flush, only used by the posting thread.
+    std::vector<std::thread>        _threads;  ///< The dispatch threads.
+
+    void work(Lane& lane)
+    {
+        std::unique_lock lock(lane.mutex);
+        while(true)
+        {
+            lane.cv.wait(lock, [&lane] { return lane.exit || !lane.events.empty(); });
+            if(lane.events.empty())
+            {
+                return;
+            }
+            auto event = std::move(lane.events.front());
+            lane.events.pop_front();
+            lock.unlock();
+            _dispatch(event.first, std::move(event.second));
+            lock.lock();
+        }
+    }
+
+public:
+    /**
+     * @param threads The number of dispatch threads, at least 1. DispatchOrdering::Strict always uses one.
+     * @param ordering Which expirations are kept in order.
+     * @param dispatch Calls the expiration callback.
+     */
+    DispatchPool(std::size_t threads, DispatchOrdering ordering, Dispatch dispatch)
+        : _dispatch(std::move(dispatch))
+    {
+        auto lanes          = ordering == DispatchOrdering::PerKey ? threads : 1;
+        auto threadsPerLane = ordering == DispatchOrdering::None ? threads : 1;
+        _lanes.resize(lanes);
+        _staging.resize(lanes);
+        for(auto& lane : _lanes)
+        {
+            for(std::size_t thread = 0; thread < threadsPerLane; ++thread)
+            {
+                _threads.emplace_back(&DispatchPool::work, this, std::ref(lane));
+            }
+        }
+    }
+
+    ~DispatchPool() { stop(); }
+
+    DispatchPool(const DispatchPool&) = delete;
+
+    DispatchPool& operator=(const DispatchPool&) = delete;
+
+    /**
+     * @brief Stages an expired event for the lane of its key. Must only be called from one thread.
+     */
+    void post(std::size_t key, const TIMESTAMP& timestamp, T&& value) { _staging[key % _staging.size()].emplace_back(timestamp, std::move(value)); }
+
+    /**
+     * @brief Hands the staged events to their lanes and wakes the lane threads. Must be called from the thread that posted them.
+     */
+    void flush()
+    {
+        for(std::size_t index = 0; index < _lanes.size(); ++index)
+        {
+            auto& staged = _staging[index];
+            if(staged.empty())
+            {
+                continue;
+            }
+            auto& lane = _lanes[index];
+            {
+                std::scoped_lock lock(lane.mutex);
+                std::move(staged.begin(), staged.end(), std::back_inserter(lane.events));
+            }
+            if(staged.size() == 1)
+            {
+                lane.cv.notify_one();
+            }
+            else
+            {
+                lane.cv.notify_all();
+            }
+            staged.clear();
+        }
+    }
+
+    /**
+     * @brief Dispatches the events already handed to the lanes and joins the dispatch threads.
+     */
+    void stop()
+    {
+        for(auto& lane : _lanes)
+        {
+            {
+                std::scoped_lock lock(lane.mutex);
+                lane.exit = true;
+            }
+            lane.cv.notify_all();
+        }
+        for(auto& thread : _threads)
+        {
+            if(thread.joinable())
+            {
+                thread.join();
+            }
+        }
+    }
+};
+
+/**
+ * @enum WaitBackend
+ * @brief Selects how the worker thread waits for the earliest deadline.
+ */
+enum class WaitBackend
+{
+    /**
+     * The worker waits on a condition variable with wait_until.
+     */
+    ConditionVariable,
+    /**
+     * The worker waits for a timerfd armed with the absolute earliest
+     * deadline, which avoids the wakeup jitter of wait_until and can be
+     * exposed to an external reactor. Only supported on Linux.
+     */
+    TimerFd,
+};
+
+#if defined(__linux__)
+/**
+ * @class TimerFd
+ * @brief A CLOCK_MONOTONIC timerfd armed with absolute TIMESTAMP deadlines.
+ *
+ * The fd becomes readable once the armed deadline has passed and stays
+ * readable until clear() is called. Arming is a single system call and can
+ * be done from any thread, which replaces the condition variable
+ * notification: arming an earlier deadline, or wakeNow(), makes a waiting
+ * thread return.
+ */
+class TimerFd
+{
+private:
+    int _fd; ///< The timerfd.
+
+public:
+    /**
+     * @throws std::system_error If the timerfd cannot be created.
+     */
+    TimerFd()
+        : _fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    {
+        if(_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "TimerFd: cannot create the timerfd");
+        }
+    }
+
+    TimerFd(const TimerFd&) = delete;
+
+    TimerFd& operator=(const TimerFd&) = delete;
+
+    ~TimerFd() { close(_fd); }
+
+    int fd() const { return _fd; }
+
+    /**
+     * @brief Arms the timer to expire at the specified steady clock time point, which shares the epoch of CLOCK_MONOTONIC.
+     *
+     * TIMESTAMP::max() disarms the timer, so it does not expire until it is armed again.
+     */
+    void arm(const TIMESTAMP& deadline)
+    {
+        if(deadline == TIMESTAMP::max())
+        {
+            itimerspec disarmed{};
+            timerfd_settime(_fd, TFD_TIMER_ABSTIME, &disarmed, nullptr);
+            return;
+        }
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+        if(nanoseconds <= 0)
+        {
+            nanoseconds = 1;
+        }
+        itimerspec spec{};
+        spec.it_value.tv_sec  = static_cast<time_t>(nanoseconds / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+        timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+    }
+
+    /**
+     * @brief Makes the timer expire immediately.
+     */
+    void wakeNow() { arm(TIMESTAMP()); }
+
+    /**
+     * @brief Blocks until the timer has expired.
+     */
+    void wait() const
+    {
+        pollfd entry{_fd, POLLIN, 0};
+        while(::poll(&entry, 1, -1) < 0 && errno == EINTR)
+        {
+        }
+    }
+
+    /**
+     * @brief Consumes the expiration of the timer, so the fd is no longer readable until it expires again.
+     *
+     * @return Whether the timer had expired.
+     */
+    bool clear()
+    {
+        std::uint64_t expirations = 0;
+        auto          result      = read(_fd, &expirations, sizeof(expirations));
+        while(result < 0 && errno == EINTR)
+        {
+            result = read(_fd, &expirations, sizeof(expirations));
+        }
+        return result == static_cast<decltype(result)>(sizeof(expirations)) && expirations > 0;
+    }
+};
+#endif
+
+/**
+ * @enum ExpirationMode
+ * @brief Selects whether the worker thread holds the queue mutex while it calls the expiration callback.
+ */
+enum class ExpirationMode
+{
+    /**
+     * The callback is called with the mutex held, so other threads cannot
+     * modify the queue until it returns. The callback must not call back into
+     * the queue.
+     */
+    Locked,
+    /**
+     * The worker moves all due events into a local batch with the mutex held,
+     * releases the mutex and then calls the callback for each event of the
+     * batch, in expiration order.
+     *
+     * An event leaves the queue when it is moved into the batch. Removing or
+     * updating it while the batch is being dispatched therefore has no effect:
+     * its callback is still called, with the timestamp and value it had when it
+     * expired. An event added during the dispatch with the same value is a new
+     * event and is scheduled independently. The callback may call back into
+     * the queue, except for stop().
+     */
+    Unlocked,
+};
+
+/**
+ * @enum SubmissionMode
+ * @brief Selects how modifications of the queue reach its storage.
+ */
+enum class SubmissionMode
+{
+    /**
+     * Every modification locks the queue mutex and applies itself to the
+     * storage directly.
+     */
+    Locked,
+    /**
+     * Modifications are pushed as commands into a lock-free MpscQueue and the
+     * worker thread, which owns the storage exclusively, applies them before
+     * every wait. Producers never wait for each other or for the worker; they
+     * only lock the mutex to wake an idle worker when they submit an event
+     * that is due before the deadline it sleeps until, and yield the processor
+     * while more than twice maxPendingCommands commands are pending. The
+     * commands come from a lock-free pool that the worker recycles, so
+     * producers do not allocate once it has grown to the peak number of
+     * pending commands. addEvent
+     * returns a handle reserved by the producer, which the worker binds to the
+     * event when it applies the command; removing or rescheduling through it
+     * returns false once the handle is known to be stale, and true when the
+     * command was submitted, since its outcome is only known once the worker
+     * applies it. The callback is never called with the mutex held, whatever the
+     * ExpirationMode, and may call back into the queue, except for stop().
+     */
+    LockFree,
+};
+
+/**
+ * @enum StalePolicy
+ * @brief Selects what a drain does with stale events, those expired more than TimedEventQueueOptions::staleAfter after their timestamp.
+ */
+enum class StalePolicy
+{
+    /**
+     * Stale events are delivered like any other and counted by lateEvents().
+     */
+    DeliverLate,
+    /**
+     * Stale events are discarded without calling the callback and counted
+     * by droppedEvents(). A stale occurrence of a periodic event is dropped,
+     * the event itself keeps recurring.
+     */
+    Drop,
+    /**
+     * Consecutive stale events of a drain with equal values are taken for
+     * missed repetitions of the same event and collapsed into one callback
+     * for the last of them. The discarded ones are counted by
+     * collapsedEvents(). Stale events with other values are delivered in
+     * order, and values without operator== are never collapsed. A periodic
+     * event needs no collapsing, since it already skips the occurrences it
+     * missed.
+     */
+    Collapse,
+};
+
+/**
+ * @struct TimedEventQueueOptions
+ * @brief The options a TimedEventQueue is constructed with.
+ */
+struct TimedEventQueueOptions
+{
+    ExpirationMode           expirationMode         = ExpirationMode::Locked;         ///< Whether the callback is called with the queue mutex held.
+    SubmissionMode           submissionMode         = SubmissionMode::Locked;         ///< Whether modifications lock the mutex or are submitted to the worker thread.
+    std::size_t              maxPendingCommands     = 1024;                           ///< With SubmissionMode::LockFree, the number of submitted commands after which the worker is woken to apply them even if none is due earlier. Twice as many commands and handles are preallocated, and beyond that many producers yield to let the worker catch up.
+    int                      workerCpu              = -1;                             ///< The CPU the worker thread is pinned to, or -1 to let it run on any CPU. Only supported on Linux, ignored elsewhere.
+    std::size_t              dispatchThreads        = 0;                              ///< The number of threads of a DispatchPool calling the callback, or 0 to call it on the worker thread.
+    DispatchOrdering         dispatchOrdering       = DispatchOrdering::Strict;       ///< Which expirations the DispatchPool keeps in order.
+    std::chrono::nanoseconds slack                  = std::chrono::nanoseconds(0);    ///< How late events may fire: the worker sleeps until the earliest deadline plus the slack and expires everything due by then in one batch.
+    WaitBackend              waitBackend            = WaitBackend::ConditionVariable; ///< How the worker thread waits for the earliest deadline.
+    bool                     externalDriver         = false;                          ///< Whether the queue runs without a worker thread and is driven by calls to poll() or processExpired(), for example from an epoll loop watching fd().
+    bool                     singleThreaded         = false;                          ///< With externalDriver, whether the queue is only used from the thread driving it, which removes all locking. The submission mode and the dispatch threads are then ignored.
+    std::size_t              maxExpirationsPerDrain = 0;                              ///< The number of events a drain expires at most before the worker releases the mutex and continues, or 0 without a limit. processExpired() returns after as many.
+    std::chrono::nanoseconds staleAfter             = std::chrono::nanoseconds(0);    ///< How much later than its timestamp a drain has to expire an event for the event to be stale, or 0 to treat no event as stale.
+    StalePolicy              stalePolicy            = StalePolicy::DeliverLate;       ///< What a drain does with stale events.
+    std::chrono::nanoseconds spinThreshold          = std::chrono::nanoseconds(0);    ///< How long before a deadline the worker stops blocking and spins on the steady clock instead, or 0 to always block. Only supported with WaitBackend::ConditionVariable.
+    bool                     simulatedTime          = false;                          ///< Whether the worker runs on a virtual clock starting at TIMESTAMP(), which jumps to the next deadline instead of sleeping until it. Not supported with externalDriver, SubmissionMode::LockFree or dispatchThreads.
+};
+
+/**
+ * @brief Returns the default key of an event for DispatchOrdering::PerKey: the std::hash of the value, or 0 for values without one.
+ */
+template<typename T>
+std::size_t defaultDispatchKey(const T& value)
+{
+    if constexpr(std::is_default_constructible_v<std::hash<T>>)
+    {
+        return std::hash<T>()(value);
+    }
+    else
+    {
+        (void)value;
+        return 0;
+    }
+}
+
+/**
+ * @brief Detects whether a callback type provides dispatchKey(timestamp, value), which then replaces defaultDispatchKey.
+ */
+template<typename Callback, typename T, typename = void>
+struct HasDispatchKey : std::false_type
+{
+};
+
+template<typename Callback, typename T>
+struct HasDispatchKey<Callback, T, std::void_t<decltype(std::declval<const Callback&>().dispatchKey(std::declval<const TIMESTAMP&>(), std::declval<const T&>()))>>
+    : std::true_type
+{
+};
+
+/**
+ * @brief Detects whether a storage policy provides publishedTimestampOf(handle), which lets lookups by handle skip the mutex.
+ */
+template<typename Storage, typename = void>
+struct HasPublishedTimestamps : std::false_type
+{
+};
+
+template<typename Storage>
+struct HasPublishedTimestamps<Storage, std::void_t<decltype(std::declval<const Storage&>().publishedTimestampOf(std::declval<const TimerHandle&>()))>>
+    : std::true_type
+{
+};
+
+/**
+ * @brief Detects whether a storage policy provides resetOrigin(now), which the queue calls with the time of its own clock.
+ */
+template<typename Storage, typename = void>
+struct HasTimeOrigin : std::false_type
+{
+};
+
+template<typename Storage>
+struct HasTimeOrigin<Storage, std::void_t<decltype(std::declval<Storage&>().resetOrigin(std::declval<const TIMESTAMP&>()))>> : std::true_type
+{
+};
+
+/**
+ * @brief Detects whether values of type T can be compared with ==, which StalePolicy::Collapse needs to recognize repeated events.
+ */
+template<typename T, typename = void>
+struct IsEqualityComparable : std::false_type
+{
+};
+
+template<typename T>
+struct IsEqualityComparable<T, std::void_t<decltype(std::declval<const T&>() == std::declval<const T&>())>> : std::true_type
+{
+};
+
+/**
+ * @struct SnapshotHeader
+ * @brief The header of a snapshot of the pending events, written by BasicTimedEventQueue::saveSnapshot.
+ *
+ * A snapshot is the header followed by one SnapshotRecord per event, in
+ * timestamp order. Every record is followed by the serialized value, padded
+ * to a multiple of 8 bytes, so the records of a mapped file stay aligned. All
+ * fields are in the byte order of the machine that wrote the snapshot.
+ */
+struct SnapshotHeader
+{
+    static constexpr char          MAGIC[8] = {'T', 'E', 'Q', 'S', 'N', 'A', 'P', '\0'};
+    static constexpr std::uint32_t VERSION  = 1;
+
+    char          magic[8]; ///< MAGIC.
+    std::uint32_t version;  ///< VERSION.
+    std::uint32_t reserved; ///< Zero.
+    std::uint64_t count;    ///< The number of records.
+    std::int64_t  savedAt;  ///< The std::chrono::system_clock time of the snapshot, in nanoseconds since its epoch.
+};
+
+/**
+ * @struct SnapshotRecord
+ * @brief The fixed size part of an event in a snapshot.
+ */
+struct SnapshotRecord
+{
+    std::int64_t  deadline;    ///< The timestamp of the event minus the time of the snapshot, in nanoseconds, negative for overdue events.
+    std::int64_t  period;      ///< The interval of a periodic event in nanoseconds, zero for a one-shot event.
+    std::uint32_t size;        ///< The number of bytes of the serialized value that follow the record.
+    std::uint8_t  recurrence;  ///< The Recurrence of a periodic event.
+    std::uint8_t  reserved[3]; ///< Zero.
+};
+
+/**
+ * @struct TrivialSerializer
+ * @tparam T A trivially copyable value type.
+ *
+ * @brief A serializer and deserializer for saveSnapshot and loadSnapshot that copies the bytes of trivially copyable values.
+ */
+template<typename T>
+struct TrivialSerializer
+{
+    static_assert(std::is_trivially_copyable_v<T>, "TrivialSerializer requires a trivially copyable value type");
+
+    void operator()(const T& value, std::string& bytes) const { bytes.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    T operator()(std::string_view bytes) const
+    {
+        if(bytes.size() != sizeof(T))
+        {
+            throw std::runtime_error("TrivialSerializer: the size of the serialized value does not match the value type");
+        }
+        T value;
+        std::memcpy(&value, bytes.data(), sizeof(T));
+        return value;
+    }
+};
+
+/**
+ * @struct QueueStatsSnapshot
+ * @brief The values of the counters of a QueueStats at one point in time, as returned by stats().
+ *
+ * The counters only grow, so the rates of two snapshots are their difference
+ * divided by the time between them.
+ */
+struct QueueStatsSnapshot
+{
+    /**
+     * The number of buckets of the lateness histogram. Bucket 0 counts the
+     * callbacks that were not late, bucket k > 0 those between 2^(k-1) and
+     * 2^k nanoseconds late, and the last bucket everything later.
+     */
+    static constexpr std::size_t LATENESS_BUCKETS = 40;
+
+    TIMESTAMP                                   taken;              ///< The time on the steady clock when the snapshot was taken.
+    std::size_t                                 pending     = 0;    ///< The number of pending events after the last modification or expiration.
+    std::uint64_t                               adds        = 0;    ///< The number of events added, including those that were rejected.
+    std::uint64_t                               cancels     = 0;    ///< The number of removals, by handle, value or timestamp.
+    std::uint64_t                               reschedules = 0;    ///< The number of timestamp updates.
+    std::chrono::nanoseconds                    mutexHeld{0};       ///< The total time the queue mutex was held by modifications and expirations.
+    std::uint64_t                               callbacks   = 0;    ///< The number of callbacks called.
+    std::chrono::nanoseconds                    callbackTime{0};    ///< The total time spent in the callback.
+    std::chrono::nanoseconds                    maxCallbackTime{0}; ///< The longest callback.
+    std::array<std::uint64_t, LATENESS_BUCKETS> lateness{};         ///< The histogram of how late the callbacks were called compared to the timestamps of their events.
+
+    /**
+     * @brief Returns the upper bound of the lateness histogram bucket holding the given fraction of the callbacks, such as 0.99.
+     */
+    std::chrono::nanoseconds latenessPercentile(double fraction) const
+    {
+        auto total = std::uint64_t(0);
+        for(auto count : lateness)
+        {
+            total += count;
+        }
+        auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(total));
+        auto seen = std::uint64_t(0);
+        for(std::size_t bucket = 0; bucket < LATENESS_BUCKETS; ++bucket)
+        {
+            seen += lateness[bucket];
+            if(seen > rank || (seen == total && seen != 0))
+            {
+                return bucket == 0 ? std::chrono::nanoseconds(0) : std::chrono::nanoseconds(std::int64_t(1) << bucket);
+            }
+        }
+        return std::chrono::nanoseconds(0);
+    }
+
+    double addsPerSecond(const QueueStatsSnapshot& earlier) const { return perSecond(adds - earlier.adds, earlier); }
+
+    double cancelsPerSecond(const QueueStatsSnapshot& earlier) const { return perSecond(cancels - earlier.cancels, earlier); }
+
+    double reschedulesPerSecond(const QueueStatsSnapshot& earlier) const { return perSecond(reschedules - earlier.reschedules, earlier); }
+
+private:
+    double perSecond(std::uint64_t count, const QueueStatsSnapshot& earlier) const
+    {
+        auto seconds = std::chrono::duration<double>(taken - earlier.taken).count();
+        return seconds > 0 ? static_cast<double>(count) / seconds : 0.0;
+    }
+};
+
+/**
+ * @struct NullQueueStats
+ * @brief The default statistics policy of BasicTimedEventQueue, which records nothing and compiles away entirely.
+ */
+struct NullQueueStats
+{
+    static constexpr bool ENABLED = false;
+
+    /**
+     * @brief The start of a section holding the queue mutex.
+     */
+    struct Hold
+    {
+    };
+
+    Hold hold() const { return Hold(); }
+    void release(const Hold&, std::size_t) {}
+    void pending(std::size_t) {}
+    void added(std::size_t = 1) {}
+    void cancelled(std::size_t = 1) {}
+    void rescheduled(std::size_t = 1) {}
+    template<typename F>
+    void callback(const TIMESTAMP&, const TIMESTAMP&, F&& fn)
+    {
+        fn();
+    }
+};
+
+/**
+ * @class QueueStats
+ * @brief A statistics policy counting modifications, mutex hold time, callback durations and the lateness of expirations.
+ *
+ * All counters are relaxed atomics, so they can be updated by the worker,
+ * the dispatch threads and the modifying threads, and read through stats()
+ * at any time without stopping the worker. Every section holding the mutex
+ * and every callback costs two reads of the steady clock.
+ */
+class QueueStats
+{
+private:
+    std::atomic<std::size_t>   _pending         = 0;
+    std::atomic<std::uint64_t> _adds            = 0;
+    std::atomic<std::uint64_t> _cancels         = 0;
+    std::atomic<std::uint64_t> _reschedules     = 0;
+    std::atomic<std::int64_t>  _mutexHeld       = 0; ///< In nanoseconds.
+    std::atomic<std::uint64_t> _callbacks       = 0;
+    std::atomic<std::int64_t>  _callbackTime    = 0; ///< In nanoseconds.
+    std::atomic<std::int64_t>  _maxCallbackTime = 0; ///< In nanoseconds.
+
+    std::array<std::atomic<std::uint64_t>, QueueStatsSnapshot::LATENESS_BUCKETS> _lateness{}; ///< The lateness histogram.
+
+    static std::size_t bucketOf(std::int64_t nanoseconds)
+    {
+        if(nanoseconds <= 0)
+        {
+            return 0;
+        }
+        auto bucket = std::size_t(0);
+        for(auto bits = static_cast<std::uint64_t>(nanoseconds); bits != 0; bits >>= 1)
+        {
+            ++bucket;
+        }
+        return std::min(bucket, QueueStatsSnapshot::LATENESS_BUCKETS - 1);
+    }
+
+public:
+    static constexpr bool ENABLED = true;
+
+    struct Hold
+    {
+        TIMESTAMP start; ///< When the mutex was acquired.
+    };
+
+    /**
+     * @brief Starts a section holding the queue mutex.
+     */
+    Hold hold() const { return Hold{TIME::now()}; }
+
+    /**
+     * @brief Ends a section holding the queue mutex, after which the storage holds @p pending events.
+     */
+    void release(const Hold& hold, std::size_t pending)
+    {
+        _mutexHeld.fetch_add((TIME::now() - hold.start).count(), std::memory_order_relaxed);
+        _pending.store(pending, std::memory_order_relaxed);
+    }
+
+    void pending(std::size_t pending) { _pending.store(pending, std::memory_order_relaxed); }
+    void added(std::size_t count = 1) { _adds.fetch_add(count, std::memory_order_relaxed); }
+    void cancelled(std::size_t count = 1) { _cancels.fetch_add(count, std::memory_order_relaxed); }
+    void rescheduled(std::size_t count = 1) { _reschedules.fetch_add(count, std::memory_order_relaxed); }
+
+    /**
+     * @brief Calls @p fn, the callback of an event with the given timestamp called at @p now, and records its lateness and duration.
+     */
+    template<typename F>
+    void callback(const TIMESTAMP& timestamp, const TIMESTAMP& now, F&& fn)
+    {
+        _lateness[bucketOf((now - timestamp).count())].fetch_add(1, std::memory_order_relaxed);
+        auto start = TIME::now();
+        fn();
+        auto duration = (TIME::now() - start).count();
+        _callbacks.fetch_add(1, std::memory_order_relaxed);
+        _callbackTime.fetch_add(duration, std::memory_order_relaxed);
+        auto longest = _maxCallbackTime.load(std::memory_order_relaxed);
+        while(duration > longest && !_maxCallbackTime.compare_exchange_weak(longest, duration, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    QueueStatsSnapshot snapshot() const
+    {
+        QueueStatsSnapshot snapshot;
+        snapshot.taken           = TIME::now();
+        snapshot.pending         = _pending.load(std::memory_order_relaxed);
+        snapshot.adds            = _adds.load(std::memory_order_relaxed);
+        snapshot.cancels         = _cancels.load(std::memory_order_relaxed);
+        snapshot.reschedules     = _reschedules.load(std::memory_order_relaxed);
+        snapshot.mutexHeld       = std::chrono::nanoseconds(_mutexHeld.load(std::memory_order_relaxed));
+        snapshot.callbacks       = _callbacks.load(std::memory_order_relaxed);
+        snapshot.callbackTime    = std::chrono::nanoseconds(_callbackTime.load(std::memory_order_relaxed));
+        snapshot.maxCallbackTime = std::chrono::nanoseconds(_maxCallbackTime.load(std::memory_order_relaxed));
+        for(std::size_t bucket = 0; bucket < QueueStatsSnapshot::LATENESS_BUCKETS; ++bucket)
+        {
+            snapshot.lateness[bucket] = _lateness[bucket].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+};
+
+/**
+ * @class BasicTimedEventQueue
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam Callback The callable invoked as callback(timestamp, value) when an event expires, with the value as an
+ *                  rvalue so that it may take ownership of it.
+ * @tparam Storage The storage policy keeping the events, OrderedMapStorage<T> by default.
+ * @tparam Clock The clock the worker reads to expire events, TIME by default. Its time points have to be TIMESTAMPs,
+ *               as with CoarseSteadyClock.
+ * @tparam Stats The statistics policy, NullQueueStats by default, which records nothing. QueueStats enables stats().
+ * @tparam Mutex The mutex serializing the queue, std::mutex by default. With std::shared_mutex, lookups by value that
+ *               have to take it take it shared, so that they do not serialize, at the price of slower modifications.
+ *
+ * @brief A class that manages a queue of timed events, allowing users to schedule, update, and cancel events.
+ *
+ * The BasicTimedEventQueue class is a template class that allows users to add,
+ * remove, and update events with specified timestamps and associated values.
+ * It uses a separate worker thread to manage event expiration, and when an
+ * event's timestamp expires, it invokes the callback. This class is designed
+ * to be thread-safe, ensuring that its operations can be called from multiple
+ * threads without causing data races or other concurrency issues.
+ *
+ * The callback is a compile-time parameter, so the worker calls it directly
+ * and the compiler can inline it into the expiration loop. It may also
+ * provide dispatchKey(timestamp, value) to key the events for
+ * DispatchOrdering::PerKey. TimedEventQueue adapts this class to a pure
+ * virtual onTimestampExpire member.
+ *
+ * Events can be removed or rescheduled by value, by timestamp or through the
+ * TimerHandle returned by addEvent. The value based members need a storage
+ * with a value index; with NoValueIndex they do not compile, and T no longer
+ * has to be ordered or unique.
+ */
+template<typename T, typename Callback, typename Storage = OrderedMapStorage<T>, typename Clock = TIME, typename Stats = NullQueueStats,
+         typename Mutex = std::mutex>
+class BasicTimedEventQueue
+{
+private:
+    static constexpr bool SHARED_LOOKUPS = std::is_same_v<Mutex, std::shared_mutex>;
+
+    static constexpr int LOOKUP_ATTEMPTS = 64; ///< The number of times a lookup finds the mutex busy and the lookup window closed before it blocks on the mutex.
+
+    using ConditionVariable = std::conditional_t<std::is_same_v<Mutex, std::mutex>, std::condition_variable, std::condition_variable_any>;
+
+    static_assert(std::is_same_v<typename Clock::time_point, TIMESTAMP>, "the time points of the clock have to be TIMESTAMPs");
+
+    /**
+     * @brief A modification submitted to the worker thread with SubmissionMode::LockFree.
+     */
+    struct Command
+    {
+        using Apply = void (*)(BasicTimedEventQueue&, Command&);
+
+        std::atomic<Command*> next  = nullptr; ///< The next command of the submission queue.
+        Apply                 apply = nullptr; ///< Applies the command to the storage.
+        std::uint32_t         index = 0;       ///< The index of the command in the command pool.
+        TIMESTAMP             timestamp;       ///< The timestamp argument of the modification.
+        std::optional<T>      value;           ///< The value argument of the modification, empty for modifications by timestamp only.
+        TimerHandle           handle;          ///< The handle reserved for an added event, or the handle argument of the modification.
+        TIMESTAMP::duration   period{0};       ///< The interval of a periodic event added by the command.
+        Recurrence            recurrence = Recurrence::FixedRate; ///< The recurrence of a periodic event added by the command.
+    };
+
+    using Apply = typename Command::Apply;
+
+    /**
+     * @brief The handle of an event added with SubmissionMode::LockFree, reserved by the producer before the worker adds the event.
+     *
+     * The generation is advanced by the worker when the ticket is released,
+     * which happens when the event is removed through the ticket, when the
+     * event could not be added, or when the storage slot of the event is
+     * reused by a later ticket because the event has expired or was removed
+     * otherwise.
+     */
+    /**
+     * @brief Packs a storage handle into one word, so that a ticket can publish it with a single atomic store.
+     */
+    static constexpr std::uint64_t packHandle(const TimerHandle& handle) { return std::uint64_t(handle.index) << 32 | handle.generation; }
+
+    static constexpr TimerHandle unpackHandle(std::uint64_t bits) { return TimerHandle{static_cast<std::uint32_t>(bits >> 32), static_cast<std::uint32_t>(bits)}; }
+
+    struct Ticket
+    {
+        std::atomic<std::uint32_t> generation = 0;                         ///< Odd while the ticket is in use.
+        std::atomic<std::uint64_t> binding    = packHandle(TimerHandle()); ///< The packed handle of the event in the storage, published by the worker once it added the event.
+    };
+
+    /**
+     * @brief Calls the callback of the queue on the threads of its DispatchPool.
+     */
+    struct PoolDispatch
+    {
+        BasicTimedEventQueue* queue; ///< The queue whose callback is called.
+
+        void operator()(const TIMESTAMP& timestamp, T&& value) const { queue->invoke(timestamp, std::move(value)); }
+    };
+
+    const TimedEventQueueOptions                   _options;                               ///< The options the queue was constructed with.
+    Callback                                       _callback;                              ///< The callable invoked when an event expires.
+    Storage                                        _storage;                               ///< The storage policy holding the events, used to efficiently find the next event to expire.
+    Stats                                          _stats;                                 ///< The statistics of the queue, empty with NullQueueStats.
+    Mutex                                          _mutex;                                 ///< A mutex used to protect concurrent access to the data members, ensuring thread safety.
+    ConditionVariable                              _cv;                                    ///< A condition variable used to signal the internal worker thread when events are added, removed, or updated.
+    std::atomic<bool>                              _exit               = false;            ///< An atomic flag used to indicate whether the worker thread should exit, allowing for clean shutdown of the thread.
+    std::atomic<TIMESTAMP>                         _wakeup             = TIMESTAMP::min(); ///< The deadline the worker thread sleeps until, or TIMESTAMP::min() while it is awake.
+    std::atomic<std::uint64_t>                     _avoidedWakeups     = 0;                ///< The number of additions and reschedules that did not need to wake the worker thread.
+    std::atomic<std::uint64_t>                     _capacityRejections = 0;                ///< The number of events that were not added because the storage was full.
+    std::atomic<std::uint64_t>                     _wakeups            = 0;                ///< The number of times the worker thread woke up to expire events.
+    std::atomic<std::uint64_t>                     _expiredEvents      = 0;                ///< The number of expired events delivered to the callback.
+    std::atomic<std::uint64_t>                     _truncatedDrains    = 0;                ///< The number of drains stopped by maxExpirationsPerDrain with events still due.
+    std::atomic<std::uint64_t>                     _lateEvents         = 0;                ///< The number of stale events delivered with StalePolicy::DeliverLate.
+    std::atomic<std::uint64_t>                     _droppedEvents      = 0;                ///< The number of stale events discarded with StalePolicy::Drop.
+    std::atomic<std::uint64_t>                     _collapsedEvents    = 0;                ///< The number of stale events discarded with StalePolicy::Collapse.
+    std::atomic<std::size_t>                       _publishedSize      = 0;                ///< The number of pending events, published after every modification for size().
+    std::atomic<TIMESTAMP>                         _publishedWakeup    = TIMESTAMP::max(); ///< The next wakeup, published after every modification for nextDeadline().
+    std::atomic<bool>                              _lookupWindow       = false;            ///< Whether the worker is in a callback with ExpirationMode::Locked, holding the mutex but leaving the storage alone.
+    std::atomic<std::size_t>                       _windowReaders      = 0;                ///< The lookups reading the storage in the lookup window.
+    std::atomic<TIMESTAMP>                         _simulatedNow       = TIMESTAMP();      ///< The virtual time of the queue with simulatedTime, only advanced by the worker.
+    std::size_t                                    _timeHolds          = 0;                ///< The number of holdTime calls not yet released, which keep the virtual time from advancing.
+    bool                                           _simulationIdle     = false;            ///< Whether the worker of a simulated queue waits for a modification or a release.
+    ConditionVariable                              _idleCv;                                ///< Signals waitUntilIdle when the worker of a simulated queue starts waiting or exits.
+    MpscQueue<Command>                             _submissions;                           ///< The commands submitted with SubmissionMode::LockFree and not yet applied.
+    std::unique_ptr<LockFreePool<Command>>         _commands;                              ///< The commands recycled by the worker with SubmissionMode::LockFree.
+    std::unique_ptr<LockFreePool<Ticket>>          _tickets;                               ///< The handles reserved by the producers with SubmissionMode::LockFree.
+    std::vector<std::uint32_t>                     _slotTickets;                           ///< The ticket bound to every storage slot with SubmissionMode::LockFree, only used by the worker.
+    std::atomic<std::thread::id>                   _driver;                                ///< The thread that last applied the commands with SubmissionMode::LockFree, the only one that may read the storage.
+    std::atomic<std::size_t>                       _pendingCommands    = 0;                ///< The number of submitted commands not yet applied.
+    std::unique_ptr<DispatchPool<T, PoolDispatch>> _pool;                                  ///< The threads calling the callback when dispatchThreads is set.
+    std::vector<std::pair<TIMESTAMP, T>>           _batch;                                 ///< The expired events of a drain with ExpirationMode::Unlocked, only used by the thread driving the queue.
+#if defined(__linux__)
+    std::unique_ptr<TimerFd>                       _timer;                                 ///< The timer the worker waits for with WaitBackend::TimerFd.
+#endif
+    std::thread                                    _thread;                                ///< The worker thread that manages event expiration and calls the user-provided callback function.
+
+    /**
+     * @brief The internal function executed by the worker thread, which manages event expiration and calls the user-provided callback function.
+     *
+     * This function continuously checks for expired events in the queue and
+     * calls the user-provided callback function when an event's timestamp
+     * expires. It also handles waiting for the next event to expire and
+     * responding to updates from other threads that modify the event queue.
+     */
+    void run()
+    {
+        if(_options.simulatedTime)
+        {
+            runSimulated();
+            return;
+        }
+        if(lockFree())
+        {
+            runLockFree();
+            return;
+        }
+
+        std::unique_lock lock(_mutex);
+        while(!_exit.load())
+        {
+            auto passed = waitUntil(lock, nextWakeup());
+            _wakeup     = TIMESTAMP::min();
+
+            if(_exit.load())
+            {
+                break;
+            }
+
+            auto now = std::max(Clock::now(), passed);
+            processDue(lock, now);
+            if(behind(now))
+            {
+                // Let the producers waiting for the mutex in before the next drain.
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+            }
+        }
+    }
+
+    /**
+     * @brief The loop of the worker thread with simulatedTime.
+     *
+     * The worker expires the events due at the virtual time, and then moves
+     * the virtual time straight to the next wakeup instead of sleeping until
+     * it. It only waits while the queue is empty or time is held, so events
+     * fire in exactly the order they would on a real clock, at the speed of
+     * the CPU.
+     */
+    void runSimulated()
+    {
+        std::unique_lock lock(_mutex);
+        while(!_exit.load())
+        {
+            auto now = _simulatedNow.load();
+            processDue(lock, now);
+            if(behind(now))
+            {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
+            }
+            if(auto deadline = nextWakeup(); deadline != TIMESTAMP::max() && _timeHolds == 0)
+            {
+                _simulatedNow = std::max(deadline, now);
+                continue;
+            }
+            if(_exit.load())
+            {
+                break;
+            }
+            _wakeup         = TIMESTAMP::max();
+            _simulationIdle = true;
+            _idleCv.notify_all();
+            _cv.wait(lock);
+            _simulationIdle = false;
+            _wakeup         = TIMESTAMP::min();
+        }
+        _idleCv.notify_all();
+    }
+
+    /**
+     * @brief The loop of the worker thread with SubmissionMode::LockFree.
+     *
+     * The worker applies the submitted commands, expires the due events
+     * without holding the mutex, and publishes the deadline it is about to
+     * sleep until before it checks the submission queue a last time under the
+     * mutex. A producer either pushes its command before that check, which
+     * then keeps the worker awake, or reads the published deadline after it
+     * and wakes the worker if its event is due earlier.
+     */
+    void runLockFree()
+    {
+        std::unique_lock lock(_mutex, std::defer_lock);
+        auto             passed = TIMESTAMP::min();
+        while(!_exit.load())
+        {
+            processDueLockFree(std::max(Clock::now(), passed));
+
+            lock.lock();
+            auto deadline = nextWakeup();
+            armWakeup(deadline);
+            passed = TIMESTAMP::min();
+            if(_submissions.empty() && !_exit.load())
+            {
+                passed = waitUntil(lock, deadline);
+            }
+            _wakeup = TIMESTAMP::min();
+            lock.unlock();
+        }
+    }
+
+    /**
+     * @brief Publishes the deadline the worker is about to sleep until and arms the timer with it. Must be called with the mutex held.
+     *
+     * The timer is armed before the deadline is published, so that a producer
+     * waking the worker after reading the deadline cannot be overridden.
+     */
+    void armWakeup(const TIMESTAMP& deadline)
+    {
+#if defined(__linux__)
+        if(_timer)
+        {
+            _timer->arm(deadline);
+        }
+#endif
+        _wakeup = deadline;
+    }
+
+    /**
+     * @brief Sleeps until the deadline or until the worker is woken up. Must be called with the mutex held.
+     *
+     * A deadline of TIMESTAMP::max() means that the queue is empty, then the
+     * worker waits without a timeout.
+     *
+     * @return A time point that has certainly passed on the steady clock when
+     *         the wait ended, so that a coarse clock lagging behind it does
+     *         not make the worker spin, or TIMESTAMP::min() if none is known.
+     */
+    TIMESTAMP waitUntil(std::unique_lock<Mutex>& lock, const TIMESTAMP& deadline)
+    {
+#if defined(__linux__)
+        if(_timer)
+        {
+            armWakeup(deadline);
+            lock.unlock();
+            _timer->wait();
+            auto fired = _timer->clear();
+            lock.lock();
+            return fired ? _wakeup.load() : TIMESTAMP::min();
+        }
+#endif
+        _wakeup = deadline;
+        if(deadline == TIMESTAMP::max())
+        {
+            _cv.wait(lock);
+            return TIMESTAMP::min();
+        }
+        if(_options.spinThreshold.count() > 0)
+        {
+            return spinUntil(lock, deadline);
+        }
+        return _cv.wait_until(lock, deadline) == std::cv_status::timeout ? deadline : TIMESTAMP::min();
+    }
+
+    /**
+     * @brief Blocks until spinThreshold before the deadline and spins on the steady clock for the rest of the wait. Must be called with the mutex held.
+     *
+     * Waking from the condition variable costs tens of microseconds of
+     * lateness, which the spin avoids at the price of a busy core for the
+     * last stretch of every wait. The spin releases the mutex and ends early
+     * when a producer publishes an earlier deadline or the queue stops.
+     *
+     * @return The deadline if it was reached, or TIMESTAMP::min() if the wait ended early.
+     */
+    TIMESTAMP spinUntil(std::unique_lock<Mutex>& lock, const TIMESTAMP& deadline)
+    {
+        auto spinFrom = deadline - _options.spinThreshold;
+        if(TIME::now() < spinFrom && _cv.wait_until(lock, spinFrom) == std::cv_status::no_timeout)
+        {
+            return TIMESTAMP::min();
+        }
+        lock.unlock();
+        auto reached = false;
+        while(!_exit.load(std::memory_order_relaxed) && _wakeup.load(std::memory_order_relaxed) == deadline)
+        {
+            if(TIME::now() >= deadline)
+            {
+                reached = true;
+                break;
+            }
+            cpuRelax();
+        }
+        lock.lock();
+        return reached ? deadline : TIMESTAMP::min();
+    }
+
+    /**
+     * @brief Expires the events due at the specified time point and dispatches them as selected by the options.
+     *
+     * Must be called with the mutex held, which is released while the
+     * callbacks run unless the ExpirationMode is Locked.
+     *
+     * @return The number of expired events delivered to the callback.
+     */
+    template<typename Lock>
+    std::size_t processDue(Lock& lock, const TIMESTAMP& now)
+    {
+        if(_pool)
+        {
+            auto expired = expireDue(now, [this](const TIMESTAMP& timestamp, T&& value) { postToPool(timestamp, std::move(value)); });
+            lock.unlock();
+            _pool->flush();
+            lock.lock();
+            return expired;
+        }
+
+        if(_options.expirationMode == ExpirationMode::Locked)
+        {
+            return expireDue(now, [this](const TIMESTAMP& timestamp, T&& value) {
+                LookupWindow window(*this);
+                invoke(timestamp, std::move(value));
+            });
+        }
+
+        auto expired = expireDue(now, [this](const TIMESTAMP& timestamp, T&& value) { _batch.emplace_back(timestamp, std::move(value)); });
+        lock.unlock();
+        for(auto& [timestamp, value] : _batch)
+        {
+            invoke(timestamp, std::move(value));
+        }
+        _batch.clear();
+        lock.lock();
+        return expired;
+    }
+
+    /**
+     * @brief Applies the submitted commands and expires the events due at the specified time point with SubmissionMode::LockFree.
+     *
+     * Must only be called from the thread owning the storage, without the mutex held.
+     *
+     * @return The number of expired events delivered to the callback.
+     */
+    std::size_t processDueLockFree(const TIMESTAMP& now)
+    {
+        _driver.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        applySubmissions();
+        auto expired = std::size_t(0);
+        if(_pool)
+        {
+            expired = expireDue(now, [this](const TIMESTAMP& timestamp, T&& value) { postToPool(timestamp, std::move(value)); });
+            _pool->flush();
+        }
+        else
+        {
+            expired = expireDue(now, [this](const TIMESTAMP& timestamp, T&& value) { invoke(timestamp, std::move(value)); });
+        }
+        applySubmissions();
+        return expired;
+    }
+
+    /**
+     * @brief Applies and releases all linked commands of the submission queue. Must only be called from the worker thread.
+     */
+    void applySubmissions()
+    {
+        auto applied = std::size_t(0);
+        while(auto* command = _submissions.pop())
+        {
+            command->apply(*this, *command);
+            command->value.reset();
+            _commands->release(command->index);
+            ++applied;
+        }
+        _pendingCommands.fetch_sub(applied, std::memory_order_relaxed);
+        _stats.pending(_storage.size());
+        publish();
+    }
+
+    bool lockFree() const { return _options.submissionMode == SubmissionMode::LockFree && !_options.singleThreaded; }
+
+    TIMESTAMP currentTime() const { return _options.simulatedTime ? _simulatedNow.load() : Clock::now(); }
+
+    /**
+     * @brief The lock of a single threaded queue, which does nothing.
+     */
+    struct NoLock
+    {
+        void lock() {}
+        void unlock() {}
+    };
+
+    /**
+     * @brief The lock of a public member, which also reports the time the mutex was held and the pending events to the statistics.
+     */
+    class Guard
+    {
+    private:
+        BasicTimedEventQueue&        _queue;
+        std::unique_lock<Mutex> _lock;
+        typename Stats::Hold         _hold;
+
+    public:
+        explicit Guard(BasicTimedEventQueue& queue)
+            : _queue(queue)
+            , _lock(queue._options.singleThreaded ? std::unique_lock<Mutex>(queue._mutex, std::defer_lock) : std::unique_lock<Mutex>(queue._mutex))
+            , _hold(queue._stats.hold())
+        {
+        }
+
+        Guard(const Guard&) = delete;
+
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard()
+        {
+            _queue._stats.release(_hold, _queue._storage.size());
+            _queue.publish();
+        }
+    };
+
+    /**
+     * @brief Locks the mutex, unless the queue is single threaded.
+     */
+    Guard guard() { return Guard(*this); }
+
+    /**
+     * @brief Publishes the number of pending events and the next wakeup for size() and nextDeadline().
+     *
+     * Must be called with the mutex held, or from the thread owning the
+     * storage with SubmissionMode::LockFree, after the storage changed.
+     */
+    void publish()
+    {
+        _publishedSize.store(_storage.size(), std::memory_order_relaxed);
+        _publishedWakeup.store(nextWakeup(), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the duration from the current time to @p timestamp, or std::nullopt without a timestamp.
+     */
+    std::optional<TIMESTAMP::duration> remaining(const std::optional<TIMESTAMP>& timestamp) const
+    {
+        if(!timestamp)
+        {
+            return std::nullopt;
+        }
+        return *timestamp - currentTime();
+    }
+
+    /**
+     * @brief Lets lookups read the storage while the worker calls a callback with ExpirationMode::Locked.
+     *
+     * The window closes when the lookup window is destroyed, also if the
+     * callback throws, and waits for the lookups reading the storage in it,
+     * before the worker modifies the storage again.
+     */
+    class LookupWindow
+    {
+    private:
+        BasicTimedEventQueue& _queue;
+
+    public:
+        explicit LookupWindow(BasicTimedEventQueue& queue)
+            : _queue(queue)
+        {
+            _queue._lookupWindow.store(true, std::memory_order_release);
+        }
+
+        LookupWindow(const LookupWindow&) = delete;
+
+        LookupWindow& operator=(const LookupWindow&) = delete;
+
+        ~LookupWindow()
+        {
+            _queue._lookupWindow.store(false);
+            while(_queue._windowReaders.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    /**
+     * @brief Looks up the timestamp of an event in the lookup window, returning std::nullopt if the window is closed.
+     *
+     * A reader registers before checking the window, and the worker closes it
+     * before checking the readers, so one of them always sees the other.
+     */
+    template<typename Key>
+    std::optional<std::optional<TIMESTAMP>> lookupInWindow(const Key& key)
+    {
+        std::optional<std::optional<TIMESTAMP>> timestamp;
+        _windowReaders.fetch_add(1);
+        if(_lookupWindow.load())
+        {
+            timestamp = _storage.timestampOf(key);
+        }
+        _windowReaders.fetch_sub(1, std::memory_order_release);
+        return timestamp;
+    }
+
+    /**
+     * @brief Looks up the timestamp of an event by handle, value or key, without blocking on a drain if possible.
+     *
+     * Lookups by handle read the timestamps the storage publishes, if it does,
+     * and never take the mutex. Other lookups read the storage in the lookup
+     * window the worker opens around every callback with
+     * ExpirationMode::Locked, or take the mutex, shared if it is a
+     * std::shared_mutex, when it is free. Only after finding the window closed
+     * and the mutex busy LOOKUP_ATTEMPTS times in a row do they block on the
+     * mutex.
+     *
+     * With SubmissionMode::LockFree, the worker reads the storage without the
+     * mutex. Lookups by handle then read the binding the ticket publishes and
+     * the published timestamp, and every other lookup throws
+     * std::logic_error unless it is called from the thread driving the queue.
+     */
+    template<typename Key>
+    std::optional<TIMESTAMP> lookup(const Key& key)
+    {
+        if(lockFree() || _options.singleThreaded)
+        {
+            if constexpr(std::is_same_v<Key, TimerHandle> && HasPublishedTimestamps<Storage>::value)
+            {
+                if(lockFree())
+                {
+                    return _storage.publishedTimestampOf(boundHandle(key));
+                }
+            }
+            if(lockFree() && _driver.load(std::memory_order_relaxed) != std::this_thread::get_id())
+            {
+                throw std::logic_error("BasicTimedEventQueue: with SubmissionMode::LockFree, lookups that read the storage must be called from the thread driving the queue");
+            }
+            if constexpr(std::is_same_v<Key, TimerHandle>)
+            {
+                if(lockFree())
+                {
+                    return _storage.timestampOf(resolveTicket(key));
+                }
+            }
+            return _storage.timestampOf(key);
+        }
+        if constexpr(std::is_same_v<Key, TimerHandle> && HasPublishedTimestamps<Storage>::value)
+        {
+            return _storage.publishedTimestampOf(key);
+        }
+        else
+        {
+            for(auto attempt = 0; attempt < LOOKUP_ATTEMPTS; ++attempt)
+            {
+                if(auto timestamp = lookupInWindow(key))
+                {
+                    return *timestamp;
+                }
+                if constexpr(SHARED_LOOKUPS)
+                {
+                    if(std::shared_lock lock(_mutex, std::try_to_lock); lock.owns_lock())
+                    {
+                        return _storage.timestampOf(key);
+                    }
+                }
+                else
+                {
+                    if(std::unique_lock lock(_mutex, std::try_to_lock); lock.owns_lock())
+                    {
+                        return _storage.timestampOf(key);
+                    }
+                }
+                std::this_thread::yield();
+            }
+            if constexpr(SHARED_LOOKUPS)
+            {
+                std::shared_lock lock(_mutex);
+                return _storage.timestampOf(key);
+            }
+            else
+            {
+                std::scoped_lock lock(_mutex);
+                return _storage.timestampOf(key);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the time point the worker sleeps until for the earliest deadline, which is later by the slack of the queue.
+     */
+    TIMESTAMP wakeupFor(const TIMESTAMP& deadline) const
+    {
+        auto slack = std::chrono::duration_cast<TIMESTAMP::duration>(_options.slack);
+        return deadline < TIMESTAMP::max() - slack ? deadline + slack : TIMESTAMP::max();
+    }
+
+    /**
+     * @brief Returns the time point the worker sleeps until for the events in the storage, or TIMESTAMP::max() while it is empty.
+     */
+    TIMESTAMP nextWakeup() const { return _storage.empty() ? TIMESTAMP::max() : wakeupFor(_storage.nextDeadline()); }
+
+    /**
+     * @brief Returns whether a stale event with the value @p next repeats the one held back with @p held, for StalePolicy::Collapse.
+     */
+    static bool repeats(const T& held, const T& next)
+    {
+        if constexpr(IsEqualityComparable<T>::value)
+        {
+            return held == next;
+        }
+        else
+        {
+            (void)held;
+            (void)next;
+            return false;
+        }
+    }
+
+    /**
+     * @brief Expires all events due at the specified time point with the given function and records the size of the batch.
+     *
+     * @return The number of events passed to @p fn, without the stale events that were dropped or collapsed.
+     */
+    template<typename F>
+    std::size_t expireDue(const TIMESTAMP& now, F&& fn)
+    {
+        auto hold    = _stats.hold();
+        auto expired = std::size_t(0);
+        auto limit   = _options.maxExpirationsPerDrain != 0 ? _options.maxExpirationsPerDrain : std::numeric_limits<std::size_t>::max();
+        auto deliver = [&expired, &fn](const TIMESTAMP& timestamp, T&& value) {
+            ++expired;
+            fn(timestamp, std::move(value));
+        };
+        if(_options.staleAfter.count() == 0)
+        {
+            _storage.expire(now, deliver, limit);
+        }
+        else
+        {
+            std::optional<std::pair<TIMESTAMP, T>> collapsed;
+            auto                                   flush = [&deliver, &collapsed] {
+                if(collapsed)
+                {
+                    deliver(collapsed->first, std::move(collapsed->second));
+                    collapsed.reset();
+                }
+            };
+            _storage.expire(now, [this, &now, &deliver, &collapsed, &flush](const TIMESTAMP& timestamp, T&& value) {
+                if(now - timestamp <= _options.staleAfter)
+                {
+                    flush();
+                    deliver(timestamp, std::move(value));
+                    return;
+                }
+                switch(_options.stalePolicy)
+                {
+                case StalePolicy::DeliverLate:
+                    _lateEvents.fetch_add(1, std::memory_order_relaxed);
+                    deliver(timestamp, std::move(value));
+                    break;
+                case StalePolicy::Drop:
+                    _droppedEvents.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                case StalePolicy::Collapse:
+                    if(collapsed && repeats(collapsed->second, value))
+                    {
+                        _collapsedEvents.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else
+                    {
+                        flush();
+                    }
+                    collapsed.emplace(timestamp, std::move(value));
+                    break;
+                }
+            }, limit);
+            flush();
+        }
+        if(behind(now))
+        {
+            _truncatedDrains.fetch_add(1, std::memory_order_relaxed);
+        }
+        _stats.release(hold, _storage.size());
+        publish();
+        _wakeups.fetch_add(1, std::memory_order_relaxed);
+        _expiredEvents.fetch_add(expired, std::memory_order_relaxed);
+        return expired;
+    }
+
+    /**
+     * @brief Returns whether a drain stopped by maxExpirationsPerDrain left events that are due at @p now.
+     */
+    bool behind(const TIMESTAMP& now) const { return _options.maxExpirationsPerDrain != 0 && !_storage.empty() && _storage.nextDeadline() <= now; }
+
+    /**
+     * @brief Pins the worker thread to the CPU selected by the options.
+     *
+     * @throws std::system_error If the affinity cannot be set, after the worker thread has been stopped.
+     */
+    void pinWorker()
+    {
+#if defined(__linux__)
+        auto      error = EINVAL;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if(_options.workerCpu < CPU_SETSIZE)
+        {
+            CPU_SET(_options.workerCpu, &cpus);
+            error = pthread_setaffinity_np(_thread.native_handle(), sizeof(cpus), &cpus);
+        }
+        if(error != 0)
+        {
+            stop();
+            throw std::system_error(error, std::generic_category(), "BasicTimedEventQueue: cannot pin the worker thread");
+        }
+#endif
+    }
+
+    /**
+     * @brief Submits a command to the worker thread with SubmissionMode::LockFree.
+     *
+     * The worker is woken if the command schedules an event earlier than the
+     * deadline it sleeps until, or if the number of pending commands reaches
+     * maxPendingCommands. Otherwise the worker applies the command when it
+     * wakes up anyway.
+     *
+     * @param timestamp The timestamp argument of the modification.
+     * @param value The value argument of the modification, if any.
+     * @param apply The function applying the command to the storage.
+     * @param schedules Whether the command can make the earliest deadline earlier.
+     * @param handle The handle reserved for an added event, or the handle argument of the modification.
+     * @param period The interval of a periodic event added by the command.
+     * @param recurrence The recurrence of a periodic event added by the command.
+     */
+    void submit(const TIMESTAMP& timestamp, std::optional<T> value, Apply apply, bool schedules, const TimerHandle& handle = TimerHandle(),
+                TIMESTAMP::duration period = TIMESTAMP::duration(0), Recurrence recurrence = Recurrence::FixedRate)
+    {
+        auto index = _commands->acquire();
+        if(index == LockFreePool<Command>::NONE)
+        {
+            throw std::length_error("BasicTimedEventQueue: too many pending commands");
+        }
+        auto& command      = (*_commands)[index];
+        command.apply      = apply;
+        command.index      = index;
+        command.timestamp  = timestamp;
+        command.value      = std::move(value);
+        command.handle     = handle;
+        command.period     = period;
+        command.recurrence = recurrence;
+        _submissions.push(&command);
+
+        auto pending = _pendingCommands.fetch_add(1, std::memory_order_relaxed) + 1;
+        if((schedules && wakeupFor(timestamp) < _wakeup.load()) || pending == _options.maxPendingCommands)
+        {
+            wake();
+        }
+        else if(schedules)
+        {
+            _avoidedWakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(pending > 2 * _options.maxPendingCommands)
+        {
+            // The worker is falling behind, let it run rather than grow the command pool further.
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Wakes the worker thread from its wait with SubmissionMode::LockFree.
+     *
+     * Only the producer that resets the published deadline locks the mutex
+     * and notifies, the others see that the worker is already awake.
+     */
+    void wake()
+    {
+        auto wakeup = _wakeup.load();
+        while(wakeup != TIMESTAMP::min())
+        {
+            if(_wakeup.compare_exchange_weak(wakeup, TIMESTAMP::min()))
+            {
+#if defined(__linux__)
+                if(_timer)
+                {
+                    _timer->wakeNow();
+                    return;
+                }
+#endif
+                std::scoped_lock lock(_mutex);
+                _cv.notify_one();
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Wakes the worker thread if a modification made the earliest deadline earlier than the one it sleeps until.
+     *
+     * Modifications that leave the earliest deadline unchanged or move it
+     * later do not wake the worker: it wakes up at the deadline it already
+     * waits for and then simply goes back to sleep. Must be called with the
+     * mutex held.
+     */
+    void notifyIfEarlier()
+    {
+        if(auto head = nextWakeup(); head < _wakeup.load())
+        {
+#if defined(__linux__)
+            if(_timer)
+            {
+                armWakeup(head);
+                return;
+            }
+#endif
+            _wakeup = head;
+            _cv.notify_one();
+        }
+        else
+        {
+            _avoidedWakeups.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Counts an event that was not added because the storage is at its capacity. Must be called with the mutex held.
+     */
+    void countRejection(const TimerHandle& handle)
+    {
+        if(!handle.valid() && _storage.full())
+        {
+            _capacityRejections.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Reserves the handle of an event added with SubmissionMode::LockFree. Can be called from any thread.
+     */
+    TimerHandle reserveTicket()
+    {
+        auto index = _tickets->acquire();
+        if(index == LockFreePool<Ticket>::NONE)
+        {
+            throw std::length_error("BasicTimedEventQueue: too many pending events");
+        }
+        auto& ticket     = (*_tickets)[index];
+        auto  generation = ticket.generation.load(std::memory_order_relaxed) + 1;
+        ticket.generation.store(generation, std::memory_order_relaxed);
+        return TimerHandle{index, generation};
+    }
+
+    /**
+     * @brief Returns whether the ticket a handle refers to is still in use, so its event may be pending. Can be called from any thread.
+     */
+    bool ticketInUse(const TimerHandle& handle)
+    {
+        auto* ticket = _tickets->find(handle.index);
+        return ticket != nullptr && ticket->generation.load(std::memory_order_acquire) == handle.generation;
+    }
+
+    /**
+     * @brief Returns the storage handle of the event a ticket refers to, or an invalid handle. Must only be called from the worker thread.
+     */
+    TimerHandle resolveTicket(const TimerHandle& handle)
+    {
+        return ticketInUse(handle) ? unpackHandle((*_tickets)[handle.index].binding.load(std::memory_order_relaxed)) : TimerHandle();
+    }
+
+    /**
+     * @brief Returns the storage handle of the event a ticket refers to, or an invalid handle. Can be called from any thread.
+     *
+     * The generation of the ticket is read before and after its binding, so
+     * a binding read while the ticket was released and reserved again for
+     * another event is discarded. A ticket whose command the worker has not
+     * applied yet is not bound.
+     */
+    TimerHandle boundHandle(const TimerHandle& handle)
+    {
+        auto* ticket = _tickets->find(handle.index);
+        if(ticket == nullptr || ticket->generation.load(std::memory_order_acquire) != handle.generation)
+        {
+            return TimerHandle();
+        }
+        auto bound = unpackHandle(ticket->binding.load(std::memory_order_acquire));
+        return ticket->generation.load(std::memory_order_relaxed) == handle.generation ? bound : TimerHandle();
+    }
+
+    /**
+     * @brief Advances the generation of a ticket and returns it to the pool. Must only be called from the worker thread.
+     */
+    void releaseTicket(std::uint32_t index)
+    {
+        auto& ticket = (*_tickets)[index];
+        ticket.binding.store(packHandle(TimerHandle()), std::memory_order_relaxed);
+        ticket.generation.store(ticket.generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        _tickets->release(index);
+    }
+
+    /**
+     * @brief Binds the ticket of an added event to the storage handle of the event. Must only be called from the worker thread.
+     *
+     * The ticket is released right away if the event was not added. A ticket
+     * still bound to the storage slot belongs to an event that has expired or
+     * was removed by value or timestamp since, so it is released now.
+     */
+    void bindTicket(const TimerHandle& ticket, const TimerHandle& handle)
+    {
+        if(!handle.valid())
+        {
+            releaseTicket(ticket.index);
+            return;
+        }
+        if(handle.index >= _slotTickets.size())
+        {
+            _slotTickets.resize(std::size_t(handle.index) + 1, LockFreePool<Ticket>::NONE);
+        }
+        auto& bound = _slotTickets[handle.index];
+        if(bound != LockFreePool<Ticket>::NONE)
+        {
+            releaseTicket(bound);
+        }
+        bound = ticket.index;
+        (*_tickets)[ticket.index].binding.store(packHandle(handle), std::memory_order_release);
+    }
+
+    /**
+     * @brief Erases the event a ticket refers to and releases the ticket. Must only be called from the worker thread.
+     */
+    void eraseTicket(const TimerHandle& ticket)
+    {
+        auto handle = resolveTicket(ticket);
+        if(_storage.erase(handle))
+        {
+            _slotTickets[handle.index] = LockFreePool<Ticket>::NONE;
+            releaseTicket(ticket.index);
+        }
+    }
+
+    template<typename V>
+    TimerHandle emplacePeriodic(const TIMESTAMP& first, TIMESTAMP::duration period, Recurrence recurrence, V&& value)
+    {
+        static_assert(std::is_copy_constructible_v<T>, "BasicTimedEventQueue: periodic events require a copy constructible value type");
+        if(period.count() <= 0)
+        {
+            throw std::invalid_argument("BasicTimedEventQueue: the interval of a periodic event must be positive");
+        }
+        _stats.added();
+        if(lockFree())
+        {
+            auto ticket = reserveTicket();
+            submit(first, std::optional<T>(std::forward<V>(value)), [](BasicTimedEventQueue& queue, Command& command) {
+                auto handle = queue._storage.insert(command.timestamp, std::move(*command.value));
+                queue._storage.setPeriod(handle, command.period, command.recurrence);
+                queue.countRejection(handle);
+                queue.bindTicket(command.handle, handle);
+            }, true, ticket, period, recurrence);
+            return ticket;
+        }
+        auto lock   = guard();
+        auto handle = _storage.insert(first, std::forward<V>(value));
+        _storage.setPeriod(handle, period, recurrence);
+        countRejection(handle);
+        notifyIfEarlier();
+        return handle;
+    }
+
+    /**
+     * @brief Writes the snapshot of the storage to @p out. Must be called with the mutex held, or from the driving thread with SubmissionMode::LockFree.
+     */
+    template<typename Serializer>
+    std::size_t writeSnapshot(std::ostream& out, Serializer& serialize)
+    {
+        auto now    = currentTime();
+        auto header = SnapshotHeader{};
+        std::memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+        header.version = SnapshotHeader::VERSION;
+        header.count   = _storage.size();
+        header.savedAt = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::string bytes;
+        _storage.forEach([&](const TIMESTAMP& timestamp, const T& value, TIMESTAMP::duration period, Recurrence recurrence) {
+            bytes.clear();
+            serialize(value, bytes);
+            if(bytes.size() > std::numeric_limits<std::uint32_t>::max())
+            {
+                throw std::runtime_error("BasicTimedEventQueue: a serialized value is too large for a snapshot");
+            }
+            auto record       = SnapshotRecord{};
+            record.deadline   = std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - now).count();
+            record.period     = std::chrono::duration_cast<std::chrono::nanoseconds>(period).count();
+            record.size       = static_cast<std::uint32_t>(bytes.size());
+            record.recurrence = static_cast<std::uint8_t>(recurrence);
+            bytes.resize((bytes.size() + 7) & ~std::size_t(7));
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        });
+        if(!out)
+        {
+            throw std::runtime_error("BasicTimedEventQueue: writing the snapshot failed");
+        }
+        return static_cast<std::size_t>(header.count);
+    }
+
+    /**
+     * @brief Reads a snapshot from @p in, calling @p add as add(timestamp, value, period, recurrence) for every event in it.
+     */
+    template<typename Deserializer, typename Add>
+    void readSnapshot(std::istream& in, Deserializer& deserialize, bool countDowntime, Add&& add)
+    {
+        auto header = SnapshotHeader{};
+        if(!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic)) != 0)
+        {
+            throw std::runtime_error("BasicTimedEventQueue: the stream does not hold a snapshot");
+        }
+        if(header.version != SnapshotHeader::VERSION)
+        {
+            throw std::runtime_error("BasicTimedEventQueue: the snapshot has an unsupported version");
+        }
+
+        auto base = currentTime();
+        if(countDowntime)
+        {
+            auto savedAt  = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.savedAt)));
+            auto downtime = std::chrono::duration_cast<TIMESTAMP::duration>(std::chrono::system_clock::now() - savedAt);
+            base          = downtime.count() > 0 ? base - downtime : base;
+        }
+
+        std::string bytes;
+        for(std::uint64_t index = 0; index < header.count; ++index)
+        {
+            auto record = SnapshotRecord{};
+            if(!in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+            {
+                throw std::runtime_error("BasicTimedEventQueue: the snapshot is truncated");
+            }
+            if(record.period < 0 || record.recurrence > static_cast<std::uint8_t>(Recurrence::FixedDelay))
+            {
+                throw std::runtime_error("BasicTimedEventQueue: the snapshot holds an invalid record");
+            }
+            bytes.resize((std::size_t(record.size) + 7) & ~std::size_t(7));
+            if(!in.read(bytes.data(), static_cast<std::streamsize>(bytes.size())))
+            {
+                throw std::runtime_error("BasicTimedEventQueue: the snapshot is truncated");
+            }
+
+            auto offset    = std::chrono::duration_cast<TIMESTAMP::duration>(std::chrono::nanoseconds(record.deadline));
+            auto timestamp = offset > TIMESTAMP::max() - base ? TIMESTAMP::max() : base + offset;
+            add(timestamp, deserialize(std::string_view(bytes.data(), record.size)), std::chrono::duration_cast<TIMESTAMP::duration>(std::chrono::nanoseconds(record.period)),
+                static_cast<Recurrence>(record.recurrence));
+        }
+    }
+
+    /**
+     * @brief Calls the callback for an expired event, recording its lateness and duration when statistics are enabled.
+     */
+    void invoke(const TIMESTAMP& timestamp, T&& value)
+    {
+        if constexpr(Stats::ENABLED)
+        {
+            _stats.callback(timestamp, currentTime(), [&] { _callback(timestamp, std::move(value)); });
+        }
+        else
+        {
+            _callback(timestamp, std::move(value));
+        }
+    }
+
+    /**
+     * @brief Stages an expired event for the DispatchPool, keyed before its value is moved.
+     */
+    void postToPool(const TIMESTAMP& timestamp, T&& value)
+    {
+        auto key = dispatchKey(timestamp, value);
+        _pool->post(key, timestamp, std::move(value));
+    }
+
+    std::size_t dispatchKey(const TIMESTAMP& timestamp, const T& value) const
+    {
+        if constexpr(HasDispatchKey<Callback, T>::value)
+        {
+            return _callback.dispatchKey(timestamp, value);
+        }
+        else
+        {
+            (void)timestamp;
+            return defaultDispatchKey(value);
+        }
+    }
+
+public:
+    /**
+     * @brief Constructs a new BasicTimedEventQueue object, initializing the worker thread.
+     *
+     * The constructor creates a new BasicTimedEventQueue object, initializing the
+     * worker thread that manages event expiration. The queue starts empty,
+     * and the worker waits without a timeout until the first event is added.
+     *
+     * @param callback The callable invoked when an event expires.
+     * @param options The options of the queue, such as its expiration mode.
+     * @param storage The storage policy instance, for example a TimingWheelStorage with a custom tick resolution.
+     */
+    explicit BasicTimedEventQueue(Callback callback = Callback(), const TimedEventQueueOptions& options = TimedEventQueueOptions(), Storage storage = Storage())
+        : _options(options)
+        , _callback(std::move(callback))
+        , _storage(std::move(storage))
+    {
+        if(_options.simulatedTime && (_options.externalDriver || _options.submissionMode == SubmissionMode::LockFree || _options.dispatchThreads > 0))
+        {
+            throw std::invalid_argument("BasicTimedEventQueue: simulatedTime needs a worker thread, SubmissionMode::Locked and no dispatch threads");
+        }
+        if(_options.waitBackend == WaitBackend::TimerFd && !_options.simulatedTime)
+        {
+#if defined(__linux__)
+            _timer = std::make_unique<TimerFd>();
+#else
+            throw std::invalid_argument("BasicTimedEventQueue: WaitBackend::TimerFd is only supported on Linux");
+#endif
+        }
+        if(_options.singleThreaded && !_options.externalDriver)
+        {
+            throw std::invalid_argument("BasicTimedEventQueue: a single threaded queue needs an external driver");
+        }
+        if(_options.staleAfter.count() < 0)
+        {
+            throw std::invalid_argument("BasicTimedEventQueue: staleAfter must not be negative");
+        }
+        if(_options.spinThreshold.count() < 0 || (_options.spinThreshold.count() > 0 && _options.waitBackend != WaitBackend::ConditionVariable))
+        {
+            throw std::invalid_argument("BasicTimedEventQueue: spinThreshold must not be negative and needs WaitBackend::ConditionVariable");
+        }
+        if constexpr(HasTimeOrigin<Storage>::value)
+        {
+            _storage.resetOrigin(currentTime());
+        }
+        if(lockFree())
+        {
+            auto reserve = std::max<std::size_t>(2 * _options.maxPendingCommands, 64);
+            _commands    = std::make_unique<LockFreePool<Command>>(reserve);
+            _tickets     = std::make_unique<LockFreePool<Ticket>>(reserve);
+        }
+        publish();
+        if(_options.dispatchThreads > 0 && !_options.singleThreaded)
+        {
+            _pool = std::make_unique<DispatchPool<T, PoolDispatch>>(_options.dispatchThreads, _options.dispatchOrdering, PoolDispatch{this});
+        }
+        if(_options.externalDriver)
+        {
+            armWakeup(nextWakeup());
+            return;
+        }
+        _thread = std::thread(&BasicTimedEventQueue::run, this);
+        if(_options.workerCpu >= 0)
+        {
+            pinWorker();
+        }
+    }
+
+    /**
+     * @brief Constructs a new BasicTimedEventQueue object with the specified storage policy instance.
+     *
+     * @param callback The callable invoked when an event expires.
+     * @param storage The storage policy instance, for example a TimingWheelStorage with a custom tick resolution.
+     * @param options The options of the queue, such as its expiration mode.
+     */
+    BasicTimedEventQueue(Callback callback, Storage storage, const TimedEventQueueOptions& options = TimedEventQueueOptions())
+        : BasicTimedEventQueue(std::move(callback), options, std::move(storage))
+    {
+    }
+
+    /**
+     * @brief Destructs the BasicTimedEventQueue object, stopping the worker thread and releasing resources.
+     *
+     * The destructor ensures that the worker thread is stopped and joined
+     * before the object is destroyed, preventing potential issues with
+     * accessing dangling resources. This is done by setting the _exit flag,
+     * notifying the worker thread via the condition variable, and joining the
+     * thread.
+     */
+    ~BasicTimedEventQueue() { stop(); }
+
+    BasicTimedEventQueue(const BasicTimedEventQueue&) = delete;
+
+    BasicTimedEventQueue& operator=(const BasicTimedEventQueue&) = delete;
+
+    /**
+     * @brief Adds an event with the specified timestamp and value to the queue.
+     *
+     * This function inserts a new event into the queue with the specified
+     * timestamp and associated value. It is thread-safe and can be called from
+     * multiple threads simultaneously. After adding the event, the function
+     * notifies the worker thread if the new event expires before the deadline
+     * the worker sleeps until. Any number of events can share a timestamp, and they expire in the order
+     * they were added. When the storage has a value index, values are unique:
+     * if the value is already in the queue, the event is not added. The event
+     * is not added either when the storage is at its capacity, which is
+     * counted by capacityRejections().
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, which can be used to remove or reschedule it without looking it up, or an
+     *         invalid handle if the event was not added.
+     */
+    TimerHandle addEvent(const TIMESTAMP& timestamp, const T& value) { return emplaceEvent(timestamp, value); }
+
+    /**
+     * @brief Adds an event with the specified timestamp to the queue, moving the value into the storage.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    TimerHandle addEvent(const TIMESTAMP& timestamp, T&& value) { return emplaceEvent(timestamp, std::move(value)); }
+
+    /**
+     * @brief Adds an event with the specified timestamp and a value constructed in place in the storage.
+     *
+     * The value is constructed once from @p args, with the mutex held, and
+     * is moved into the callback when the event expires. With
+     * SubmissionMode::LockFree it is constructed in the submitted command
+     * instead and moved into the storage by the worker.
+     *
+     * @param timestamp The timestamp of the event.
+     * @param args The arguments of the constructor of the value.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    template<typename... Args>
+    TimerHandle emplaceEvent(const TIMESTAMP& timestamp, Args&&... args)
+    {
+        _stats.added();
+        if(lockFree())
+        {
+            auto ticket = reserveTicket();
+            submit(timestamp, std::optional<T>(std::in_place, std::forward<Args>(args)...), [](BasicTimedEventQueue& queue, Command& command) {
+                auto handle = queue._storage.insert(command.timestamp, std::move(*command.value));
+                queue.countRejection(handle);
+                queue.bindTicket(command.handle, handle);
+            }, true, ticket);
+            return ticket;
+        }
+        auto lock = guard();
+        auto handle = _storage.emplace(timestamp, std::forward<Args>(args)...);
+        countRejection(handle);
+        notifyIfEarlier();
+        return handle;
+    }
+
+    /**
+     * @brief Adds an event that expires after the specified duration, measured from the current time of the clock of the queue.
+     *
+     * With CoarseSteadyClock, callers adding events at a high rate pay for a
+     * cheap coarse clock read only, at the price of deadlines up to one
+     * scheduler tick early.
+     *
+     * @param delay The duration after which the event expires.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    template<typename Rep, typename Period>
+    TimerHandle addEventAfter(const std::chrono::duration<Rep, Period>& delay, const T& value)
+    {
+        return addEvent(currentTime() + std::chrono::duration_cast<TIMESTAMP::duration>(delay), value);
+    }
+
+    /**
+     * @brief Adds an event that expires after the specified duration, moving the value into the storage.
+     *
+     * @param delay The duration after which the event expires.
+     * @param value The value associated with the event.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     */
+    template<typename Rep, typename Period>
+    TimerHandle addEventAfter(const std::chrono::duration<Rep, Period>& delay, T&& value)
+    {
+        return addEvent(currentTime() + std::chrono::duration_cast<TIMESTAMP::duration>(delay), std::move(value));
+    }
+
+    /**
+     * @brief Adds a periodic event, which first expires at the specified timestamp and then every interval until it is removed.
+     *
+     * When a periodic event expires, the worker moves it to its next deadline
+     * in place, reusing its storage node, before it calls the callback. A
+     * recurrence therefore neither allocates nor takes the mutex again, and
+     * nothing has to be re-added from the callback. The callback receives a
+     * copy of the value, so T has to be copy constructible, and the event
+     * keeps its handle for all its occurrences, so removeEvent with that
+     * handle, or with the value or the current timestamp, stops it;
+     * updateTimestamp moves its next occurrence. With a TimingWheelStorage an
+     * event fires at most once per tick.
+     *
+     * @param first The timestamp of the first occurrence.
+     * @param interval The interval between two occurrences, which must be positive.
+     * @param value The value associated with the event.
+     * @param recurrence Whether the interval is measured from the previous deadline or from the previous expiration.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     * @throws std::invalid_argument If the interval is not positive.
+     */
+    template<typename Rep, typename Period>
+    TimerHandle addPeriodicEvent(const TIMESTAMP& first, const std::chrono::duration<Rep, Period>& interval, const T& value,
+                                 Recurrence recurrence = Recurrence::FixedRate)
+    {
+        return emplacePeriodic(first, std::chrono::duration_cast<TIMESTAMP::duration>(interval), recurrence, value);
+    }
+
+    /**
+     * @brief Adds a periodic event, moving the value into the storage.
+     *
+     * @param first The timestamp of the first occurrence.
+     * @param interval The interval between two occurrences, which must be positive.
+     * @param value The value associated with the event.
+     * @param recurrence Whether the interval is measured from the previous deadline or from the previous expiration.
+     * @return The handle of the event, or an invalid handle if the event was not added.
+     * @throws std::invalid_argument If the interval is not positive.
+     */
+    template<typename Rep, typename Period>
+    TimerHandle addPeriodicEvent(const TIMESTAMP& first, const std::chrono::duration<Rep, Period>& interval, T&& value,
+                                 Recurrence recurrence = Recurrence::FixedRate)
+    {
+        return emplacePeriodic(first, std::chrono::duration_cast<TIMESTAMP::duration>(interval), recurrence, std::move(value));
+    }
+
+    /**
+     * @brief Adds a range of events to the queue under a single lock.
+     *
+     * This function inserts the events of a range of (timestamp, value) pairs,
+     * such as std::pair<TIMESTAMP, T>, while holding the queue mutex once. A
+     * range sorted by timestamp is inserted with hinted insertions. The worker
+     * thread is notified at most once, and only if the earliest deadline of
+     * the queue became earlier.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     * @param handles An output iterator receiving the handle of every event of the range, invalid for events that were not added.
+     * @return The output iterator past the last written handle.
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt addEvents(InputIt first, InputIt last, OutputIt handles)
+    {
+        if(lockFree())
+        {
+            for(; first != last; ++first)
+            {
+                const auto& [timestamp, value] = *first;
+                *handles++ = addEvent(timestamp, value);
+            }
+            return handles;
+        }
+        auto lock = guard();
+        _storage.insert(first, last, [this, &handles](const TimerHandle& handle) {
+            _stats.added();
+            countRejection(handle);
+            *handles++ = handle;
+        });
+        notifyIfEarlier();
+        return handles;
+    }
+
+    /**
+     * @brief Adds a range of events to the queue under a single lock.
+     *
+     * @param first The beginning of the range of (timestamp, value) pairs.
+     * @param last The end of the range.
+     * @return The number of events that were added. With SubmissionMode::LockFree, the number of events submitted, since
+     *         duplicates and a full storage are only detected once the worker applies them.
+     */
+    template<typename InputIt>
+    std::size_t addEvents(InputIt first, InputIt last)
+    {
+        if(lockFree())
+        {
+            auto submitted = std::size_t(0);
+            for(; first != last; ++first)
+            {
+                const auto& [timestamp, value] = *first;
+                submitted += addEvent(timestamp, value).valid() ? 1 : 0;
+            }
+            return submitted;
+        }
+        auto lock = guard();
+        auto added = std::size_t(0);
+        _storage.insert(first, last, [this, &added](const TimerHandle& handle) {
+            _stats.added();
+            countRejection(handle);
+            added += handle.valid() ? 1 : 0;
+        });
+        notifyIfEarlier();
+        return added;
+    }
+
+    /**
+     * @brief Adds all events of a container of (timestamp, value) pairs to the queue under a single lock.
+     *
+     * @param events The container of events, such as a std::vector<std::pair<TIMESTAMP, T>>.
+     * @return The number of events that were added, or with SubmissionMode::LockFree, submitted.
+     */
+    template<typename Range>
+    std::size_t addEvents(const Range& events)
+    {
+        return addEvents(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Removes a range of events from the queue under a single lock.
+     *
+     * The range holds the values, timestamps or handles of the events to
+     * remove, exactly as accepted by removeEvent. Like removeEvent, it does
+     * not notify the worker thread.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     */
+    template<typename InputIt>
+    void removeEvents(InputIt first, InputIt last)
+    {
+        if(lockFree())
+        {
+            for(; first != last; ++first)
+            {
+                removeEvent(*first);
+            }
+            return;
+        }
+        auto lock = guard();
+        for(; first != last; ++first)
+        {
+            _stats.cancelled();
+            _storage.erase(*first);
+        }
+    }
+
+    /**
+     * @brief Removes all events of a container of values, timestamps or handles from the queue under a single lock.
+     *
+     * @param events The container of events to remove.
+     */
+    template<typename Range>
+    void removeEvents(const Range& events)
+    {
+        removeEvents(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Updates the timestamps of a range of events under a single lock.
+     *
+     * The range holds (timestamp, value) or (timestamp, handle) pairs, exactly
+     * as accepted by updateTimestamp. The worker thread is notified at most
+     * once, and only if the earliest deadline of the queue became earlier.
+     *
+     * @param first The beginning of the range.
+     * @param last The end of the range.
+     */
+    template<typename InputIt>
+    void updateTimestamps(InputIt first, InputIt last)
+    {
+        if(lockFree())
+        {
+            for(; first != last; ++first)
+            {
+                const auto& [timestamp, event] = *first;
+                updateTimestamp(timestamp, event);
+            }
+            return;
+        }
+        auto lock = guard();
+        for(; first != last; ++first)
+        {
+            const auto& [timestamp, event] = *first;
+            _stats.rescheduled();
+            _storage.updateTimestamp(timestamp, event);
+        }
+        notifyIfEarlier();
+    }
+
+    /**
+     * @brief Updates the timestamps of all events of a container of (timestamp, value) or (timestamp, handle) pairs under a single lock.
+     *
+     * @param events The container of updates.
+     */
+    template<typename Range>
+    void updateTimestamps(const Range& events)
+    {
+        updateTimestamps(std::begin(events), std::end(events));
+    }
+
+    /**
+     * @brief Removes the event the handle refers to from the queue.
+     *
+     * This function removes the event the handle was returned for, if it is
+     * still pending, without looking it up by value or timestamp. It is
+     * thread-safe and can be called from multiple threads simultaneously.
+     *
+     * @param handle The handle of the event to remove.
+     * @return Whether the event was still pending. With SubmissionMode::LockFree, whether the removal was submitted for a handle that was not known to be stale.
+     */
+    bool removeEvent(const TimerHandle& handle)
+    {
+        if(lockFree())
+        {
+            if(!ticketInUse(handle))
+            {
+                return false;
+            }
+            _stats.cancelled();
+            submit(TIMESTAMP(), std::nullopt, [](BasicTimedEventQueue& queue, Command& command) { queue.eraseTicket(command.handle); }, false, handle);
+            return true;
+        }
+        _stats.cancelled();
+        auto lock = guard();
+        return _storage.erase(handle);
+    }
+
+    /**
+     * @brief Removes the event with the specified value from the queue.
+     *
+     * This function removes the event with the specified value from the queue,
+     * if it exists. It is thread-safe and can be called from multiple threads
+     * simultaneously. Removing an event cannot make the earliest deadline
+     * earlier, so the worker thread is not notified.
+     *
+     * @param value The value of the event to remove.
+     */
+    void removeEvent(const T& value)
+    {
+        _stats.cancelled();
+        if(lockFree())
+        {
+            submit(TIMESTAMP(), value, [](BasicTimedEventQueue& queue, Command& command) { queue._storage.erase(*command.value); }, false);
+            return;
+        }
+        auto lock = guard();
+        _storage.erase(value);
+    }
+
+    /**
+     * @brief Removes the event whose value is equal to @p key, without constructing a T to look it up.
+     *
+     * This overload takes part when the value index of the storage is
+     * transparent, for example a HashValueIndex whose hash and equality accept
+     * std::string_view keys for std::string values. With
+     * SubmissionMode::LockFree the key is converted to a T for the command.
+     *
+     * @param key A key equal to the value of the event to remove.
+     */
+    template<typename K, typename = std::enable_if_t<Storage::template LOOKUP_KEY<K>>>
+    void removeEvent(const K& key)
+    {
+        _stats.cancelled();
+        if(lockFree())
+        {
+            submit(TIMESTAMP(), T(key), [](BasicTimedEventQueue& queue, Command& command) { queue._storage.erase(*command.value); }, false);
+            return;
+        }
+        auto lock = guard();
+        _storage.erase(key);
+    }
+
+    /**
+     * @brief Removes the events with the specified timestamp from the queue.
+     *
+     * This function removes all events with the specified timestamp from the
+     * queue, if any exist. It is thread-safe and can be called from multiple
+     * threads simultaneously. Removing events cannot make the earliest
+     * deadline earlier, so the worker thread is not notified.
+     *
+     * @param timestamp The timestamp of the events to remove.
+     */
+    void removeEvent(const TIMESTAMP& timestamp)
+    {
+        _stats.cancelled();
+        if(lockFree())
+        {
+            submit(timestamp, std::nullopt, [](BasicTimedEventQueue& queue, Command& command) { queue._storage.erase(command.timestamp); }, false);
+            return;
+        }
+        auto lock = guard();
+        _storage.erase(timestamp);
+    }
+
+    /**
+     * @brief Updates the value associated with the specified timestamp in the queue.
+     *
+     * This function updates the value associated with the specified timestamp
+     * in the queue, if it exists. When several events share the timestamp, the
+     * earliest added one is updated. It is thread-safe and can be called from
+     * multiple threads simultaneously. Updating a value does not change any
+     * deadline, so the worker thread is not woken up.
+     *
+     * @param timestamp The timestamp of the event to update.
+     * @param value The new value to associate with the timestamp.
+     */
+    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    {
+        if(lockFree())
+        {
+            submit(timestamp, value, [](BasicTimedEventQueue& queue, Command& command) {
+                queue._storage.updateValue(command.timestamp, *command.value);
+            }, false);
+            return;
+        }
+        auto lock = guard();
+        _storage.updateValue(timestamp, value);
+    }
+
+    /**
+     * @brief Removes the earliest added event with the specified timestamp and returns its value and its period.
+     *
+     * The event is looked up and removed under a single lock, so it cannot
+     * expire in between. This lets a caller move an event to another queue,
+     * possibly under a new value, and add it back here if that fails. The
+     * handle of the event becomes stale. With SubmissionMode::LockFree the
+     * outcome is only known once the worker applies a command, so nothing is
+     * removed and nothing is returned.
+     *
+     * @param timestamp The timestamp of the event to remove.
+     * @return The removed event, if one was pending.
+     */
+    std::optional<ExtractedEvent<T>> extractEvent(const TIMESTAMP& timestamp)
+    {
+        if(lockFree())
+        {
+            return std::nullopt;
+        }
+        auto lock  = guard();
+        auto event = _storage.extract(timestamp);
+        if(event)
+        {
+            _stats.cancelled();
+        }
+        return event;
+    }
+
+    /**
+     * @brief Updates the timestamp of the event the handle refers to.
+     *
+     * This function moves the event the handle was returned for to a new
+     * timestamp, if it is still pending, without looking it up by value. The
+     * handle stays valid. It is thread-safe and can be called from multiple
+     * threads simultaneously. After updating the timestamp, the function
+     * notifies the worker thread if the earliest deadline became earlier.
+     *
+     * @param timestamp The new timestamp of the event.
+     * @param handle The handle of the event to update.
+     * @return Whether the event was still pending. With SubmissionMode::LockFree, whether the update was submitted for a handle that was not known to be stale.
+     */
+    bool updateTimestamp(const TIMESTAMP& timestamp, const TimerHandle& handle)
+    {
+        if(lockFree())
+        {
+            if(!ticketInUse(handle))
+            {
+                return false;
+            }
+            _stats.rescheduled();
+            submit(timestamp, std::nullopt, [](BasicTimedEventQueue& queue, Command& command) {
+                queue._storage.updateTimestamp(command.timestamp, queue.resolveTicket(command.handle));
+            }, true, handle);
+            return true;
+        }
+        _stats.rescheduled();
+        auto lock = guard();
+        auto updated = _storage.updateTimestamp(timestamp, handle);
+        notifyIfEarlier();
+        return updated;
+    }
+
+    /**
+     * @brief Updates the timestamp associated with the specified value in the queue.
+     *
+     * This function updates the timestamp associated with the specified value
+     * in the queue, if it exists. It is thread-safe and can be called from
+     * multiple threads simultaneously. After updating the timestamp, the function
+     * notifies the worker thread if the earliest deadline became earlier.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param value The value of the event to update.
+     */
+    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    {
+        _stats.rescheduled();
+        if(lockFree())
+        {
+            submit(timestamp, value, [](BasicTimedEventQueue& queue, Command& command) {
+                queue._storage.updateTimestamp(command.timestamp, *command.value);
+            }, true);
+            return;
+        }
+        auto lock = guard();
+        _storage.updateTimestamp(timestamp, value);
+        notifyIfEarlier();
+    }
+
+    /**
+     * @brief Moves the event whose value is equal to @p key to a new timestamp, without constructing a T to look it up.
+     *
+     * Like removeEvent(const K&), this overload takes part when the value index
+     * of the storage is transparent.
+     *
+     * @param timestamp The new timestamp to associate with the value.
+     * @param key A key equal to the value of the event to update.
+     */
+    template<typename K, typename = std::enable_if_t<Storage::template LOOKUP_KEY<K>>>
+    void updateTimestamp(const TIMESTAMP& timestamp, const K& key)
+    {
+        _stats.rescheduled();
+        if(lockFree())
+        {
+            submit(timestamp, T(key), [](BasicTimedEventQueue& queue, Command& command) {
+                queue._storage.updateTimestamp(command.timestamp, *command.value);
+            }, true);
+            return;
+        }
+        auto lock = guard();
+        _storage.updateTimestamp(timestamp, key);
+        notifyIfEarlier();
+    }
+
+    /**
+     * @brief Writes all pending events to @p out as a compact binary snapshot, in timestamp order.
+     *
+     * The format is described by SnapshotHeader. Deadlines are stored relative
+     * to the current time of the clock of the queue, since the epoch of a
+     * steady clock does not survive a reboot. Periodic events keep their
+     * interval and recurrence. The queue mutex is held while the events are
+     * written. With SubmissionMode::LockFree, it must only be called from the
+     * thread driving the queue, or after stop(), and does not include the
+     * commands submitted since they were last applied.
+     *
+     * @param out The stream to write to, opened in binary mode.
+     * @param serialize A callable invoked as serialize(value, bytes), appending the serialized value to the std::string bytes,
+     *                  for example a TrivialSerializer<T>.
+     * @return The number of events written.
+     * @throws std::runtime_error If writing to the stream fails.
+     */
+    template<typename Serializer>
+    std::size_t saveSnapshot(std::ostream& out, Serializer&& serialize)
+    {
+        if(lockFree())
+        {
+            return writeSnapshot(out, serialize);
+        }
+        auto lock = guard();
+        return writeSnapshot(out, serialize);
+    }
+
+    /**
+     * @brief Adds the events of a snapshot written by saveSnapshot to the queue.
+     *
+     * Their deadlines are the saved offsets applied to the current time of the
+     * clock of the queue. Since the snapshot is sorted, every event is
+     * inserted at the end of the timestamp order of the storage, so loading
+     * into an empty queue takes linear time. The events are added under a
+     * single lock, and the worker thread is notified at most once. Events read
+     * before an error stay in the queue.
+     *
+     * @param in The stream to read from, opened in binary mode.
+     * @param deserialize A callable invoked as deserialize(bytes) with a std::string_view of a serialized value, returning the T.
+     * @param countDowntime Whether the std::chrono::system_clock time that passed since the snapshot was saved is subtracted
+     *                      from the deadlines, so that the events keep their wall clock time across a restart.
+     * @return The number of events added, or with SubmissionMode::LockFree, the number of events submitted.
+     * @throws std::runtime_error If the stream does not hold a valid snapshot or is truncated.
+     */
+    template<typename Deserializer>
+    std::size_t loadSnapshot(std::istream& in, Deserializer&& deserialize, bool countDowntime = false)
+    {
+        auto loaded = std::size_t(0);
+        if(lockFree())
+        {
+            readSnapshot(in, deserialize, countDowntime, [this, &loaded](const TIMESTAMP& timestamp, T&& value, TIMESTAMP::duration period, Recurrence recurrence) {
+                if(period.count() != 0)
+                {
+                    emplacePeriodic(timestamp, period, recurrence, std::move(value));
+                }
+                else
+                {
+                    emplaceEvent(timestamp, std::move(value));
+                }
+                ++loaded;
+            });
+            return loaded;
+        }
+        auto lock = guard();
+        auto add  = [this, &loaded](const TIMESTAMP& timestamp, T&& value, TIMESTAMP::duration period, Recurrence recurrence) {
+            auto handle = _storage.insert(timestamp, std::move(value));
+            if(period.count() != 0)
             {
-                std::invoke(&TimedEventQueue<T>::onTimestampExpire, this, _ts2Val.begin()->first, _ts2Val.begin()->second);
-                _val2Ts.erase(_ts2Val.begin()->second);
-                _ts2Val.erase(_ts2Val.begin());
+                _storage.setPeriod(handle, period, recurrence);
             }
+            _stats.added();
+            countRejection(handle);
+            loaded += handle.valid() ? 1 : 0;
+        };
+        try
+        {
+            readSnapshot(in, deserialize, countDowntime, add);
         }
+        catch(...)
+        {
+            // The events read so far stay, so the worker has to learn about them.
+            notifyIfEarlier();
+            throw;
+        }
+        notifyIfEarlier();
+        return loaded;
     }
 
-protected:
     /**
-     * @brief A pure virtual function that must be implemented by the user, called when an event's timestamp expires.
+     * @brief Returns the number of pending events.
      *
-     * This function is called by the worker thread when an event's timestamp expires. Users
-     * should override this function to define custom behavior when an event
-     * expires, such as performing a specific action or updating a data
-     * structure. The function is provided with the expired timestamp and its
-     * associated value.
+     * It reads a counter the queue publishes after every modification and
+     * drain, so it never takes the mutex and can be polled from any thread.
+     * With SubmissionMode::LockFree, it does not include the commands
+     * submitted since they were last applied.
+     */
+    std::size_t size() const { return _publishedSize.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns whether the event the handle refers to is still pending.
      *
-     * @param timestamp The expired timestamp.
-     * @param value The value associated with the expired timestamp.
+     * Like timeUntil, it reads the timestamp the storage published for the
+     * handle without taking the mutex, so it neither waits for nor delays the
+     * worker; with a storage that does not publish its timestamps, it looks
+     * the event up like contains(value). With SubmissionMode::LockFree, it
+     * also reads the storage handle the worker bound to the handle from an
+     * atomic, so it can be called from any thread, but only finds an event
+     * once the worker has applied the command that added it.
+     *
+     * @param handle The handle of the event.
+     * @throws std::logic_error If not called from the thread driving the queue with SubmissionMode::LockFree and a
+     *                          storage that does not publish its timestamps.
      */
-    virtual void onTimestampExpire(const TIMESTAMP& timestamp, const T& value) = 0;
+    bool contains(const TimerHandle& handle) { return lookup(handle).has_value(); }
 
-public:
     /**
-     * @brief Constructs a new TimedEventQueue object, initializing the worker thread and adding a dummy event.
+     * @brief Returns whether an event with the specified value is pending.
      *
-     * The constructor creates a new TimedEventQueue object, initializing the
-     * worker thread that manages event expiration. It also adds a dummy event
-     * with a timestamp 100 years in the future to ensure that the worker
-     * thread always has an event to wait for.
+     * While the worker calls a callback with ExpirationMode::Locked, it reads
+     * the storage without the mutex, so it can also be called from the
+     * callback. Otherwise it takes the mutex, shared if the Mutex is a
+     * std::shared_mutex, only once it is free, and keeps trying to find it or
+     * the callback window free for a while before it blocks on it. With
+     * SubmissionMode::LockFree, the worker owns the storage, so it must be
+     * called from the thread driving the queue: the worker thread, from a
+     * callback, or the thread calling processExpired.
+     *
+     * @param value The value of the event, or a key such as a std::string_view with a transparent value index.
+     * @throws std::logic_error If not called from the thread driving the queue with SubmissionMode::LockFree.
      */
-    TimedEventQueue()
+    bool contains(const T& value) { return lookup(value).has_value(); }
+
+    template<typename K, typename = std::enable_if_t<Storage::template LOOKUP_KEY<K>>>
+    bool contains(const K& key)
     {
-        auto dummy_timestamp = CENTENNIAL;
-        addEvent(dummy_timestamp, T());
-        _thread = std::thread(&TimedEventQueue::run, this);
+        return lookup(key).has_value();
     }
 
     /**
-     * @brief Destructs the TimedEventQueue object, stopping the worker thread and releasing resources.
+     * @brief Returns how long until the event the handle refers to expires, negative if it is overdue, or std::nullopt if it is no longer pending.
      *
-     * The destructor ensures that the worker thread is stopped and joined
-     * before the object is destroyed, preventing potential issues with
-     * accessing dangling resources. This is done by setting the _exit flag,
-     * notifying the worker thread via the condition variable, and joining the
-     * thread.
+     * The duration is measured from now() to the timestamp of the event, or
+     * of the next occurrence of a periodic event. It looks the event up like
+     * contains(handle), and can be called from any thread like it.
+     *
+     * @param handle The handle of the event.
+     * @throws std::logic_error If not called from the thread driving the queue with SubmissionMode::LockFree and a
+     *                          storage that does not publish its timestamps.
      */
-    virtual ~TimedEventQueue() { stop(); }
+    std::optional<TIMESTAMP::duration> timeUntil(const TimerHandle& handle) { return remaining(lookup(handle)); }
 
-    TimedEventQueue(const TimedEventQueue&) = delete;
+    /**
+     * @brief Returns how long until the event with the specified value expires, negative if it is overdue, or std::nullopt if there is none.
+     *
+     * It looks the event up like contains(value).
+     *
+     * @param value The value of the event, or a key such as a std::string_view with a transparent value index.
+     * @throws std::logic_error If not called from the thread driving the queue with SubmissionMode::LockFree.
+     */
+    std::optional<TIMESTAMP::duration> timeUntil(const T& value) { return remaining(lookup(value)); }
 
-    TimedEventQueue& operator=(const TimedEventQueue&) = delete;
+    template<typename K, typename = std::enable_if_t<Storage::template LOOKUP_KEY<K>>>
+    std::optional<TIMESTAMP::duration> timeUntil(const K& key)
+    {
+        return remaining(lookup(key));
+    }
 
     /**
-     * @brief Adds an event with the specified timestamp and value to the queue.
-     *
-     * This function inserts a new event into the queue with the specified
-     * timestamp and associated value. It is thread-safe and can be called from
-     * multiple threads simultaneously. After adding the event, the function
-     * notifies the worker thread to ensure that it is aware of the new event.
+     * @brief Returns a snapshot of the statistics of the queue, which can be taken at any time without stopping the worker.
      *
-     * @param timestamp The timestamp of the event.
-     * @param value The value associated with the event.
+     * Only available with the QueueStats policy.
      */
-    void addEvent(const TIMESTAMP& timestamp, const T& value)
+    QueueStatsSnapshot stats() const
     {
-        std::scoped_lock lock(_mutex);
-        _ts2Val.emplace(timestamp, value);
-        _val2Ts.emplace(value, timestamp);
-        _cv.notify_one();
+        static_assert(Stats::ENABLED, "stats() requires a statistics policy such as QueueStats");
+        return _stats.snapshot();
     }
 
     /**
-     * @brief Removes the event with the specified value from the queue.
+     * @brief Returns how many additions and reschedules did not wake the worker thread because they did not make the next expiration earlier.
      *
-     * This function removes the event with the specified value from the queue,
-     * if it exists. It is thread-safe and can be called from multiple threads
-     * simultaneously. After removing the event, the function notifies the
-     * worker thread to ensure that it is aware of the change.
+     * Removals and value updates never change the next expiration to an
+     * earlier one, so they are not counted.
+     */
+    std::uint64_t avoidedWakeups() const { return _avoidedWakeups.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many events were not added because the storage was at its capacity.
+     */
+    std::uint64_t capacityRejections() const { return _capacityRejections.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many times the worker thread woke up to expire events.
+     */
+    std::uint64_t wakeups() const { return _wakeups.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many expired events were delivered to the callback, without the stale events dropped or collapsed.
+     */
+    std::uint64_t expiredEvents() const { return _expiredEvents.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many drains maxExpirationsPerDrain stopped while events were still due.
+     */
+    std::uint64_t truncatedDrains() const { return _truncatedDrains.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many stale events were delivered with StalePolicy::DeliverLate.
+     */
+    std::uint64_t lateEvents() const { return _lateEvents.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many stale events were discarded with StalePolicy::Drop.
+     */
+    std::uint64_t droppedEvents() const { return _droppedEvents.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns how many stale events were discarded with StalePolicy::Collapse.
+     */
+    std::uint64_t collapsedEvents() const { return _collapsedEvents.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the average number of events delivered per wakeup of the worker thread, which the slack option raises.
+     */
+    double averageBatchSize() const
+    {
+        auto wakeups = _wakeups.load(std::memory_order_relaxed);
+        return wakeups == 0 ? 0.0 : static_cast<double>(_expiredEvents.load(std::memory_order_relaxed)) / static_cast<double>(wakeups);
+    }
+
+    /**
+     * @brief Returns the timerfd of the queue with WaitBackend::TimerFd, or -1 without one.
      *
-     * @param value The value of the event to remove.
+     * With externalDriver set, the fd becomes readable when the earliest
+     * deadline has passed, or when a command submitted with
+     * SubmissionMode::LockFree is due earlier, and the reactor watching it
+     * calls poll(). The fd must only be read by poll().
      */
-    void removeEvent(const T& value)
+    int fd() const
     {
-        std::scoped_lock lock(_mutex);
-        if(auto itr = _val2Ts.find(value); itr != _val2Ts.end())
+#if defined(__linux__)
+        if(_timer)
         {
-            _ts2Val.erase(itr->second);
-            _val2Ts.erase(itr);
+            return _timer->fd();
         }
+#endif
+        return -1;
     }
 
     /**
-     * @brief Removes the event with the specified timestamp from the queue.
+     * @brief Expires and dispatches the events due at the specified time point, the step the worker thread does after every wait.
      *
-     * This function removes the event with the specified timestamp from the
-     * queue, if it exists. It is thread-safe and can be called from multiple
-     * threads simultaneously. After removing the event, the function notifies
-     * the worker thread to ensure that it is aware of the change.
+     * Only meant for queues with externalDriver set, and must be called from
+     * one thread at a time. The callback is called on the calling thread, or
+     * on the DispatchPool, exactly as the worker would call it. Afterwards the
+     * timerfd is armed with the new earliest deadline.
      *
-     * @param timestamp The timestamp of the event to remove.
+     * @param now The time point up to which events expire.
+     * @return The number of expired events delivered to the callback.
      */
-    void removeEvent(const TIMESTAMP& timestamp)
+    std::size_t processExpired(const TIMESTAMP& now)
     {
-        std::scoped_lock lock(_mutex);
-        if(auto itr = _ts2Val.find(timestamp); itr != _ts2Val.end())
+        if(lockFree())
+        {
+            auto expired = processDueLockFree(now);
+            armWakeup(nextWakeup());
+            if(!_submissions.empty())
+            {
+                wake();
+            }
+            return expired;
+        }
+        if(_options.singleThreaded)
         {
-            _val2Ts.erase(itr->second);
-            _ts2Val.erase(itr);
+            NoLock lock;
+            auto   expired = processDue(lock, now);
+            armWakeup(nextWakeup());
+            return expired;
         }
+        std::unique_lock lock(_mutex);
+        auto             expired = processDue(lock, now);
+        armWakeup(nextWakeup());
+        return expired;
     }
 
     /**
-     * @brief Updates the value associated with the specified timestamp in the queue.
+     * @brief Returns the time point at which processExpired should be called next: the earliest deadline, later by the slack.
      *
-     * This function updates the value associated with the specified timestamp
-     * in the queue, if it exists. It is thread-safe and can be called from
-     * multiple threads simultaneously. After updating the value, the function
-     * notifies the worker thread to ensure that it is aware of the change.
+     * Meant for queues with externalDriver set that are not watched through
+     * fd(), and for polling the head deadline from any thread: like size(),
+     * it reads a time point published after every modification and never
+     * takes the mutex. It is TIMESTAMP::max() while the queue has no events.
+     * With SubmissionMode::LockFree, it does not include the commands
+     * submitted since the last processExpired.
+     */
+    TIMESTAMP nextDeadline() const { return _publishedWakeup.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the current time of the queue: the virtual time with simulatedTime, otherwise the time of the clock.
      *
-     * @param timestamp The timestamp of the event to update.
-     * @param value The new value to associate with the timestamp.
+     * addEventAfter measures its delay from this time point, so a replay can
+     * schedule relative to the virtual time.
      */
-    void updateValue(const TIMESTAMP& timestamp, const T& value)
+    TIMESTAMP now() const { return currentTime(); }
+
+    /**
+     * @brief Keeps the virtual time of a simulated queue from advancing until the matching releaseTime call.
+     *
+     * A producer holds time while it adds the events of one instant, so the
+     * worker does not jump past events it has yet to add. Events due at the
+     * current virtual time still expire. Holds nest and may be taken by any
+     * number of threads; time advances once all of them are released.
+     */
+    void holdTime()
     {
         std::scoped_lock lock(_mutex);
-        if(auto itr = _ts2Val.find(timestamp); _ts2Val.end() != itr)
+        ++_timeHolds;
+    }
+
+    /**
+     * @brief Releases a hold taken with holdTime, letting the virtual time advance once no hold is left.
+     */
+    void releaseTime()
+    {
         {
-            auto nodeHandler  = _val2Ts.extract(itr->second);
-            nodeHandler.key() = value;
-            _val2Ts.insert(std::move(nodeHandler));
-            itr->second = value;
+            std::scoped_lock lock(_mutex);
+            if(_timeHolds == 0 || --_timeHolds != 0)
+            {
+                return;
+            }
         }
         _cv.notify_one();
     }
 
     /**
-     * @brief Updates the timestamp associated with the specified value in the queue.
+     * @brief Blocks until the worker of a simulated queue has nothing left to do, or until it is stopped.
      *
-     * This function updates the timestamp associated with the specified value
-     * in the queue, if it exists. It is thread-safe and can be called from
-     * multiple threads simultaneously. After updating the timestamp, the function
-     * notifies the worker thread to ensure that it is aware of the change.
+     * That is the case once every event has expired, or while time is held
+     * and no event is due at the current virtual time. The callbacks of the
+     * expired events have returned by then.
+     */
+    void waitUntilIdle()
+    {
+        std::unique_lock lock(_mutex);
+        _idleCv.wait(lock, [this] {
+            return _exit.load() || (_simulationIdle && (_storage.empty() || (_timeHolds != 0 && _storage.nextDeadline() > _simulatedNow.load())));
+        });
+    }
+
+    /**
+     * @brief Consumes the expiration of the timerfd, if any, and processes the events that are due at the current time of the clock.
      *
-     * @param timestamp The new timestamp to associate with the value.
-     * @param value The value of the event to update.
+     * @return The number of expired events delivered to the callback.
      */
-    void updateTimestamp(const TIMESTAMP& timestamp, const T& value)
+    std::size_t poll()
     {
-        std::scoped_lock lock(_mutex);
-        if(auto itr = _val2Ts.find(value); _val2Ts.end() != itr)
+        auto passed = TIMESTAMP::min();
+#if defined(__linux__)
+        if(_timer && _timer->clear())
         {
-            auto nodeHandler  = _ts2Val.extract(itr->second);
-            nodeHandler.key() = timestamp;
-            _ts2Val.insert(std::move(nodeHandler));
-            itr->second = timestamp;
+            passed = _wakeup.load();
         }
-        _cv.notify_one();
+#endif
+        return processExpired(std::max(Clock::now(), passed));
     }
 
     /**
@@ -248,7 +5578,7 @@ public:
      *
      * This function stops the worker thread by setting the _exit flag, notifying
      * the worker thread via the condition variable, and joining the thread. It
-     * should be called before the TimedEventQueue object is destroyed to ensure
+     * should be called before the BasicTimedEventQueue object is destroyed to ensure
      * that resources are properly cleaned up and no dangling references to the
      * object are accessed by the worker thread.
      */
@@ -256,9 +5586,292 @@ public:
     {
         if(_thread.joinable())
         {
-            _exit.store(true);
+            {
+                std::scoped_lock lock(_mutex);
+                _exit.store(true);
+            }
             _cv.notify_one();
+#if defined(__linux__)
+            if(_timer)
+            {
+                _timer->wakeNow();
+            }
+#endif
             _thread.join();
         }
+        if(_pool)
+        {
+            _pool->stop();
+        }
+    }
+};
+
+template<typename T, typename Storage = OrderedMapStorage<T>, typename Clock = TIME, typename Stats = NullQueueStats, typename Mutex = std::mutex>
+class TimedEventQueue;
+
+/**
+ * @struct VirtualExpireCallback
+ * @brief The callback of TimedEventQueue, forwarding to its virtual members.
+ */
+template<typename T, typename Storage, typename Clock, typename Stats, typename Mutex>
+struct VirtualExpireCallback
+{
+    TimedEventQueue<T, Storage, Clock, Stats, Mutex>* queue; ///< The queue whose virtual members are called.
+
+    void operator()(const TIMESTAMP& timestamp, T&& value) const { queue->onTimestampExpireOwned(timestamp, std::move(value)); }
+
+    std::size_t dispatchKey(const TIMESTAMP& timestamp, const T& value) const { return queue->dispatchKey(timestamp, value); }
+};
+
+/**
+ * @class TimedEventQueue
+ * @tparam T The type of value to be associated with each event in the queue.
+ * @tparam Storage The storage policy keeping the events, OrderedMapStorage<T> by default.
+ * @tparam Clock The clock the worker reads to expire events, TIME by default.
+ * @tparam Stats The statistics policy, NullQueueStats by default.
+ * @tparam Mutex The mutex serializing the queue, std::mutex by default.
+ *
+ * @brief A BasicTimedEventQueue whose callback is the pure virtual onTimestampExpire member.
+ *
+ * Users derive from this class and override onTimestampExpire. Every
+ * expiration costs one virtual call; BasicTimedEventQueue avoids it with a
+ * compile-time callback.
+ */
+template<typename T, typename Storage, typename Clock, typename Stats, typename Mutex>
+class TimedEventQueue : public BasicTimedEventQueue<T, VirtualExpireCallback<T, Storage, Clock, Stats, Mutex>, Storage, Clock, Stats, Mutex>
+{
+private:
+    using Base = BasicTimedEventQueue<T, VirtualExpireCallback<T, Storage, Clock, Stats, Mutex>, Storage, Clock, Stats, Mutex>;
+
+    friend struct VirtualExpireCallback<T, Storage, Clock, Stats, Mutex>;
+
+protected:
+    /**
+     * @brief A pure virtual function that must be implemented by the user, called when an event's timestamp expires.
+     *
+     * This function is called by the worker thread when an event's timestamp expires. Users
+     * should override this function to define custom behavior when an event
+     * expires, such as performing a specific action or updating a data
+     * structure. The function is provided with the expired timestamp and its
+     * associated value. Whether the queue mutex is held during the call is
+     * selected by the ExpirationMode of the queue. With dispatchThreads set,
+     * it is called on a thread of the DispatchPool without the mutex held, as
+     * with ExpirationMode::Unlocked, and concurrently as far as the
+     * DispatchOrdering allows.
+     *
+     * @param timestamp The expired timestamp.
+     * @param value The value associated with the expired timestamp.
+     */
+    virtual void onTimestampExpire(const TIMESTAMP& timestamp, const T& value) = 0;
+
+    /**
+     * @brief Called instead of onTimestampExpire with ownership of the expired value, which has already left the queue.
+     *
+     * Overriding it lets the expiration take the value by move rather than
+     * copying it out of a const reference. The default calls
+     * onTimestampExpire.
+     *
+     * @param timestamp The expired timestamp.
+     * @param value The value associated with the expired timestamp.
+     */
+    virtual void onTimestampExpireOwned(const TIMESTAMP& timestamp, T&& value) { onTimestampExpire(timestamp, value); }
+
+    /**
+     * @brief Returns the key of an expired event for DispatchOrdering::PerKey, called by the worker thread.
+     *
+     * Events with equal keys are dispatched in expiration order. The default
+     * is defaultDispatchKey(value).
+     *
+     * @param timestamp The expired timestamp.
+     * @param value The value associated with the expired timestamp.
+     */
+    virtual std::size_t dispatchKey(const TIMESTAMP& timestamp, const T& value) const
+    {
+        (void)timestamp;
+        return defaultDispatchKey(value);
+    }
+
+public:
+    /**
+     * @brief Constructs a new TimedEventQueue object, initializing the worker thread.
+     *
+     * @param options The options of the queue, such as its expiration mode.
+     * @param storage The storage policy instance, for example a TimingWheelStorage with a custom tick resolution.
+     */
+    explicit TimedEventQueue(const TimedEventQueueOptions& options = TimedEventQueueOptions(), Storage storage = Storage())
+        : Base(VirtualExpireCallback<T, Storage, Clock, Stats, Mutex>{this}, options, std::move(storage))
+    {
+    }
+
+    /**
+     * @brief Constructs a new TimedEventQueue object with the specified storage policy instance.
+     *
+     * @param storage The storage policy instance, for example a TimingWheelStorage with a custom tick resolution.
+     * @param options The options of the queue, such as its expiration mode.
+     */
+    explicit TimedEventQueue(Storage storage, const TimedEventQueueOptions& options = TimedEventQueueOptions())
+        : TimedEventQueue(options, std::move(storage))
+    {
+    }
+
+    /**
+     * @brief Destructs the TimedEventQueue object, stopping the worker thread if it is still running.
+     *
+     * When this destructor runs, the subclass part of the object, and with it
+     * the override of onTimestampExpire, is already destroyed, while the
+     * worker may still be expiring events. A subclass therefore has to call
+     * stop() in its own destructor; stopping here only covers subclasses
+     * whose events can no longer expire.
+     */
+    virtual ~TimedEventQueue() { this->stop(); }
+};
+
+/**
+ * @class InlineFunction
+ * @tparam Signature The function type R(Args...) the callable is invoked with.
+ * @tparam Capacity The size of the inline buffer in bytes, 48 by default so that an InlineFunction fills a cache line.
+ *
+ * @brief A move-only callable wrapper that stores its target inline and never allocates.
+ *
+ * Unlike std::function, a target that does not fit into the buffer, is
+ * over-aligned or may throw when moved is rejected at compile time instead of
+ * being allocated on the heap, so a lambda with a few captures is scheduled
+ * without any allocation. Move-only targets, such as lambdas capturing a
+ * std::unique_ptr, are supported. Invoking an empty InlineFunction is undefined.
+ */
+template<typename Signature, std::size_t Capacity = 48>
+class InlineFunction;
+
+template<typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R(Args...), Capacity>
+{
+private:
+    using Invoke   = R (*)(void* target, Args&&... args);
+    using Relocate = void (*)(void* from, void* to) noexcept;
+
+    alignas(std::max_align_t) unsigned char _buffer[Capacity]; ///< The storage of the target.
+    Invoke                                  _invoke   = nullptr; ///< Invokes the target, or nullptr while empty.
+    Relocate                                _relocate = nullptr; ///< Moves the target to another buffer and destroys it, or only destroys it when the other buffer is nullptr.
+
+    template<typename F>
+    static R invokeTarget(void* target, Args&&... args)
+    {
+        return std::invoke(*std::launder(static_cast<F*>(target)), std::forward<Args>(args)...);
+    }
+
+    template<typename F>
+    static void relocateTarget(void* from, void* to) noexcept
+    {
+        auto* target = std::launder(static_cast<F*>(from));
+        if(to != nullptr)
+        {
+            ::new(to) F(std::move(*target));
+        }
+        target->~F();
+    }
+
+    void take(InlineFunction& other) noexcept
+    {
+        if(other._relocate != nullptr)
+        {
+            other._relocate(other._buffer, _buffer);
+        }
+        _invoke   = std::exchange(other._invoke, nullptr);
+        _relocate = std::exchange(other._relocate, nullptr);
+    }
+
+public:
+    InlineFunction() noexcept = default;
+
+    InlineFunction(std::nullptr_t) noexcept {}
+
+    /**
+     * @brief Stores a copy of the callable, or the callable itself when it is an rvalue.
+     *
+     * @param target The callable, invocable with Args... and returning a type convertible to R.
+     */
+    template<typename F, typename Target = std::decay_t<F>,
+             typename = std::enable_if_t<!std::is_same_v<Target, InlineFunction> && std::is_invocable_r_v<R, Target&, Args...>>>
+    InlineFunction(F&& target)
+    {
+        static_assert(sizeof(Target) <= Capacity, "InlineFunction: the callable does not fit into the buffer, increase the Capacity");
+        static_assert(alignof(Target) <= alignof(std::max_align_t), "InlineFunction: the callable is over-aligned");
+        static_assert(std::is_nothrow_move_constructible_v<Target>, "InlineFunction: the callable must be nothrow move constructible");
+        ::new(static_cast<void*>(_buffer)) Target(std::forward<F>(target));
+        _invoke   = &invokeTarget<Target>;
+        _relocate = &relocateTarget<Target>;
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept { take(other); }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept
+    {
+        if(this != &other)
+        {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() { reset(); }
+
+    /**
+     * @brief Destroys the target, leaving the InlineFunction empty.
+     */
+    void reset() noexcept
+    {
+        if(_relocate != nullptr)
+        {
+            _relocate(_buffer, nullptr);
+        }
+        _invoke   = nullptr;
+        _relocate = nullptr;
+    }
+
+    explicit operator bool() const noexcept { return _invoke != nullptr; }
+
+    R operator()(Args... args) { return _invoke(_buffer, std::forward<Args>(args)...); }
+};
+
+/**
+ * @brief The per-event action of an ActionTimedEventQueue, called with the expired timestamp.
+ */
+template<std::size_t Capacity = 48>
+using EventAction = InlineFunction<void(const TIMESTAMP&), Capacity>;
+
+/**
+ * @struct InvokeEventAction
+ * @brief The callback of an ActionTimedEventQueue, calling the action of every expired event with its timestamp.
+ */
+struct InvokeEventAction
+{
+    template<typename Action>
+    void operator()(const TIMESTAMP& timestamp, Action&& action) const
+    {
+        action(timestamp);
     }
 };
+
+/**
+ * @brief A BasicTimedEventQueue whose events carry their own action instead of a value handled by one callback.
+ *
+ * Events are added with addEvent(timestamp, lambda) or emplaceEvent, and the
+ * lambda is stored inline in the event, so scheduling it does not allocate
+ * beyond the storage of the event. The actions have no identity, so the
+ * default storage is a HeapStorage without a value index, and events are
+ * removed and rescheduled by their TimerHandle.
+ *
+ * @tparam Action The action type, EventAction<> by default. A larger EventAction<Capacity> admits larger captures.
+ * @tparam Storage The storage policy keeping the events.
+ * @tparam Clock The clock the worker reads to expire events, TIME by default.
+ * @tparam Stats The statistics policy, NullQueueStats by default.
+ * @tparam Mutex The mutex serializing the queue, std::mutex by default.
+ */
+template<typename Action = EventAction<>, typename Storage = HeapStorage<Action, NoValueIndex>, typename Clock = TIME, typename Stats = NullQueueStats,
+         typename Mutex = std::mutex>
+using ActionTimedEventQueue = BasicTimedEventQueue<Action, InvokeEventAction, Storage, Clock, Stats, Mutex>;
@@ -0,0 +1,366 @@
+#include "TimedEventQueue.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using Value = std::uint64_t;
+
+using MapStorage      = OrderedMapStorage<Value>;
+using HashMapStorage  = OrderedMapStorage<Value, HashValueIndex<std::hash<Value>>>;
+using WheelStorage    = TimingWheelStorage<Value>;
+using FlatHeapStorage = HeapStorage<Value>;
+
+constexpr std::size_t BATCH = 1024; ///< The number of events added or removed per iteration of the throughput benchmarks.
+
+/**
+ * @brief The callback of the throughput benchmarks, whose events never expire.
+ */
+struct Discard
+{
+    void operator()(const TIMESTAMP&, Value&&) const {}
+};
+
+/**
+ * @brief The callback of the drain benchmarks, counting the dispatched events.
+ */
+struct Count
+{
+    std::atomic<std::size_t>* dispatched;
+
+    void operator()(const TIMESTAMP&, Value&&) const { dispatched->fetch_add(1, std::memory_order_relaxed); }
+};
+
+/**
+ * @brief The callback of the latency benchmarks, recording how late the event fired.
+ */
+struct Probe
+{
+    struct State
+    {
+        std::atomic<bool>        fired = false;
+        std::chrono::nanoseconds lateness{0};
+    };
+
+    State* state;
+
+    void operator()(const TIMESTAMP& timestamp, Value&&) const
+    {
+        state->lateness = TIME::now() - timestamp;
+        state->fired.store(true, std::memory_order_release);
+    }
+};
+
+template<typename Callback, typename Storage>
+using Queue = BasicTimedEventQueue<Value, Callback, Storage>;
+
+/**
+ * @brief A named set of queue options, one of the dispatch modes every storage is measured with.
+ */
+struct Mode
+{
+    const char*            name;
+    TimedEventQueueOptions options;
+};
+
+TimedEventQueueOptions makeOptions(ExpirationMode expirationMode, SubmissionMode submissionMode, std::size_t dispatchThreads = 0,
+                                   DispatchOrdering dispatchOrdering = DispatchOrdering::Strict)
+{
+    TimedEventQueueOptions options;
+    options.expirationMode   = expirationMode;
+    options.submissionMode   = submissionMode;
+    options.dispatchThreads  = dispatchThreads;
+    options.dispatchOrdering = dispatchOrdering;
+    return options;
+}
+
+/**
+ * @brief Returns random offsets between one and two hours, far enough for the pending events never to expire during a benchmark.
+ */
+std::vector<std::chrono::nanoseconds> farOffsets(std::size_t count, std::uint64_t seed)
+{
+    std::mt19937_64                             random(seed);
+    std::uniform_int_distribution<std::int64_t> distribution(0, std::chrono::nanoseconds(std::chrono::hours(1)).count());
+    std::vector<std::chrono::nanoseconds>       offsets(count);
+    for(auto& offset : offsets)
+    {
+        offset = std::chrono::hours(1) + std::chrono::nanoseconds(distribution(random));
+    }
+    return offsets;
+}
+
+/**
+ * @brief A queue holding a given number of pending events, kept across the runs of a benchmark since filling it dominates at 10M events.
+ */
+template<typename Storage>
+struct Pending
+{
+    std::size_t                              size = 0;
+    TIMESTAMP                                base;
+    std::unique_ptr<Queue<Discard, Storage>> queue;
+    std::vector<TimerHandle>                 handles;
+    Value                                    next = 0;
+
+    static Pending& get(std::size_t size)
+    {
+        static Pending pending;
+        if(pending.size != size || !pending.queue)
+        {
+            pending.queue.reset();
+            pending.handles = std::vector<TimerHandle>();
+            pending.size    = size;
+            pending.base    = TIME::now();
+            pending.queue   = std::make_unique<Queue<Discard, Storage>>();
+            pending.handles.reserve(size);
+            auto offsets = farOffsets(1 << 16, 1);
+            for(pending.next = 0; pending.next < size; ++pending.next)
+            {
+                pending.handles.push_back(pending.queue->addEvent(pending.base + offsets[pending.next % offsets.size()], pending.next));
+            }
+        }
+        return pending;
+    }
+};
+
+template<typename Storage>
+void addEvents(benchmark::State& state)
+{
+    auto&       pending = Pending<Storage>::get(static_cast<std::size_t>(state.range(0)));
+    auto        offsets = farOffsets(BATCH, 2);
+    TimerHandle handles[BATCH];
+    for(auto _ : state)
+    {
+        for(std::size_t index = 0; index < BATCH; ++index)
+        {
+            handles[index] = pending.queue->addEvent(pending.base + offsets[index], pending.next++);
+        }
+        state.PauseTiming();
+        for(const auto& handle : handles)
+        {
+            pending.queue->removeEvent(handle);
+        }
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * BATCH));
+}
+
+template<typename Storage>
+void removeEvents(benchmark::State& state)
+{
+    auto&       pending = Pending<Storage>::get(static_cast<std::size_t>(state.range(0)));
+    auto        offsets = farOffsets(BATCH, 3);
+    TimerHandle handles[BATCH];
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        for(std::size_t index = 0; index < BATCH; ++index)
+        {
+            handles[index] = pending.queue->addEvent(pending.base + offsets[index], pending.next++);
+        }
+        state.ResumeTiming();
+        for(const auto& handle : handles)
+        {
+            pending.queue->removeEvent(handle);
+        }
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * BATCH));
+}
+
+template<typename Storage>
+void rescheduleEvents(benchmark::State& state)
+{
+    auto& pending = Pending<Storage>::get(static_cast<std::size_t>(state.range(0)));
+    auto  offsets = farOffsets(1 << 16, 4);
+
+    std::mt19937_64            random(5);
+    std::vector<std::uint32_t> targets(offsets.size());
+    for(auto& target : targets)
+    {
+        target = static_cast<std::uint32_t>(random() % pending.handles.size());
+    }
+
+    std::size_t index = 0;
+    for(auto _ : state)
+    {
+        pending.queue->updateTimestamp(pending.base + offsets[index], pending.handles[targets[index]]);
+        index = (index + 1) % offsets.size();
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()));
+}
+
+/**
+ * @brief Every thread adds an event and removes it again by value, all on one queue shared by the threads.
+ */
+template<typename Storage>
+void contention(benchmark::State& state, TimedEventQueueOptions options)
+{
+    static std::unique_ptr<Queue<Discard, Storage>> queue;
+    static TIMESTAMP                                base;
+    if(state.thread_index() == 0)
+    {
+        queue = std::make_unique<Queue<Discard, Storage>>(Discard(), options);
+        base  = TIME::now();
+    }
+    auto        offsets = farOffsets(1 << 12, 6 + static_cast<std::uint64_t>(state.thread_index()));
+    Value       value   = static_cast<Value>(state.thread_index()) << 48;
+    std::size_t index   = 0;
+    for(auto _ : state)
+    {
+        queue->addEvent(base + offsets[index], value);
+        queue->removeEvent(value);
+        index = (index + 1) % offsets.size();
+        ++value;
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * 2));
+    if(state.thread_index() == 0)
+    {
+        queue.reset();
+    }
+}
+
+/**
+ * @brief Expires batches of due events through processExpired and waits until all of them have been dispatched.
+ */
+template<typename Storage>
+void drain(benchmark::State& state, TimedEventQueueOptions options)
+{
+    options.externalDriver = true;
+    std::atomic<std::size_t> dispatched = 0;
+    Queue<Count, Storage>    queue(Count{&dispatched}, options);
+
+    auto events   = static_cast<std::size_t>(state.range(0));
+    auto now      = TIME::now();
+    auto expected = std::size_t(0);
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        for(std::size_t index = 0; index < events; ++index)
+        {
+            queue.addEvent(now + std::chrono::nanoseconds(index), index);
+        }
+        // A timing wheel fires events up to one tick late, so the drain runs one default tick past the last event.
+        now += std::chrono::nanoseconds(events) + std::chrono::milliseconds(1);
+        expected += events;
+        state.ResumeTiming();
+
+        queue.processExpired(now);
+        while(dispatched.load(std::memory_order_relaxed) < expected)
+        {
+            std::this_thread::yield();
+        }
+        now += std::chrono::nanoseconds(1);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations()) * static_cast<std::int64_t>(events));
+}
+
+/**
+ * @brief Schedules one event at a time shortly ahead and reports the percentiles of how late the worker fired it.
+ */
+template<typename Storage>
+void wakeupLatency(benchmark::State& state, TimedEventQueueOptions options)
+{
+    Probe::State          probe;
+    Queue<Probe, Storage> queue(Probe{&probe}, options);
+
+    std::vector<double> lateness;
+    lateness.reserve(static_cast<std::size_t>(state.max_iterations));
+    Value value = 0;
+    for(auto _ : state)
+    {
+        probe.fired.store(false, std::memory_order_relaxed);
+        queue.addEvent(TIME::now() + std::chrono::microseconds(200), value++);
+        while(!probe.fired.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        lateness.push_back(std::chrono::duration<double, std::micro>(probe.lateness).count());
+    }
+    std::sort(lateness.begin(), lateness.end());
+    auto percentile = [&lateness](double fraction) { return lateness.empty() ? 0.0 : lateness[static_cast<std::size_t>(fraction * static_cast<double>(lateness.size() - 1))]; };
+    state.counters["p50_us"]  = percentile(0.5);
+    state.counters["p99_us"]  = percentile(0.99);
+    state.counters["p999_us"] = percentile(0.999);
+}
+
+/**
+ * @brief Registers every benchmark for one storage policy, in each of the dispatch modes it applies to.
+ */
+template<typename Storage>
+void registerStorage(const std::string& storage)
+{
+    for(auto [name, benchmark] : {std::pair("add", &addEvents<Storage>), std::pair("remove", &removeEvents<Storage>), std::pair("reschedule", &rescheduleEvents<Storage>)})
+    {
+        benchmark::RegisterBenchmark((name + ("/" + storage)).c_str(), benchmark)->Arg(1000)->Arg(1000000)->Arg(10000000);
+    }
+
+    const Mode submissionModes[] = {
+        {"locked", makeOptions(ExpirationMode::Locked, SubmissionMode::Locked)},
+        {"lock_free", makeOptions(ExpirationMode::Locked, SubmissionMode::LockFree)},
+    };
+    for(const auto& mode : submissionModes)
+    {
+        benchmark::RegisterBenchmark(("contention/" + storage + "/" + mode.name).c_str(), contention<Storage>, mode.options)->ThreadRange(1, 64)->UseRealTime();
+    }
+
+    auto singleThreaded           = makeOptions(ExpirationMode::Locked, SubmissionMode::Locked);
+    singleThreaded.singleThreaded = true;
+    const Mode dispatchModes[] = {
+        {"locked", makeOptions(ExpirationMode::Locked, SubmissionMode::Locked)},
+        {"unlocked", makeOptions(ExpirationMode::Unlocked, SubmissionMode::Locked)},
+        {"lock_free", makeOptions(ExpirationMode::Locked, SubmissionMode::LockFree)},
+        {"single_threaded", singleThreaded},
+        {"pool_strict", makeOptions(ExpirationMode::Unlocked, SubmissionMode::Locked, 4, DispatchOrdering::Strict)},
+        {"pool_per_key", makeOptions(ExpirationMode::Unlocked, SubmissionMode::Locked, 4, DispatchOrdering::PerKey)},
+        {"pool_none", makeOptions(ExpirationMode::Unlocked, SubmissionMode::Locked, 4, DispatchOrdering::None)},
+    };
+    for(const auto& mode : dispatchModes)
+    {
+        benchmark::RegisterBenchmark(("drain/" + storage + "/" + mode.name).c_str(), drain<Storage>, mode.options)->Arg(1 << 10)->Arg(1 << 16)->UseRealTime();
+    }
+
+    for(auto backend : {WaitBackend::ConditionVariable, WaitBackend::TimerFd})
+    {
+#if !defined(__linux__)
+        if(backend == WaitBackend::TimerFd)
+        {
+            continue;
+        }
+#endif
+        for(std::size_t dispatchThreads : {0, 1})
+        {
+            auto options        = makeOptions(ExpirationMode::Locked, SubmissionMode::Locked, dispatchThreads);
+            options.waitBackend = backend;
+            auto name           = "wakeup_latency/" + storage + (backend == WaitBackend::TimerFd ? "/timerfd" : "/condition_variable") + (dispatchThreads > 0 ? "/pool" : "/worker");
+            benchmark::RegisterBenchmark(name.c_str(), wakeupLatency<Storage>, options)->Iterations(2000)->UseRealTime();
+        }
+    }
+
+    auto spinning          = makeOptions(ExpirationMode::Locked, SubmissionMode::Locked);
+    spinning.spinThreshold = std::chrono::microseconds(50);
+    benchmark::RegisterBenchmark(("wakeup_latency/" + storage + "/spin/worker").c_str(), wakeupLatency<Storage>, spinning)->Iterations(2000)->UseRealTime();
+}
+
+int main(int argc, char** argv)
+{
+    registerStorage<MapStorage>("ordered_map");
+    registerStorage<HashMapStorage>("ordered_map_hash");
+    registerStorage<WheelStorage>("timing_wheel");
+    registerStorage<FlatHeapStorage>("heap");
+
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
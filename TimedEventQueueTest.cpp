@@ -0,0 +1,1646 @@
+#include "TimedEventQueueTest.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+/**
+ * @brief The callback of the model tests, recording the expired events in order.
+ */
+struct Record
+{
+    std::vector<std::pair<TIMESTAMP, int>>* expired;
+
+    void operator()(const TIMESTAMP& timestamp, int&& value) const { expired->emplace_back(timestamp, value); }
+};
+
+/**
+ * @brief The reference model of a queue: a list of pending events that expire in timestamp order, ties in the order they were scheduled.
+ */
+class Model
+{
+public:
+    struct Event
+    {
+        TIMESTAMP     timestamp;
+        std::uint64_t sequence;
+        int           value;
+        TimerHandle   handle;
+    };
+
+    std::vector<Event> events;       ///< The pending events, unordered.
+    std::uint64_t      sequence = 0; ///< The sequence number of the next scheduled event.
+
+    Event* find(int value)
+    {
+        auto itr = std::find_if(events.begin(), events.end(), [&](const Event& event) { return event.value == value; });
+        return itr != events.end() ? &*itr : nullptr;
+    }
+
+    Event* find(const TimerHandle& handle)
+    {
+        auto itr = std::find_if(events.begin(), events.end(), [&](const Event& event) { return event.handle == handle; });
+        return itr != events.end() ? &*itr : nullptr;
+    }
+
+    /**
+     * @brief Returns the earliest scheduled event with the timestamp, the one updateValue replaces.
+     */
+    Event* first(const TIMESTAMP& timestamp)
+    {
+        Event* first = nullptr;
+        for(auto& event : events)
+        {
+            if(event.timestamp == timestamp && (first == nullptr || event.sequence < first->sequence))
+            {
+                first = &event;
+            }
+        }
+        return first;
+    }
+
+    void erase(const Event* event) { events.erase(events.begin() + (event - events.data())); }
+
+    /**
+     * @brief Removes and returns the events due at @p now, in the order they expire.
+     */
+    std::vector<std::pair<TIMESTAMP, int>> expire(const TIMESTAMP& now)
+    {
+        auto due = std::stable_partition(events.begin(), events.end(), [&](const Event& event) { return event.timestamp > now; });
+        std::vector<Event> expired(due, events.end());
+        events.erase(due, events.end());
+        std::sort(expired.begin(), expired.end(), [](const Event& lhs, const Event& rhs) {
+            return lhs.timestamp < rhs.timestamp || (lhs.timestamp == rhs.timestamp && lhs.sequence < rhs.sequence);
+        });
+        std::vector<std::pair<TIMESTAMP, int>> result;
+        for(const auto& event : expired)
+        {
+            result.emplace_back(event.timestamp, event.value);
+        }
+        return result;
+    }
+};
+
+/**
+ * @brief Runs random operations on a single threaded, externally driven queue and compares every result with the Model.
+ *
+ * The timestamps are whole milliseconds after a base and the queue is driven
+ * to just before the next millisecond, so a TimingWheelStorage with a tick
+ * of one millisecond expires the same events in the same order as the exact
+ * storages. Events are scheduled during the first STEPS milliseconds, with
+ * values drawn from VALUES so that indexed storages see duplicates, and
+ * then the queue is driven until it is empty.
+ *
+ * @tparam Indexed Whether the storage has a value index, making values unique.
+ */
+template<bool Indexed, typename Storage>
+void testModel(Storage storage, std::size_t capacity, std::uint32_t seed)
+{
+    using Queue = BasicTimedEventQueue<int, Record, Storage>;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    options.singleThreaded = true;
+    Queue queue(Record{&expired}, std::move(storage), options);
+
+    constexpr int STEPS  = 800;
+    constexpr int VALUES = 96;
+
+    Model                    model;
+    std::vector<TimerHandle> stale;
+    std::mt19937             generator(seed);
+    auto                     base     = TIME::now() + std::chrono::seconds(1);
+    auto                     rejected = std::uint64_t(0);
+    auto                     failed   = failures;
+    auto                     upcoming = [&](int step) {
+        auto offset = generator() % 10 == 0 ? generator() % 3000 : generator() % 40;
+        return base + std::chrono::milliseconds(step + 1 + offset);
+    };
+    auto pendingHandle = [&]() { return model.events[generator() % model.events.size()].handle; };
+
+    for(auto step = 0; step <= STEPS + 3100; ++step)
+    {
+        for(auto operation = 0; step < STEPS && operation < 4; ++operation)
+        {
+            auto value = static_cast<int>(generator() % VALUES);
+            switch(generator() % 9)
+            {
+            case 0:
+            case 1:
+            case 2:
+            {
+                auto timestamp = model.events.empty() || generator() % 4 != 0 ? upcoming(step) : model.events[generator() % model.events.size()].timestamp;
+                auto duplicate = Indexed && model.find(value) != nullptr;
+                auto full      = model.events.size() >= capacity;
+                auto handle    = queue.addEvent(timestamp, value);
+                CHECK(handle.valid() == (!duplicate && !full));
+                if(handle.valid())
+                {
+                    model.events.push_back({timestamp, model.sequence++, value, handle});
+                }
+                rejected += !duplicate && full;
+                if(duplicate && full)
+                {
+                    rejected = queue.capacityRejections();
+                }
+                CHECK(queue.capacityRejections() == rejected);
+                break;
+            }
+            case 3:
+                if(!model.events.empty())
+                {
+                    auto handle = pendingHandle();
+                    CHECK(queue.removeEvent(handle));
+                    model.erase(model.find(handle));
+                    stale.push_back(handle);
+                }
+                break;
+            case 4:
+                if(!model.events.empty())
+                {
+                    auto handle    = pendingHandle();
+                    auto timestamp = upcoming(step);
+                    CHECK(queue.updateTimestamp(timestamp, handle));
+                    auto* event      = model.find(handle);
+                    event->timestamp = timestamp;
+                    event->sequence  = model.sequence++;
+                }
+                break;
+            case 5:
+                if(!model.events.empty())
+                {
+                    auto timestamp = model.events[generator() % model.events.size()].timestamp;
+                    queue.removeEvent(timestamp);
+                    while(auto* event = model.first(timestamp))
+                    {
+                        stale.push_back(event->handle);
+                        model.erase(event);
+                    }
+                }
+                break;
+            case 6:
+                if(!model.events.empty())
+                {
+                    auto timestamp = model.events[generator() % model.events.size()].timestamp;
+                    queue.updateValue(timestamp, value);
+                    if(!Indexed || model.find(value) == nullptr)
+                    {
+                        model.first(timestamp)->value = value;
+                    }
+                }
+                break;
+            case 7:
+                if constexpr(Indexed)
+                {
+                    auto* event = model.find(value);
+                    if(generator() % 2 == 0)
+                    {
+                        queue.removeEvent(value);
+                        if(event != nullptr)
+                        {
+                            stale.push_back(event->handle);
+                            model.erase(event);
+                        }
+                    }
+                    else
+                    {
+                        auto timestamp = upcoming(step);
+                        queue.updateTimestamp(timestamp, value);
+                        if(event != nullptr)
+                        {
+                            event->timestamp = timestamp;
+                            event->sequence  = model.sequence++;
+                        }
+                    }
+                }
+                break;
+            default:
+                if(!stale.empty())
+                {
+                    auto handle = stale[generator() % stale.size()];
+                    CHECK(!queue.contains(handle));
+                    CHECK(!queue.timeUntil(handle).has_value());
+                    CHECK(!queue.removeEvent(handle));
+                    CHECK(!queue.updateTimestamp(upcoming(step), handle));
+                }
+                break;
+            }
+        }
+
+        auto now = base + std::chrono::milliseconds(step + 1) - std::chrono::nanoseconds(1);
+        expired.clear();
+        auto count    = queue.processExpired(now);
+        auto expected = model.expire(now);
+        CHECK(count == expected.size());
+        CHECK(expired == expected);
+        CHECK(queue.size() == model.events.size());
+        for(const auto& event : model.events)
+        {
+            CHECK(queue.contains(event.handle));
+            if constexpr(Indexed)
+            {
+                CHECK(queue.contains(event.value));
+            }
+        }
+        if(failures != failed)
+        {
+            std::fprintf(stderr, "seed %u, step %d\n", seed, step);
+            return;
+        }
+    }
+    CHECK(queue.size() == 0);
+    CHECK(capacity == SIZE_MAX || rejected != 0);
+}
+
+/**
+ * @brief Runs testModel with a few seeds, on a storage without a capacity and on one that fills up.
+ */
+template<bool Indexed, typename Make>
+void testModels(const char* name, Make make)
+{
+    auto failed = failures;
+    for(std::uint32_t seed = 1; seed <= 4 && failures == failed; ++seed)
+    {
+        testModel<Indexed>(make(StorageMemory()), SIZE_MAX, seed);
+        testModel<Indexed>(make(StorageMemory(16)), 16, seed);
+    }
+    std::printf("model %s: %s\n", name, failures == failed ? "ok" : "failed");
+}
+
+void runModelTests()
+{
+    testModels<true>("ordered_map", [](StorageMemory memory) { return OrderedMapStorage<int>(std::move(memory)); });
+    testModels<true>("ordered_map_hash", [](StorageMemory memory) { return OrderedMapStorage<int, HashValueIndex<std::hash<int>>>(std::move(memory)); });
+    testModels<false>("ordered_map_unindexed", [](StorageMemory memory) { return OrderedMapStorage<int, NoValueIndex>(std::move(memory)); });
+    testModels<true>("heap", [](StorageMemory memory) { return HeapStorage<int>(std::move(memory)); });
+    testModels<true>("binary_heap", [](StorageMemory memory) { return HeapStorage<int, HashValueIndex<std::hash<int>>, 2>(std::move(memory)); });
+    testModels<false>("heap_unindexed", [](StorageMemory memory) { return HeapStorage<int, NoValueIndex>(std::move(memory)); });
+    testModels<true>("timing_wheel", [](StorageMemory memory) { return TimingWheelStorage<int>(std::chrono::milliseconds(1), 4, std::move(memory)); });
+    testModels<false>("timing_wheel_unindexed", [](StorageMemory memory) { return TimingWheelStorage<int, NoValueIndex>(std::chrono::milliseconds(1), 4, std::move(memory)); });
+}
+
+/**
+ * @brief Adds, reschedules and removes ranges of events and checks what the batch members report and what expires.
+ */
+template<SubmissionMode Mode>
+void testBatch()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    options.submissionMode = Mode;
+    BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+
+    auto base  = TIME::now() + std::chrono::seconds(1);
+    auto added = queue.addEvents(std::vector<std::pair<TIMESTAMP, int>>{{base + milliseconds(3), 1}, {base + milliseconds(1), 2}, {base + milliseconds(2), 3}, {base + milliseconds(1), 2}});
+    CHECK(added == (Mode == SubmissionMode::LockFree ? 4 : 3));
+
+    std::vector<std::pair<TIMESTAMP, int>> more{{base + milliseconds(4), 4}, {base + milliseconds(5), 5}};
+    std::vector<TimerHandle>               handles;
+    queue.addEvents(more.begin(), more.end(), std::back_inserter(handles));
+    CHECK(handles.size() == 2 && handles[0].valid() && handles[1].valid());
+
+    queue.updateTimestamps(std::vector<std::pair<TIMESTAMP, TimerHandle>>{{base + milliseconds(6), handles[0]}});
+    queue.removeEvents(std::vector<int>{1});
+    queue.removeEvents(std::vector<TIMESTAMP>{base + milliseconds(2)});
+    queue.processExpired(base + milliseconds(10));
+    CHECK((expired == std::vector<std::pair<TIMESTAMP, int>>{{base + milliseconds(1), 2}, {base + milliseconds(5), 5}, {base + milliseconds(6), 4}}));
+    CHECK(queue.size() == 0);
+}
+
+void runBatchTests()
+{
+    testBatch<SubmissionMode::Locked>();
+    testBatch<SubmissionMode::LockFree>();
+}
+
+/**
+ * @brief Checks that an InlineFunction holds move-only targets, moves them between objects and destroys them exactly once.
+ */
+void testInlineFunction()
+{
+    auto                                  state = std::make_shared<int>(1);
+    InlineFunction<int(int)>              empty;
+    InlineFunction<int(int)>              nothing(nullptr);
+    InlineFunction<int(int)>              add([state](int value) { return *state + value; });
+    InlineFunction<int(int), sizeof(int)> small([](int value) { return value; });
+    CHECK(!empty && !nothing && add && small);
+    CHECK(add(2) == 3 && small(4) == 4 && state.use_count() == 2);
+
+    auto moved = std::move(add);
+    CHECK(!add && moved && moved(3) == 4 && state.use_count() == 2);
+    empty = std::move(moved);
+    CHECK(!moved && empty(4) == 5 && state.use_count() == 2);
+    empty = InlineFunction<int(int)>([](int value) { return -value; });
+    CHECK(empty(5) == -5 && state.use_count() == 1);
+
+    InlineFunction<int()> owner([pointer = std::make_unique<int>(6)] { return *pointer; });
+    InlineFunction<int()> other(std::move(owner));
+    CHECK(!owner && other() == 6);
+
+    InlineFunction<void()> reset([state] {});
+    CHECK(state.use_count() == 2);
+    reset.reset();
+    CHECK(!reset && state.use_count() == 1);
+}
+
+/**
+ * @brief Checks that an ActionTimedEventQueue calls the action of every expired event in order, and destroys the
+ * actions of removed, expired and pending events.
+ */
+void testActionQueue()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> fired;
+    auto                                   state = std::make_shared<int>(0);
+    auto                                   record = [&fired, &state](int value) {
+        return [&fired, state, value](const TIMESTAMP& timestamp) { fired.emplace_back(timestamp, value + *state); };
+    };
+    TimedEventQueueOptions options;
+    options.externalDriver = true;
+    {
+        ActionTimedEventQueue<> queue(InvokeEventAction(), options);
+        auto                    base    = TIME::now() + std::chrono::seconds(1);
+        auto                    second  = queue.addEvent(base + milliseconds(2), record(2));
+        auto                    removed = queue.addEvent(base + milliseconds(3), record(3));
+        queue.addEvent(base + milliseconds(1), record(1));
+        queue.emplaceEvent(base + milliseconds(4), [pointer = std::make_unique<int>(4), &fired](const TIMESTAMP& timestamp) {
+            fired.emplace_back(timestamp, *pointer);
+        });
+        queue.addEvent(base + std::chrono::hours(1), record(5));
+        CHECK(queue.size() == 5 && state.use_count() == 5);
+
+        CHECK(queue.removeEvent(removed) && !queue.removeEvent(removed));
+        CHECK(state.use_count() == 4);
+        CHECK(queue.updateTimestamp(base + milliseconds(5), second));
+        CHECK(queue.processExpired(base + milliseconds(5)) == 3);
+        CHECK((fired == std::vector<std::pair<TIMESTAMP, int>>{{base + milliseconds(1), 1}, {base + milliseconds(4), 4}, {base + milliseconds(5), 2}}));
+        CHECK(queue.size() == 1 && state.use_count() == 2);
+    }
+    // The queue destroys the action of the event still pending.
+    CHECK(state.use_count() == 1);
+
+    // A queue with a worker calls the actions on the worker thread.
+    ActionTimedEventQueue<> queue;
+    std::atomic<bool>       called{false};
+    std::thread::id         thread;
+    queue.addEventAfter(milliseconds(5), [&called, &thread](const TIMESTAMP&) {
+        thread = std::this_thread::get_id();
+        called.store(true);
+    });
+    CHECK(eventually([&] { return called.load(); }));
+    CHECK(thread != std::this_thread::get_id());
+    queue.stop();
+}
+
+void runActionTests()
+{
+    testInlineFunction();
+    testActionQueue();
+}
+
+/**
+ * @brief An event recorded by a dispatch thread, with the thread that dispatched it.
+ */
+struct DispatchedEvent
+{
+    TIMESTAMP       timestamp;
+    int             value;
+    std::thread::id thread;
+};
+
+/**
+ * @brief The events dispatched so far, recorded by several dispatch threads.
+ */
+struct Dispatched
+{
+    std::mutex                   mutex;
+    std::vector<DispatchedEvent> events;
+
+    void record(const TIMESTAMP& timestamp, int value)
+    {
+        // Let the other dispatch threads run, so that orderings that are not kept show up.
+        if(value % 4 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        std::scoped_lock lock(mutex);
+        events.push_back({timestamp, value, std::this_thread::get_id()});
+    }
+
+    std::size_t size()
+    {
+        std::scoped_lock lock(mutex);
+        return events.size();
+    }
+};
+
+/**
+ * @brief The callback of the dispatch tests, keying every event by its value modulo 3 for DispatchOrdering::PerKey.
+ */
+struct RecordDispatch
+{
+    Dispatched* dispatched;
+
+    void operator()(const TIMESTAMP& timestamp, int&& value) const { dispatched->record(timestamp, value); }
+
+    std::size_t dispatchKey(const TIMESTAMP&, const int& value) const { return static_cast<std::size_t>(value % 3); }
+};
+
+/**
+ * @brief Checks the order in which the events of @p dispatched ran against the order they expired in, @p expected.
+ *
+ * DispatchOrdering::Strict keeps the expiration order on a single thread,
+ * PerKey keeps it for the events of every key, each key staying on one
+ * thread, and None only dispatches every event once.
+ */
+void checkDispatchOrder(DispatchOrdering ordering, const std::vector<DispatchedEvent>& dispatched, std::vector<std::pair<TIMESTAMP, int>> expected)
+{
+    std::vector<std::pair<TIMESTAMP, int>> order;
+    for(const auto& event : dispatched)
+    {
+        order.emplace_back(event.timestamp, event.value);
+    }
+    auto ofKey = [](std::vector<std::pair<TIMESTAMP, int>> events, int key) {
+        events.erase(std::remove_if(events.begin(), events.end(), [key](const auto& event) { return event.second % 3 != key; }), events.end());
+        return events;
+    };
+    auto oneThread = [&](int key) {
+        std::thread::id thread;
+        for(const auto& event : dispatched)
+        {
+            if(key >= 0 && event.value % 3 != key)
+            {
+                continue;
+            }
+            if(thread != std::thread::id() && event.thread != thread)
+            {
+                return false;
+            }
+            thread = event.thread;
+        }
+        return true;
+    };
+    CHECK(order.size() == expected.size());
+    switch(ordering)
+    {
+    case DispatchOrdering::Strict:
+        CHECK(order == expected);
+        CHECK(oneThread(-1));
+        break;
+    case DispatchOrdering::PerKey:
+        for(auto key = 0; key < 3; ++key)
+        {
+            CHECK(ofKey(order, key) == ofKey(expected, key));
+            CHECK(oneThread(key));
+        }
+        break;
+    case DispatchOrdering::None:
+        std::sort(order.begin(), order.end());
+        std::sort(expected.begin(), expected.end());
+        CHECK(order == expected);
+        break;
+    }
+    CHECK(std::none_of(dispatched.begin(), dispatched.end(), [](const DispatchedEvent& event) { return event.thread == std::this_thread::get_id(); }));
+}
+
+/**
+ * @brief Posts events to a DispatchPool in several flushes, then stops it, which has to dispatch every flushed event.
+ */
+void testDispatchPool(DispatchOrdering ordering)
+{
+    constexpr int EVENTS = 300;
+
+    Dispatched                             dispatched;
+    auto                                   base = TIME::now();
+    std::vector<std::pair<TIMESTAMP, int>> expected;
+    {
+        DispatchPool<int, RecordDispatch> pool(3, ordering, RecordDispatch{&dispatched});
+        for(auto value = 0; value < EVENTS; ++value)
+        {
+            auto timestamp = base + std::chrono::milliseconds(value / 7);
+            pool.post(static_cast<std::size_t>(value % 3), timestamp, int(value));
+            expected.emplace_back(timestamp, value);
+            if(value % 50 == 49)
+            {
+                pool.flush();
+            }
+        }
+        pool.stop();
+    }
+    checkDispatchOrder(ordering, dispatched.events, expected);
+}
+
+/**
+ * @brief Expires events sharing timestamps through a queue with dispatch threads and checks the dispatch order.
+ */
+void testDispatchThreads(DispatchOrdering ordering)
+{
+    constexpr int EVENTS = 120;
+
+    Dispatched             dispatched;
+    TimedEventQueueOptions options;
+    options.externalDriver   = true;
+    options.dispatchThreads  = 3;
+    options.dispatchOrdering = ordering;
+    BasicTimedEventQueue<int, RecordDispatch> queue(RecordDispatch{&dispatched}, options);
+
+    auto                                   base = TIME::now() + std::chrono::seconds(1);
+    std::vector<std::pair<TIMESTAMP, int>> expected;
+    for(auto value = 0; value < EVENTS; ++value)
+    {
+        // Later values get earlier timestamps, so the expiration order differs from the insertion order.
+        auto timestamp = base + std::chrono::milliseconds((EVENTS - value) / 5);
+        queue.addEvent(timestamp, value);
+        expected.emplace_back(timestamp, value);
+    }
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    CHECK(queue.processExpired(base + std::chrono::milliseconds(EVENTS / 10)) + queue.processExpired(base + std::chrono::seconds(1)) == EVENTS);
+    CHECK(eventually([&] { return dispatched.size() == EVENTS; }));
+    queue.stop();
+    checkDispatchOrder(ordering, dispatched.events, expected);
+}
+
+void runDispatchTests()
+{
+    for(auto ordering : {DispatchOrdering::Strict, DispatchOrdering::PerKey, DispatchOrdering::None})
+    {
+        testDispatchPool(ordering);
+        testDispatchThreads(ordering);
+    }
+}
+
+/**
+ * @brief Returns whether @p fn throws a std::logic_error.
+ */
+template<typename F>
+bool throwsLogicError(F fn)
+{
+    try
+    {
+        fn();
+    }
+    catch(const std::logic_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Checks that lookups by handle find the events of a lock-free queue from any thread while the worker applies
+ * commands, and that lookups by value are only accepted on the thread driving the queue.
+ */
+void testLockFreeLookups()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.submissionMode     = SubmissionMode::LockFree;
+    options.maxPendingCommands = 1; // Wakes the worker for every command, so removals are applied at once too.
+    {
+        BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+        auto                              deadline = TIME::now() + std::chrono::hours(1);
+        auto                              handle   = queue.addEvent(deadline, 1);
+        CHECK(eventually([&] { return queue.contains(handle); }));
+        auto left = queue.timeUntil(handle);
+        CHECK(left && *left > std::chrono::minutes(59) && *left <= std::chrono::hours(1));
+        CHECK(throwsLogicError([&] { queue.contains(1); }));
+        CHECK(throwsLogicError([&] { queue.timeUntil(1); }));
+
+        // A ticket reserved again for another event is not confused with the removed one.
+        CHECK(queue.removeEvent(handle));
+        CHECK(eventually([&] { return !queue.contains(handle); }));
+        auto again = queue.addEvent(deadline, 2);
+        CHECK(eventually([&] { return queue.contains(again); }));
+        CHECK(!queue.contains(handle) && !queue.timeUntil(handle));
+
+        // Readers race with the worker binding, rescheduling and releasing tickets.
+        std::atomic<bool>        done{false};
+        std::vector<TimerHandle> removed;
+        std::mutex               mutex;
+        std::thread              reader([&] {
+            while(!done.load())
+            {
+                std::vector<TimerHandle> stale;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stale = removed;
+                }
+                CHECK(queue.contains(again));
+                for(const auto& handle : stale)
+                {
+                    CHECK(!queue.contains(handle));
+                }
+            }
+        });
+        for(auto round = 0; round < 200; ++round)
+        {
+            auto added = queue.addEvent(deadline + milliseconds(round), 10 + round);
+            queue.updateTimestamp(deadline + milliseconds(round + 1), added);
+            queue.removeEvent(added);
+            if(round % 20 == 0)
+            {
+                CHECK(eventually([&] { return !queue.contains(added); }));
+                std::lock_guard<std::mutex> lock(mutex);
+                removed.push_back(added);
+            }
+        }
+        done.store(true);
+        reader.join();
+        queue.stop();
+    }
+
+    // With an external driver, lookups by value work on the thread calling processExpired.
+    options.externalDriver = true;
+    BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+    auto                              base = TIME::now() + std::chrono::seconds(1);
+    queue.addEvent(base, 3);
+    CHECK(throwsLogicError([&] { queue.contains(3); }));
+    queue.processExpired(TIME::now());
+    CHECK(queue.contains(3) && queue.timeUntil(3));
+    auto other = false;
+    std::thread([&] { other = throwsLogicError([&] { queue.contains(3); }); }).join();
+    CHECK(other);
+    CHECK(queue.processExpired(base) == 1 && !queue.contains(3));
+}
+
+/**
+ * @brief Checks that the slack delays the next deadline of an externally driven queue and batches the events due by then.
+ */
+void testSlackDeadline()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    options.slack          = milliseconds(5);
+    BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+
+    CHECK(queue.nextDeadline() == TIMESTAMP::max());
+    auto base = TIME::now() + std::chrono::seconds(1);
+    queue.addEvent(base + milliseconds(1), 2);
+    queue.addEvent(base, 1);
+    queue.addEvent(base + milliseconds(5), 3);
+    queue.addEvent(base + milliseconds(6), 4);
+    CHECK(queue.nextDeadline() == base + milliseconds(5));
+    CHECK(queue.processExpired(queue.nextDeadline()) == 3);
+    CHECK((expired == std::vector<std::pair<TIMESTAMP, int>>{{base, 1}, {base + milliseconds(1), 2}, {base + milliseconds(5), 3}}));
+    CHECK(queue.nextDeadline() == base + milliseconds(11));
+    CHECK(queue.processExpired(queue.nextDeadline()) == 1);
+    CHECK(queue.wakeups() == 2 && queue.averageBatchSize() == 2.0);
+    CHECK(queue.nextDeadline() == TIMESTAMP::max());
+}
+
+/**
+ * @brief The callback of the simulated slack test, recording every event with the virtual time it expired at.
+ */
+struct RecordTime
+{
+    std::vector<std::pair<int, TIMESTAMP>>* fired;
+    std::function<TIMESTAMP()>              now;
+
+    void operator()(const TIMESTAMP&, int&& value) const { fired->emplace_back(value, now()); }
+};
+
+/**
+ * @brief Checks on a simulated worker that every event fires at most the slack late, together with the events due by then.
+ */
+void testSlackWorker()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<int, TIMESTAMP>> fired;
+    BasicTimedEventQueue<int, RecordTime>* pointer = nullptr;
+    TimedEventQueueOptions                 options;
+    options.simulatedTime = true;
+    options.slack         = milliseconds(30);
+    BasicTimedEventQueue<int, RecordTime> queue(RecordTime{&fired, [&pointer] { return pointer->now(); }}, options);
+    pointer = &queue;
+
+    queue.holdTime();
+    queue.addEvent(TIMESTAMP(milliseconds(20)), 1);
+    queue.addEvent(TIMESTAMP(milliseconds(25)), 2);
+    queue.addEvent(TIMESTAMP(milliseconds(50)), 3);
+    queue.addEvent(TIMESTAMP(milliseconds(51)), 4);
+    queue.addEvent(TIMESTAMP(milliseconds(100)), 5);
+    queue.releaseTime();
+    queue.waitUntilIdle();
+    queue.stop();
+    auto at = [](int ms) { return TIMESTAMP(milliseconds(ms)); };
+    CHECK((fired == std::vector<std::pair<int, TIMESTAMP>>{{1, at(50)}, {2, at(50)}, {3, at(50)}, {4, at(81)}, {5, at(130)}}));
+    CHECK(queue.expiredEvents() == 5);
+}
+
+void runSlackTests()
+{
+    testSlackDeadline();
+    testSlackWorker();
+}
+
+/**
+ * @brief Checks that a simulated worker fires events in timestamp order at their virtual time, ties in the order they
+ * were added, with rescheduled, removed and relative events, and rejects the options it does not support.
+ */
+template<typename Storage>
+void testSimulated(const char* name, Storage storage)
+{
+    using std::chrono::milliseconds;
+
+    auto                                            failed = failures;
+    std::vector<std::pair<int, TIMESTAMP>>          fired;
+    BasicTimedEventQueue<int, RecordTime, Storage>* pointer = nullptr;
+    TimedEventQueueOptions                          options;
+    options.simulatedTime = true;
+    BasicTimedEventQueue<int, RecordTime, Storage> queue(RecordTime{&fired, [&pointer] { return pointer->now(); }}, options, std::move(storage));
+    pointer = &queue;
+    CHECK(queue.now() == TIMESTAMP());
+
+    auto at = [](int ms) { return TIMESTAMP(milliseconds(ms)); };
+    queue.holdTime();
+    queue.addEvent(at(30), 3);
+    queue.addEvent(at(10), 1);
+    queue.addEvent(at(5000), 6);
+    queue.addEvent(at(20), 2);
+    queue.addEvent(at(30), 4);
+    auto moved = queue.addEvent(at(15), 5);
+    queue.addEvent(at(40), 7);
+    queue.updateTimestamp(at(35), moved);
+    queue.removeEvent(7);
+    queue.addEventAfter(milliseconds(25), 8);
+    queue.releaseTime();
+    queue.waitUntilIdle();
+    queue.stop();
+    CHECK((fired == std::vector<std::pair<int, TIMESTAMP>>{{1, at(10)}, {2, at(20)}, {8, at(25)}, {3, at(30)}, {4, at(30)}, {5, at(35)}, {6, at(5000)}}));
+    CHECK(queue.now() == at(5000));
+    std::printf("simulated %s: %s\n", name, failures == failed ? "ok" : "failed");
+}
+
+void runSimulatedTests()
+{
+    testSimulated("ordered_map", OrderedMapStorage<int>());
+    testSimulated("heap", HeapStorage<int>());
+    testSimulated("timing_wheel", TimingWheelStorage<int>(std::chrono::milliseconds(1)));
+    testSimulated("coarse_timing_wheel", TimingWheelStorage<int>(std::chrono::milliseconds(5), 2));
+
+    for(auto invalid : {0, 1, 2})
+    {
+        TimedEventQueueOptions options;
+        options.simulatedTime   = true;
+        options.externalDriver  = invalid == 0;
+        options.submissionMode  = invalid == 1 ? SubmissionMode::LockFree : SubmissionMode::Locked;
+        options.dispatchThreads = invalid == 2 ? 1 : 0;
+        auto thrown             = false;
+        try
+        {
+            BasicTimedEventQueue<int, Record> queue(Record{nullptr}, options);
+        }
+        catch(const std::invalid_argument&)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
+
+#if defined(__linux__)
+/**
+ * @brief Returns whether the fd becomes readable within @p timeout.
+ */
+bool readable(int fd, std::chrono::milliseconds timeout)
+{
+    pollfd entry{fd, POLLIN, 0};
+    return ::poll(&entry, 1, static_cast<int>(timeout.count())) == 1 && (entry.revents & POLLIN) != 0;
+}
+
+/**
+ * @brief Checks that a TimerFd becomes readable at its deadline, stays readable until cleared, and can be disarmed.
+ */
+void testTimerFd()
+{
+    using std::chrono::milliseconds;
+
+    TimerFd timer;
+    CHECK(timer.fd() >= 0);
+    CHECK(!timer.clear());
+    timer.arm(TIME::now() + milliseconds(20));
+    CHECK(!readable(timer.fd(), milliseconds(0)));
+    timer.wait();
+    CHECK(readable(timer.fd(), milliseconds(0)));
+    CHECK(timer.clear());
+    CHECK(!timer.clear());
+    timer.arm(TIME::now() + milliseconds(10));
+    timer.arm(TIMESTAMP::max());
+    CHECK(!readable(timer.fd(), milliseconds(50)));
+    timer.wakeNow();
+    CHECK(readable(timer.fd(), milliseconds(1000)));
+    CHECK(timer.clear());
+}
+
+/**
+ * @brief Drives a queue from its timerfd like an epoll loop would, checking that the fd follows the earliest deadline.
+ */
+void testTimerFdDriver()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    options.waitBackend    = WaitBackend::TimerFd;
+    BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+
+    CHECK(queue.fd() >= 0);
+    CHECK(!readable(queue.fd(), milliseconds(20)));
+    auto now = TIME::now();
+    queue.addEvent(now + std::chrono::hours(1), 1);
+    CHECK(!readable(queue.fd(), milliseconds(20)));
+    queue.addEvent(now + milliseconds(30), 2);
+    queue.addEvent(now + milliseconds(40), 3);
+    CHECK(readable(queue.fd(), milliseconds(5000)));
+    CHECK(TIME::now() >= now + milliseconds(30));
+    auto polled = queue.poll();
+    polled += readable(queue.fd(), milliseconds(5000)) ? queue.poll() : 0;
+    CHECK(polled == 2);
+    CHECK((expired == std::vector<std::pair<TIMESTAMP, int>>{{now + milliseconds(30), 2}, {now + milliseconds(40), 3}}));
+    CHECK(!readable(queue.fd(), milliseconds(20)));
+    CHECK(queue.size() == 1);
+
+    BasicTimedEventQueue<int, Record> plain(Record{&expired}, TimedEventQueueOptions{});
+    CHECK(plain.fd() == -1);
+    plain.stop();
+}
+
+/**
+ * @brief Checks that a worker waiting on its timerfd expires events in order and wakes up for an earlier event.
+ */
+void testTimerFdWorker()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<int, TIMESTAMP>> fired;
+    TimedEventQueueOptions                 options;
+    options.waitBackend = WaitBackend::TimerFd;
+    BasicTimedEventQueue<int, RecordTime> queue(RecordTime{&fired, [] { return TIME::now(); }}, options);
+
+    auto now = TIME::now();
+    queue.addEvent(now + std::chrono::hours(1), 1);
+    queue.addEvent(now + milliseconds(40), 2);
+    queue.addEvent(now + milliseconds(20), 3);
+    CHECK(eventually([&] { return queue.size() == 1; }));
+    queue.stop();
+    CHECK(fired.size() == 2 && fired[0].first == 3 && fired[1].first == 2);
+    CHECK(fired.size() == 2 && fired[0].second >= now + milliseconds(20) && fired[1].second >= now + milliseconds(40));
+}
+
+void runTimerFdTests()
+{
+    testTimerFd();
+    testTimerFdDriver();
+    testTimerFdWorker();
+}
+#endif
+
+/**
+ * @brief Drives periodic events with both recurrences through late expirations, reschedules and removals.
+ */
+template<typename Storage>
+void testPeriodic(const char* name)
+{
+    using std::chrono::milliseconds;
+    using Expired = std::vector<std::pair<TIMESTAMP, int>>;
+
+    auto                   failed = failures;
+    Expired                expired;
+    TimedEventQueueOptions options;
+    options.externalDriver = true;
+    options.singleThreaded = true;
+    BasicTimedEventQueue<int, Record, Storage> queue(Record{&expired}, options);
+
+    auto base  = TIME::now() + std::chrono::seconds(1);
+    auto at    = [base](int offset) { return base + milliseconds(offset); };
+    auto rate  = queue.addPeriodicEvent(base, milliseconds(10), 1);
+    auto delay = queue.addPeriodicEvent(at(5), milliseconds(10), 2, Recurrence::FixedDelay);
+    CHECK(rate.valid() && delay.valid());
+
+    CHECK(queue.processExpired(base) == 1);
+    CHECK(queue.nextDeadline() == at(5));
+    CHECK(queue.processExpired(at(8)) == 1);
+    CHECK(queue.nextDeadline() == at(10));
+    CHECK((expired == Expired{{base, 1}, {at(5), 2}}));
+
+    // Running late: the fixed rate event fires once and skips to its grid, the fixed delay event shifts.
+    expired.clear();
+    CHECK(queue.processExpired(at(45)) == 2);
+    CHECK((expired == Expired{{at(10), 1}, {at(18), 2}}));
+    CHECK(queue.nextDeadline() == at(50));
+    CHECK(queue.processExpired(at(50)) == 1);
+    CHECK(queue.nextDeadline() == at(55));
+    CHECK(queue.contains(rate) && queue.contains(1) && queue.contains(delay) && queue.size() == 2);
+
+    // Moving the next occurrence keeps the event periodic from there.
+    CHECK(queue.updateTimestamp(at(53), rate));
+    CHECK(queue.processExpired(at(53)) == 1);
+    CHECK(queue.processExpired(at(55)) == 1);
+    CHECK(queue.nextDeadline() == at(63));
+    CHECK((expired == Expired{{at(10), 1}, {at(18), 2}, {at(50), 1}, {at(53), 1}, {at(55), 2}}));
+
+    // Removing the event stops it, by handle, by value or by its current timestamp.
+    expired.clear();
+    CHECK(queue.removeEvent(rate));
+    CHECK(!queue.contains(rate));
+    CHECK(queue.nextDeadline() == at(65));
+    queue.removeEvent(at(65));
+    CHECK(queue.size() == 0 && !queue.contains(delay));
+    queue.addPeriodicEvent(at(70), milliseconds(10), 3);
+    queue.removeEvent(3);
+    CHECK(queue.size() == 0);
+    CHECK(queue.processExpired(at(1000)) == 0);
+    CHECK(expired.empty());
+
+    auto thrown = false;
+    try
+    {
+        queue.addPeriodicEvent(base, milliseconds(0), 4);
+    }
+    catch(const std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    CHECK(thrown && queue.size() == 0);
+    std::printf("periodic %s: %s\n", name, failures == failed ? "ok" : "failed");
+}
+
+/**
+ * @brief Checks that a periodic event with an interval shorter than the tick of a TimingWheelStorage fires at most once per tick.
+ */
+void testPeriodicTick()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    options.singleThreaded = true;
+    BasicTimedEventQueue<int, Record, TimingWheelStorage<int>> queue(Record{&expired}, TimingWheelStorage<int>(milliseconds(10), 2), options);
+
+    auto base = TIME::now() + std::chrono::seconds(1);
+    queue.addPeriodicEvent(base, milliseconds(1), 1);
+    for(auto step = 0; step <= 100; ++step)
+    {
+        queue.processExpired(base + milliseconds(step));
+    }
+    CHECK(expired.size() >= 9 && expired.size() <= 11);
+    CHECK(queue.size() == 1);
+}
+
+void runPeriodicTests()
+{
+    testPeriodic<OrderedMapStorage<int>>("ordered_map");
+    testPeriodic<HeapStorage<int>>("heap");
+    testPeriodicTick();
+}
+
+/**
+ * @brief The callback of the snapshot tests, recording the expired events of a queue of strings in order.
+ */
+struct RecordString
+{
+    std::vector<std::pair<TIMESTAMP, std::string>>* expired;
+
+    void operator()(const TIMESTAMP& timestamp, std::string&& value) const { expired->emplace_back(timestamp, std::move(value)); }
+};
+
+using StringQueue = BasicTimedEventQueue<std::string, RecordString>;
+
+void serializeString(const std::string& value, std::string& bytes) { bytes += value; }
+
+std::string deserializeString(std::string_view bytes) { return std::string(bytes); }
+
+/**
+ * @brief Returns whether calling @p fn throws a std::runtime_error.
+ */
+template<typename F>
+bool throwsRuntimeError(F fn)
+{
+    try
+    {
+        fn();
+    }
+    catch(const std::runtime_error&)
+    {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Saves one-shot and periodic events with values of several sizes, loads them into another queue and expires them there.
+ */
+void testSnapshotRoundTrip()
+{
+    using std::chrono::minutes;
+
+    std::vector<std::pair<TIMESTAMP, std::string>> expired;
+    TimedEventQueueOptions                         options;
+    options.externalDriver = true;
+    StringQueue source(RecordString{&expired}, options);
+
+    auto start = TIME::now();
+    source.addEvent(start + minutes(60), "a");
+    source.addPeriodicEvent(start + minutes(90), minutes(10), "periodic!", Recurrence::FixedDelay);
+    source.addEvent(start + minutes(30), "");
+    source.addEvent(start + minutes(45), std::string(20, 'x'));
+    source.removeEvent(start + minutes(45));
+
+    std::stringstream stream;
+    CHECK(source.saveSnapshot(stream, serializeString) == 3);
+    auto bytes = stream.str();
+    CHECK(bytes.size() % 8 == 0);
+    CHECK(bytes.size() == sizeof(SnapshotHeader) + 3 * sizeof(SnapshotRecord) + 0 + 8 + 16);
+    auto header = SnapshotHeader{};
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    CHECK(std::memcmp(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic)) == 0);
+    CHECK(header.version == SnapshotHeader::VERSION && header.count == 3);
+    auto first = SnapshotRecord{};
+    std::memcpy(&first, bytes.data() + sizeof(header), sizeof(first));
+    CHECK(first.size == 0 && first.period == 0);
+
+    StringQueue target(RecordString{&expired}, options);
+    CHECK(target.loadSnapshot(stream, deserializeString) == 3);
+    auto drift = TIME::now() - start;
+    CHECK(target.size() == 3 && target.contains(std::string("periodic!")));
+    auto due = start + minutes(91) + drift;
+    CHECK(target.processExpired(due) == 3);
+    CHECK(expired.size() == 3 && expired[0].second.empty() && expired[1].second == "a" && expired[2].second == "periodic!");
+    auto offsets = std::vector<minutes>{minutes(30), minutes(60), minutes(90)};
+    for(std::size_t event = 0; event < expired.size() && event < offsets.size(); ++event)
+    {
+        auto shift = expired[event].first - (start + offsets[event]);
+        CHECK(shift >= TIMESTAMP::duration::zero() && shift <= drift);
+    }
+    CHECK(target.size() == 1 && target.nextDeadline() == due + minutes(10));
+    CHECK(source.size() == 3);
+}
+
+/**
+ * @brief Writes a snapshot by hand and checks how loading it applies the downtime and rejects malformed input.
+ */
+void testSnapshotFormat()
+{
+    using std::chrono::minutes;
+
+    auto header = SnapshotHeader{};
+    std::memcpy(header.magic, SnapshotHeader::MAGIC, sizeof(header.magic));
+    header.version = SnapshotHeader::VERSION;
+    header.count   = 2;
+    header.savedAt = std::chrono::duration_cast<std::chrono::nanoseconds>((std::chrono::system_clock::now() - minutes(60)).time_since_epoch()).count();
+    auto record    = SnapshotRecord{};
+    record.size    = 3;
+    std::string snapshot(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(auto deadline : {minutes(30), minutes(90)})
+    {
+        record.deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline).count();
+        snapshot.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        snapshot.append(deadline == minutes(30) ? "due" : "new");
+        snapshot.append(5, '\0');
+    }
+
+    std::vector<std::pair<TIMESTAMP, std::string>> expired;
+    TimedEventQueueOptions                         options;
+    options.externalDriver = true;
+    {
+        // The event due 30 minutes after a snapshot taken an hour ago is overdue.
+        StringQueue       queue(RecordString{&expired}, options);
+        std::stringstream stream(snapshot);
+        CHECK(queue.loadSnapshot(stream, deserializeString, true) == 2);
+        CHECK(queue.processExpired(TIME::now()) == 1);
+        CHECK(expired.size() == 1 && expired[0].second == "due");
+        CHECK(queue.nextDeadline() > TIME::now() + minutes(29) && queue.nextDeadline() < TIME::now() + minutes(31));
+    }
+    {
+        StringQueue       queue(RecordString{&expired}, options);
+        std::stringstream stream(snapshot);
+        CHECK(queue.loadSnapshot(stream, deserializeString) == 2);
+        CHECK(queue.processExpired(TIME::now()) == 0);
+    }
+    {
+        // A truncated snapshot throws, and the events read before stay in the queue.
+        StringQueue       queue(RecordString{&expired}, options);
+        std::stringstream stream(snapshot.substr(0, snapshot.size() - 4));
+        CHECK(throwsRuntimeError([&] { queue.loadSnapshot(stream, deserializeString); }));
+        CHECK(queue.size() == 1 && queue.contains(std::string("due")));
+    }
+    {
+        StringQueue queue(RecordString{&expired}, options);
+        auto        load = [&](std::string bytes) {
+            std::stringstream stream(bytes);
+            queue.loadSnapshot(stream, deserializeString);
+        };
+        auto badMagic = snapshot;
+        badMagic[0]   = 'X';
+        CHECK(throwsRuntimeError([&] { load(badMagic); }));
+        auto badVersion = snapshot;
+        badVersion[offsetof(SnapshotHeader, version)] += 1;
+        CHECK(throwsRuntimeError([&] { load(badVersion); }));
+        auto badRecurrence = snapshot;
+        badRecurrence[sizeof(SnapshotHeader) + offsetof(SnapshotRecord, recurrence)] = 7;
+        CHECK(throwsRuntimeError([&] { load(badRecurrence); }));
+        CHECK(throwsRuntimeError([&] { load(""); }));
+        CHECK(queue.size() == 0);
+    }
+}
+
+/**
+ * @brief Loads a snapshot into a full storage and with SubmissionMode::LockFree, checking what loadSnapshot reports.
+ */
+void testSnapshotLoading()
+{
+    using std::chrono::minutes;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver = true;
+    BasicTimedEventQueue<int, Record> source(Record{&expired}, options);
+    for(auto value = 0; value < 5; ++value)
+    {
+        source.addEvent(TIME::now() + minutes(value + 1), value);
+    }
+    std::stringstream stream;
+    CHECK(source.saveSnapshot(stream, TrivialSerializer<int>()) == 5);
+    auto snapshot = stream.str();
+
+    BasicTimedEventQueue<int, Record> full(Record{&expired}, OrderedMapStorage<int>(StorageMemory(3)), options);
+    std::stringstream                 fullStream(snapshot);
+    CHECK(full.loadSnapshot(fullStream, TrivialSerializer<int>()) == 3);
+    CHECK(full.size() == 3 && full.capacityRejections() == 2);
+    CHECK(full.contains(0) && full.contains(2) && !full.contains(3));
+
+    options.submissionMode = SubmissionMode::LockFree;
+    BasicTimedEventQueue<int, Record> lockFree(Record{&expired}, options);
+    std::stringstream                 lockFreeStream(snapshot);
+    CHECK(lockFree.loadSnapshot(lockFreeStream, TrivialSerializer<int>()) == 5);
+    lockFree.processExpired(TIME::now());
+    CHECK(lockFree.size() == 5);
+    CHECK(expired.empty());
+}
+
+void runSnapshotTests()
+{
+    testSnapshotRoundTrip();
+    testSnapshotFormat();
+    testSnapshotLoading();
+}
+
+/**
+ * @brief The callback of the spin tests, recording every event with the time it expired at.
+ */
+struct RecordAt
+{
+    std::mutex*                             mutex;
+    std::vector<std::pair<int, TIMESTAMP>>* fired;
+
+    void operator()(const TIMESTAMP&, int&& value) const
+    {
+        auto                        now = TIME::now();
+        std::lock_guard<std::mutex> lock(*mutex);
+        fired->emplace_back(value, now);
+    }
+};
+
+/**
+ * @brief Checks that a spinning worker expires events no earlier than their timestamp, stops spinning for an earlier
+ * event and for stop(), and that the options it does not support are rejected.
+ */
+void testSpinning()
+{
+    using std::chrono::milliseconds;
+
+    std::mutex                             mutex;
+    std::vector<std::pair<int, TIMESTAMP>> fired;
+    auto                                   count = [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return fired.size();
+    };
+    {
+        // The worker blocks until 10ms before each deadline and spins for the rest.
+        TimedEventQueueOptions options;
+        options.spinThreshold = milliseconds(10);
+        BasicTimedEventQueue<int, RecordAt> queue(RecordAt{&mutex, &fired}, options);
+        auto                                start = TIME::now();
+        queue.addEvent(start + milliseconds(40), 2);
+        queue.addEvent(start + milliseconds(20), 1);
+        CHECK(eventually([&] { return count() == 2; }));
+        std::lock_guard<std::mutex> lock(mutex);
+        CHECK(fired[0].first == 1 && fired[0].second >= start + milliseconds(20));
+        CHECK(fired[1].first == 2 && fired[1].second >= start + milliseconds(40));
+    }
+    fired.clear();
+    {
+        // The threshold exceeds the wait, so the worker spins at once, and an earlier event ends the spin.
+        TimedEventQueueOptions options;
+        options.spinThreshold = std::chrono::hours(2);
+        BasicTimedEventQueue<int, RecordAt> queue(RecordAt{&mutex, &fired}, options);
+        auto                                start = TIME::now();
+        queue.addEvent(start + std::chrono::hours(1), 2);
+        std::this_thread::sleep_for(milliseconds(10));
+        queue.addEvent(start + milliseconds(20), 1);
+        CHECK(eventually([&] { return count() == 1; }));
+        CHECK(queue.size() == 1 && fired[0].first == 1 && fired[0].second >= start + milliseconds(20));
+
+        // stop() ends the spin towards the remaining event.
+        auto stopping = TIME::now();
+        queue.stop();
+        CHECK(TIME::now() - stopping < std::chrono::seconds(5) && count() == 1);
+    }
+
+    auto rejected = [](std::chrono::nanoseconds threshold, WaitBackend backend) {
+        TimedEventQueueOptions options;
+        options.spinThreshold = threshold;
+        options.waitBackend   = backend;
+        try
+        {
+            BasicTimedEventQueue<int, Record> queue(Record{nullptr}, options);
+        }
+        catch(const std::invalid_argument&)
+        {
+            return true;
+        }
+        return false;
+    };
+    CHECK(rejected(std::chrono::nanoseconds(-1), WaitBackend::ConditionVariable));
+    CHECK(rejected(milliseconds(1), WaitBackend::TimerFd));
+}
+
+/**
+ * @brief Expires a run of stale events, some repeating the same value, with every StalePolicy and checks what is delivered and counted.
+ */
+void testStalePolicies()
+{
+    using std::chrono::milliseconds;
+    using Expired = std::vector<std::pair<TIMESTAMP, int>>;
+
+    auto base = TIME::now() + std::chrono::seconds(1);
+    auto at   = [base](int offset) { return base + milliseconds(offset); };
+    auto run  = [&](StalePolicy policy, Expired& expired) {
+        TimedEventQueueOptions options;
+        options.externalDriver = true;
+        options.singleThreaded = true;
+        options.staleAfter     = milliseconds(10);
+        options.stalePolicy    = policy;
+        auto queue = std::make_unique<BasicTimedEventQueue<int, Record, OrderedMapStorage<int, NoValueIndex>>>(Record{&expired}, options);
+        for(const auto& [offset, value] : std::vector<std::pair<int, int>>{{0, 1}, {1, 1}, {2, 2}, {3, 1}, {4, 1}, {50, 3}})
+        {
+            queue->addEvent(at(offset), value);
+        }
+        CHECK(queue->processExpired(at(55)) == expired.size());
+        CHECK(queue->expiredEvents() == expired.size());
+        return queue;
+    };
+
+    Expired late;
+    auto    deliverLate = run(StalePolicy::DeliverLate, late);
+    CHECK((late == Expired{{at(0), 1}, {at(1), 1}, {at(2), 2}, {at(3), 1}, {at(4), 1}, {at(50), 3}}));
+    CHECK(deliverLate->lateEvents() == 5 && deliverLate->droppedEvents() == 0 && deliverLate->collapsedEvents() == 0);
+
+    Expired dropped;
+    auto    drop = run(StalePolicy::Drop, dropped);
+    CHECK((dropped == Expired{{at(50), 3}}));
+    CHECK(drop->droppedEvents() == 5 && drop->lateEvents() == 0);
+
+    // Only the repetitions of a value are collapsed; the stale event with another value in between is delivered.
+    Expired collapsed;
+    auto    collapse = run(StalePolicy::Collapse, collapsed);
+    CHECK((collapsed == Expired{{at(1), 1}, {at(2), 2}, {at(4), 1}, {at(50), 3}}));
+    CHECK(collapse->collapsedEvents() == 2 && collapse->averageBatchSize() == 4.0);
+}
+
+/**
+ * @brief Checks that maxExpirationsPerDrain splits a backlog into bounded drains that keep the expiration order.
+ */
+void testMaxExpirationsPerDrain()
+{
+    using std::chrono::milliseconds;
+
+    std::vector<std::pair<TIMESTAMP, int>> expired;
+    TimedEventQueueOptions                 options;
+    options.externalDriver         = true;
+    options.maxExpirationsPerDrain = 3;
+    BasicTimedEventQueue<int, Record> queue(Record{&expired}, options);
+
+    auto base = TIME::now() + std::chrono::seconds(1);
+    for(auto value = 0; value < 7; ++value)
+    {
+        queue.addEvent(base + milliseconds(7 - value), value);
+    }
+    auto now = base + milliseconds(10);
+    CHECK(queue.processExpired(now) == 3);
+    CHECK(queue.nextDeadline() <= now && queue.truncatedDrains() == 1);
+    CHECK(queue.processExpired(now) == 3);
+    CHECK(queue.processExpired(now) == 1);
+    CHECK(queue.truncatedDrains() == 2 && queue.size() == 0);
+    CHECK(expired.size() == 7 && std::is_sorted(expired.begin(), expired.end()));
+
+    // The limit counts the dropped events too, while processExpired only counts the delivered ones.
+    expired.clear();
+    options.staleAfter  = milliseconds(5);
+    options.stalePolicy = StalePolicy::Drop;
+    BasicTimedEventQueue<int, Record> dropping(Record{&expired}, options);
+    for(auto value = 0; value < 4; ++value)
+    {
+        dropping.addEvent(base + milliseconds(value * 3), value);
+    }
+    CHECK(dropping.processExpired(base + milliseconds(10)) == 1);
+    CHECK(dropping.droppedEvents() == 2 && dropping.size() == 1);
+    CHECK(dropping.processExpired(base + milliseconds(10)) == 1);
+    CHECK((expired == std::vector<std::pair<TIMESTAMP, int>>{{base + milliseconds(6), 2}, {base + milliseconds(9), 3}}));
+}
+
+void runOverloadTests()
+{
+    testStalePolicies();
+    testMaxExpirationsPerDrain();
+}
+
+/**
+ * @brief The callback of the tests whose events never expire.
+ */
+struct Discard
+{
+    void operator()(const TIMESTAMP&, int&&) const {}
+};
+
+/**
+ * @brief Checks that only additions and reschedules that leave the next expiration as it is count as avoided wakeups.
+ */
+template<SubmissionMode Mode>
+void testAvoidedWakeups()
+{
+    TimedEventQueueOptions options;
+    options.submissionMode = Mode;
+    BasicTimedEventQueue<int, Discard> queue(Discard{}, options);
+
+    auto now    = TIME::now();
+    auto handle = queue.addEvent(now + std::chrono::hours(1), 1);
+    auto before = queue.avoidedWakeups();
+    queue.updateValue(now + std::chrono::hours(1), 2);
+    queue.removeEvent(3);
+    queue.removeEvent(now + std::chrono::hours(3));
+    CHECK(queue.avoidedWakeups() == before);
+    queue.addEvent(now + std::chrono::hours(2), 4);
+    queue.updateTimestamp(now + std::chrono::hours(2), handle);
+    CHECK(queue.avoidedWakeups() == before + 2);
+    queue.stop();
+}
+
+void runWakeupTests()
+{
+    testAvoidedWakeups<SubmissionMode::Locked>();
+    testAvoidedWakeups<SubmissionMode::LockFree>();
+}
+
+/**
+ * @brief The callback of the stress tests, counting how often each value expired.
+ */
+struct Count
+{
+    std::vector<std::atomic<int>>* fired;
+
+    void operator()(const TIMESTAMP&, int&& value) const { (*fired)[value].fetch_add(1, std::memory_order_relaxed); }
+};
+
+/**
+ * @brief Adds, reschedules and removes events from several threads with SubmissionMode::LockFree while the worker expires them.
+ *
+ * Every producer schedules near events, which all have to expire exactly
+ * once, and far events, which never expire and of which it removes some.
+ */
+template<typename Storage>
+void stressLockFree(const char* name)
+{
+    constexpr int PRODUCERS = 4;
+    constexpr int EVENTS    = 4000;
+
+    auto                          failed = failures;
+    std::vector<std::atomic<int>> fired(PRODUCERS * EVENTS);
+    std::atomic<int>              removed{0};
+    TimedEventQueueOptions        options;
+    options.submissionMode = SubmissionMode::LockFree;
+    BasicTimedEventQueue<int, Count, Storage> queue(Count{&fired}, options);
+
+    std::vector<std::thread> producers;
+    for(auto producer = 0; producer < PRODUCERS; ++producer)
+    {
+        producers.emplace_back([&, producer] {
+            for(auto event = 0; event < EVENTS; ++event)
+            {
+                auto value = producer * EVENTS + event;
+                auto now   = TIME::now();
+                if(event % 2 == 0)
+                {
+                    auto handle = queue.addEvent(now + std::chrono::microseconds(event % 20 * 100), value);
+                    if(event % 6 == 0)
+                    {
+                        queue.updateTimestamp(now + std::chrono::microseconds(200), handle);
+                    }
+                }
+                else
+                {
+                    auto handle = queue.addEvent(now + std::chrono::hours(1), value);
+                    if(event % 4 == 1 && queue.removeEvent(handle))
+                    {
+                        removed.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+        });
+    }
+    for(auto& producer : producers)
+    {
+        producer.join();
+    }
+
+    auto near = [&](int value) { return value % EVENTS % 2 == 0; };
+    CHECK(eventually([&] {
+        auto count = 0;
+        for(auto value = 0; value < PRODUCERS * EVENTS; ++value)
+        {
+            count += fired[value].load(std::memory_order_relaxed);
+        }
+        return count == PRODUCERS * EVENTS / 2;
+    }));
+    CHECK(removed.load() == PRODUCERS * EVENTS / 4);
+    CHECK(eventually([&] { return queue.size() == PRODUCERS * EVENTS / 4; }));
+    queue.stop();
+    for(auto value = 0; value < PRODUCERS * EVENTS; ++value)
+    {
+        CHECK(fired[value].load() == (near(value) ? 1 : 0));
+    }
+    std::printf("stress lock_free %s: %s\n", name, failures == failed ? "ok" : "failed");
+}
+
+template<typename Storage>
+struct Rearm;
+
+/**
+ * @brief The state shared by the threads of stressUnlocked.
+ */
+template<typename Storage>
+struct RearmState
+{
+    static constexpr int TOTAL = 3 * 3000; ///< The number of events the producers add. Every expired one is added again once, offset by TOTAL.
+
+    BasicTimedEventQueue<int, Rearm<Storage>, Storage>* queue = nullptr;
+    std::vector<std::atomic<int>>                      fired = std::vector<std::atomic<int>>(2 * TOTAL);
+    std::vector<std::atomic<int>>                      removed = std::vector<std::atomic<int>>(TOTAL);
+};
+
+/**
+ * @brief The callback of stressUnlocked, which calls back into the queue to add every expired event once more.
+ */
+template<typename Storage>
+struct Rearm
+{
+    RearmState<Storage>* state;
+
+    void operator()(const TIMESTAMP&, int&& value) const
+    {
+        state->fired[value].fetch_add(1, std::memory_order_relaxed);
+        if(value < RearmState<Storage>::TOTAL)
+        {
+            state->queue->addEvent(TIME::now() + std::chrono::microseconds(100), value + RearmState<Storage>::TOTAL);
+            state->queue->contains(value);
+        }
+    }
+};
+
+/**
+ * @brief Adds, reschedules, removes and looks up events from several threads with ExpirationMode::Unlocked while the callbacks add more.
+ *
+ * Every event added by a producer either expires or is removed, exactly once,
+ * and every expired one is added again by the callback and expires once more.
+ */
+template<typename Storage>
+void stressUnlocked(const char* name)
+{
+    constexpr int PRODUCERS = 3;
+    constexpr int EVENTS    = RearmState<Storage>::TOTAL / PRODUCERS;
+    constexpr int TOTAL     = RearmState<Storage>::TOTAL;
+
+    auto                   failed = failures;
+    RearmState<Storage>    state;
+    TimedEventQueueOptions options;
+    options.expirationMode = ExpirationMode::Unlocked;
+    BasicTimedEventQueue<int, Rearm<Storage>, Storage> queue(Rearm<Storage>{&state}, options);
+    state.queue = &queue;
+
+    std::atomic<bool>        done{false};
+    std::vector<std::thread> threads;
+    threads.emplace_back([&] {
+        for(auto value = 0; !done.load(std::memory_order_relaxed); value = (value + 7) % (2 * TOTAL))
+        {
+            queue.contains(value);
+            queue.timeUntil(TimerHandle{static_cast<std::uint32_t>(value % 64), static_cast<std::uint32_t>(value % 5)});
+        }
+    });
+    for(auto producer = 0; producer < PRODUCERS; ++producer)
+    {
+        threads.emplace_back([&, producer] {
+            for(auto event = 0; event < EVENTS; ++event)
+            {
+                auto value  = producer * EVENTS + event;
+                auto now    = TIME::now();
+                auto handle = queue.addEvent(now + std::chrono::microseconds(event % 10 * 100), value);
+                if(event % 5 == 0)
+                {
+                    queue.updateTimestamp(now + std::chrono::microseconds(50), handle);
+                }
+                if(event % 3 == 0 && queue.removeEvent(handle))
+                {
+                    state.removed[value].store(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for(std::size_t thread = 1; thread < threads.size(); ++thread)
+    {
+        threads[thread].join();
+    }
+
+    auto settled = [&] {
+        for(auto value = 0; value < TOTAL; ++value)
+        {
+            auto fired = state.fired[value].load(std::memory_order_relaxed);
+            if(fired + state.removed[value].load(std::memory_order_relaxed) != 1 || state.fired[value + TOTAL].load(std::memory_order_relaxed) != fired)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    CHECK(eventually(settled));
+    CHECK(eventually([&] { return queue.size() == 0; }));
+    done = true;
+    threads.front().join();
+    queue.stop();
+    CHECK(settled());
+    std::printf("stress unlocked %s: %s\n", name, failures == failed ? "ok" : "failed");
+}
+
+void runStressTests()
+{
+    stressLockFree<OrderedMapStorage<int>>("ordered_map");
+    stressLockFree<HeapStorage<int>>("heap");
+    stressLockFree<TimingWheelStorage<int>>("timing_wheel");
+    stressUnlocked<OrderedMapStorage<int>>("ordered_map");
+    stressUnlocked<HeapStorage<int>>("heap");
+    stressUnlocked<TimingWheelStorage<int>>("timing_wheel");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    return runTestSuites(argc, argv, {
+        {"model", runModelTests},
+        {"batch", runBatchTests},
+        {"actions", runActionTests},
+        {"dispatch", runDispatchTests},
+        {"lookup", testLockFreeLookups},
+        {"overload", runOverloadTests},
+        {"periodic", runPeriodicTests},
+        {"simulated", runSimulatedTests},
+        {"slack", runSlackTests},
+        {"snapshot", runSnapshotTests},
+        {"spin", testSpinning},
+#if defined(__linux__)
+        {"timerfd", runTimerFdTests},
+#endif
+        {"wakeups", runWakeupTests},
+        {"stress", runStressTests},
+    });
+}
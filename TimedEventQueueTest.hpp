@@ -0,0 +1,87 @@
+/**
+ * @file TimedEventQueueTest.hpp
+ * @brief The checks and the suite runner shared by the test executables of the queues.
+ *
+ * Every test executable lists its suites and runs the one named on the
+ * command line, or all of them without an argument, so that CTest registers
+ * each suite as a test of its own.
+ */
+#pragma once
+
+#include "TimedEventQueue.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <thread>
+
+/**
+ * @brief The number of failed checks of the running executable.
+ */
+inline int failures = 0;
+
+inline void check(bool passed, const char* condition, const char* file, int line)
+{
+    if(!passed)
+    {
+        ++failures;
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+    }
+}
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+/**
+ * @brief Waits until @p done returns true, polling it for at most @p timeout.
+ */
+template<typename Predicate>
+bool eventually(Predicate done, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+{
+    auto deadline = TIME::now() + timeout;
+    while(!done())
+    {
+        if(TIME::now() >= deadline)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+/**
+ * @brief A named group of tests, registered with CTest under its name.
+ */
+struct TestSuite
+{
+    const char* name;
+    void (*run)();
+};
+
+/**
+ * @brief Runs the suite named by the first argument, or every suite without one, and reports each.
+ *
+ * @return The exit code of the executable, nonzero if a check failed or the suite is unknown.
+ */
+inline int runTestSuites(int argc, char* argv[], std::initializer_list<TestSuite> suites)
+{
+    auto ran = false;
+    for(const auto& suite : suites)
+    {
+        if(argc > 1 && std::strcmp(argv[1], suite.name) != 0)
+        {
+            continue;
+        }
+        auto failed = failures;
+        suite.run();
+        std::printf("%s: %s\n", suite.name, failures == failed ? "ok" : "failed");
+        ran = true;
+    }
+    if(!ran)
+    {
+        std::fprintf(stderr, "unknown test suite %s\n", argv[1]);
+        return 2;
+    }
+    return failures == 0 ? 0 : 1;
+}
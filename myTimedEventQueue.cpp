@@ -4,6 +4,9 @@
 
 class MyTimedEventQueue : public TimedEventQueue<int>
 {
+public:
+    ~MyTimedEventQueue() override { stop(); }
+
 protected:
     void onTimestampExpire(const TIMESTAMP& timestamp, const int& value) override
     {